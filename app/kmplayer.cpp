@@ -1101,13 +1101,11 @@ void KMPlayerApp::slotSaveAs () {
         if (m_player->source ()) {
             KMPlayer::NodePtr doc = m_player->source ()->document ();
             if (doc) {
-                QTextStream ts (&file);
-                ts.setCodec("UTF-8");
-                ts << QString ("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+                file.write ("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
                 if (doc->childNodes ().length () == 1)
-                    ts << doc->innerXML ();
+                    doc->writeInnerXML (&file);
                 else
-                    ts << doc->outerXML ();
+                    doc->writeOuterXML (&file);
             }
         }
         file.close ();
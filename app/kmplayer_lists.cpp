@@ -8,7 +8,11 @@
 #include <QFile>
 #include <QUrl>
 #include <QTextStream>
+#include <QTextCodec>
 #include <QByteArray>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QTimer>
 #include <QInputDialog>
 #include <QStandardPaths>
 #include <QFileDialog>
@@ -67,14 +71,42 @@ void FileDocument::writeToFile (const QString & fn) {
     QFile file (fn);
     qCDebug(LOG_KMPLAYER_APP) << "writeToFile " << fn;
     file.open (QIODevice::WriteOnly | QIODevice::Truncate);
-    file.write (outerXML ().toUtf8 ());
+    writeOuterXML (&file);
     load_tree_version = m_tree_version;
 }
 
+static QString snapshotFile (const QString &fn) {
+    const QFileInfo fi (fn);
+    return fi.path () + QChar ('/') + fi.completeBaseName () + ".snapshot";
+}
+
+void FileDocument::load (const QString &fn) {
+    // the xml is read instead when it's newer, eg. copied from elsewhere
+    const QFileInfo xml (fn);
+    const QFileInfo snap (snapshotFile (fn));
+    if (snap.exists () &&
+            (!xml.exists () || xml.lastModified () <= snap.lastModified ()) &&
+            snapshot.read (this, snap.filePath ())) {
+        normalize ();
+        load_tree_version = m_tree_version;
+        return;
+    }
+    readFromFile (fn);
+    if (xml.exists ())
+        snapshot.write (this, snap.filePath ());
+}
+
+void FileDocument::save (const QString &fn) {
+    if (snapshot.write (this, snapshotFile (fn)))
+        load_tree_version = m_tree_version;
+    else
+        writeToFile (fn);
+}
+
 void FileDocument::sync (const QString &fn)
 {
     if (resolved && load_tree_version != m_tree_version)
-        writeToFile (fn);
+        save (fn);
 }
 
 Recents::Recents (KMPlayerApp *a)
@@ -92,7 +124,7 @@ void Recents::activate () {
 void Recents::defer () {
     if (!resolved) {
         resolved = true;
-        readFromFile(QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + "/kmplayer/recent.xml");
+        load(QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + "/kmplayer/recent.xml");
     }
 }
 
@@ -162,7 +194,7 @@ void Playlist::defer () {
             firstChild()->state = KMPlayer::Node::state_activated;
     } else if (!resolved) {
         resolved = true;
-        readFromFile(QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + "/kmplayer/playlist.xml");
+        load(QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + "/kmplayer/playlist.xml");
     }
 }
 
@@ -375,10 +407,47 @@ KMPlayer::Node *HtmlObject::childFromTag (const QString & tag) {
     return nullptr;
 }
 
+static const int max_generators = 6; // processes running at once
+static const qint64 output_ttl = 5 * 60 * 1000; // ms a list output is reused
+
+struct GeneratorOutput {
+    QString output;
+    QElapsedTimer age;
+};
+
+static QHash <QString, GeneratorOutput> generator_outputs;
+static QList <KMPlayer::NodePtrW> generator_queue;
+static int generators_running;
+
+static bool cachedGeneratorOutput (const QString &key, QString &output) {
+    QHash <QString, GeneratorOutput>::iterator i = generator_outputs.find (key);
+    if (i == generator_outputs.end ())
+        return false;
+    if (i.value ().age.hasExpired (output_ttl)) {
+        generator_outputs.erase (i);
+        return false;
+    }
+    output = i.value ().output;
+    return true;
+}
+
+static void storeGeneratorOutput (const QString &key, const QString &output) {
+    QHash <QString, GeneratorOutput>::iterator i = generator_outputs.begin ();
+    while (i != generator_outputs.end ())
+        if (i.value ().age.hasExpired (output_ttl))
+            i = generator_outputs.erase (i);
+        else
+            ++i;
+    GeneratorOutput &out = generator_outputs[key];
+    out.output = output;
+    out.age.start ();
+}
+
 Generator::Generator (KMPlayerApp *a)
  : FileDocument (id_node_gen_document, QString (),
             a->player ()->sources () ["listssource"]),
-   app (a), qprocess (nullptr), data (nullptr)
+   app (a), qprocess (nullptr), decoder (nullptr), reader (nullptr),
+   running (false)
 {}
 
 KMPlayer::Node *Generator::childFromTag (const QString &tag) {
@@ -552,7 +621,14 @@ void Generator::activate () {
         message (KMPlayer::MsgInfoString, &input);
         //openFile (m_control->m_app, input);
     } else if (!process.isEmpty ()) {
-        data = new QTextStream (&buffer);
+        cache_key = input.isEmpty ()
+            ? process.toString ()
+            : input + " | " + process.toString ();
+        if (cachedGeneratorOutput (cache_key, buffer)) {
+            state = state_began;
+            QTimer::singleShot (0, this, &Generator::cachedOutput);
+            return;
+        }
         if (input.isEmpty ()) {
             QString cmd = process.toString();
             message (KMPlayer::MsgInfoString, &cmd);
@@ -570,6 +646,19 @@ void Generator::activate () {
 }
 
 void Generator::begin () {
+    state = state_began;
+    if (generators_running < max_generators) {
+        startProcess ();
+    } else {
+        // the others are running, start when one of them is done
+        if (!generator_queue.contains (KMPlayer::NodePtrW (this)))
+            generator_queue.append (this);
+        QString info = QString ("Waiting to run ") + process.toString();
+        message (KMPlayer::MsgInfoString, &info);
+    }
+}
+
+void Generator::startProcess () {
     if (!qprocess) {
         qprocess = new QProcess (app);
         connect (qprocess, &QProcess::started,
@@ -581,6 +670,10 @@ void Generator::begin () {
         connect (qprocess, &QProcess::readyReadStandardOutput,
                  this, &Generator::readyRead);
     }
+    if (!decoder)
+        decoder = QTextCodec::codecForName ("UTF-8")->makeDecoder ();
+    running = true;
+    ++generators_running;
     QString info;
     if (media_info)
         info = QString ("Input data ") +
@@ -589,7 +682,14 @@ void Generator::begin () {
     message (KMPlayer::MsgInfoString, &info);
     qCDebug(LOG_KMPLAYER_APP) << process.toString();
     qprocess->start (process.program, process.args);
-    state = state_began;
+}
+
+void Generator::startQueued () {
+    while (generators_running < max_generators && !generator_queue.isEmpty ()) {
+        KMPlayer::NodePtrW n = generator_queue.takeFirst ();
+        if (n && n->active () && n->state == state_began)
+            static_cast <Generator *> (n.ptr ())->startProcess ();
+    }
 }
 
 void Generator::deactivate () {
@@ -606,10 +706,19 @@ void Generator::deactivate () {
         qprocess->deleteLater ();
     }
     qprocess = nullptr;
-    delete data;
-    data = nullptr;
+    if (running) {
+        running = false;
+        --generators_running;
+    }
+    generator_queue.removeAll (KMPlayer::NodePtrW (this));
+    delete reader;
+    reader = nullptr;
+    playlist = nullptr;
+    delete decoder;
+    decoder = nullptr;
     buffer.clear ();
     FileDocument::deactivate ();
+    startQueued ();
 }
 
 void Generator::message (KMPlayer::MessageType msg, void *content) {
@@ -626,29 +735,48 @@ void Generator::message (KMPlayer::MessageType msg, void *content) {
     }
 }
 
+void Generator::newPlaylist () {
+    Playlist *pl = new Playlist (app, m_source, true);
+    pl->src.clear ();
+    playlist = pl;
+    reader = new KMPlayer::IncrementalXMLReader (playlist, false);
+}
+
+void Generator::showList () {
+    Playlist *pl = static_cast <Playlist *> (playlist.ptr ());
+    reader->finish ();
+    pl->title = title;
+    pl->normalize ();
+    message (KMPlayer::MsgInfoString, nullptr);
+    bool reset_only = m_source == app->player ()->source ();
+    if (reset_only)
+        app->player ()->stop ();
+    m_source->setDocument (pl, pl);
+    if (reset_only) {
+        m_source->activate ();
+        app->setCaption (getAttribute(KMPlayer::Ids::attr_name));
+    } else {
+        app->player ()->setSource (m_source);
+    }
+}
+
 void Generator::readyRead () {
-    if (qprocess->bytesAvailable ())
-        *data << qprocess->readAll();
+    if (qprocess->bytesAvailable ()) {
+        // build the list while the process is still writing it
+        const QString chunk = decoder->toUnicode (qprocess->readAll ());
+        if (!chunk.isEmpty ()) {
+            if (!reader)
+                newPlaylist ();
+            buffer += chunk;
+            reader->feed (chunk);
+        }
+    }
     if (qprocess->state () == QProcess::NotRunning) {
         if (!buffer.isEmpty ()) {
-            Playlist *pl = new Playlist (app, m_source, true);
-            KMPlayer::NodePtr n = pl;
-            pl->src.clear ();
-            QTextStream stream (&buffer, QIODevice::ReadOnly);
-            KMPlayer::readXML (pl, stream, QString (), false);
-            pl->title = title;
-            pl->normalize ();
-            message (KMPlayer::MsgInfoString, nullptr);
-            bool reset_only = m_source == app->player ()->source ();
-            if (reset_only)
-                app->player ()->stop ();
-            m_source->setDocument (pl, pl);
-            if (reset_only) {
-                m_source->activate ();
-                app->setCaption (getAttribute(KMPlayer::Ids::attr_name));
-            } else {
-                app->player ()->setSource (m_source);
-            }
+            if (QProcess::NormalExit == qprocess->exitStatus () &&
+                    !qprocess->exitCode ())
+                storeGeneratorOutput (cache_key, buffer);
+            showList ();
         } else {
             QString err ("No data received");
             message (KMPlayer::MsgInfoString, &err);
@@ -657,6 +785,16 @@ void Generator::readyRead () {
     }
 }
 
+void Generator::cachedOutput () {
+    if (!active () || state_began != state || qprocess || buffer.isEmpty ())
+        return;
+    qCDebug(LOG_KMPLAYER_APP) << "cached output of " << cache_key;
+    newPlaylist ();
+    reader->feed (buffer);
+    showList ();
+    deactivate ();
+}
+
 void Generator::started () {
     if (media_info) {
         QByteArray &ba = media_info->rawData ();
@@ -14,6 +14,9 @@
 
 #include "kmplayerplaylist.h"
 #include "kmplayerpartbase.h"
+#include "snapshot.h"
+
+class QTextDecoder;
 
 static const short id_node_recent_document = 31;
 static const short id_node_recent_node = 32;
@@ -55,8 +58,13 @@ public:
     KMPlayer::Node *childFromTag (const QString &tag) override;
     void readFromFile (const QString &file);
     void writeToFile (const QString &file);
+    void load (const QString &file);
+    /* stores the document, sync only does when the tree changed */
+    void save (const QString &file);
     void sync (const QString & file);
     unsigned int load_tree_version;
+private:
+    KMPlayer::DocumentSnapshot snapshot;
 };
 
 class Recents : public FileDocument
@@ -169,6 +177,7 @@ private Q_SLOTS:
     void error (QProcess::ProcessError err);
     void readyRead ();
     void finished ();
+    void cachedOutput ();
 
 private:
     struct ProgramCmd
@@ -183,14 +192,22 @@ private:
     QString genReadString (KMPlayer::Node *n);
     QString genReadUriGet (KMPlayer::Node *n);
     QString genReadAsk (KMPlayer::Node *n);
+    void startProcess ();
+    void newPlaylist ();
+    void showList ();
+    static void startQueued ();
 
     KMPlayerApp *app;
     QProcess *qprocess;
-    QTextStream *data;
+    QTextDecoder *decoder;
+    KMPlayer::IncrementalXMLReader *reader;
+    KMPlayer::NodePtr playlist; // being read from the output
     ProgramCmd process;
+    QString cache_key;
     QString buffer;
     bool canceled;
     bool quote;
+    bool running; // holds one of the process slots
 };
 
 class GeneratorElement : public KMPlayer::Element
@@ -14,6 +14,7 @@
 #include <QStringList>
 #include <QComboBox>
 #include <QLineEdit>
+#include <QSpinBox>
 #include <QGroupBox>
 #include <QWhatsThis>
 #include <QTabWidget>
@@ -42,9 +43,11 @@
 #include "viewarea.h"
 #include "kmplayer.h"
 #include "kmplayercontrolpanel.h"
+#include "timeshift.h"
 
 static const char * strTV = "TV";
 static const char * strTVDriver = "Driver";
+static const char * strTVTimeShift = "Time Shift Size";
 
 
 TVDevicePage::TVDevicePage (QWidget *parent, KMPlayer::NodePtr dev)
@@ -163,12 +166,21 @@ KMPlayerPrefSourcePageTV::KMPlayerPrefSourcePageTV (QWidget *parent, KMPlayerTVS
     QLabel *deviceLabel = new QLabel(i18n("Device:"));
     device = new KUrlRequester(QUrl::fromLocalFile("/dev/video"));
     device->setWhatsThis(i18n("Path to your video device, eg. /dev/video0"));
+    QLabel *timeshiftLabel = new QLabel(i18n("Time shift buffer:"));
+    timeshift = new QSpinBox;
+    timeshift->setRange (0, 32768);
+    timeshift->setSingleStep (256);
+    timeshift->setSuffix (i18n (" MB"));
+    timeshift->setSpecialValueText (i18n ("Disabled"));
+    timeshift->setWhatsThis(i18n("Record live TV in a buffer of this size on disk, so it can be paused and rewound"));
     scan = new QPushButton(i18n("Scan..."));
     QGridLayout *gridlayout = new QGridLayout;
     gridlayout->addWidget (driverLabel, 0, 0);
     gridlayout->addWidget (driver, 0, 1);
     gridlayout->addWidget (deviceLabel, 1, 0);
     gridlayout->addWidget (device, 1, 1);
+    gridlayout->addWidget (timeshiftLabel, 2, 0);
+    gridlayout->addWidget (timeshift, 2, 1);
     QHBoxLayout *buttonlayout = new QHBoxLayout;
     buttonlayout->addItem (new QSpacerItem (0, 0, QSizePolicy::Minimum, QSizePolicy::Minimum));
     buttonlayout->addWidget (scan);
@@ -364,14 +376,14 @@ void TVDocument::message (KMPlayer::MessageType msg, void *data) {
 void TVDocument::defer () {
     if (!resolved) {
         resolved = true;
-        readFromFile(QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + "/kmplayer/tv.xml");
+        load(QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + "/kmplayer/tv.xml");
     }
 }
 
 //-----------------------------------------------------------------------------
 
 KMPlayerTVSource::KMPlayerTVSource(KMPlayerApp* a)
-    : KMPlayer::Source (i18n ("TV"), a->player(), "tvsource"), m_app(a), m_configpage(nullptr), scanner(nullptr), config_read(false) {
+    : KMPlayer::Source (i18n ("TV"), a->player(), "tvsource"), m_app(a), timeshift_size(0), m_configpage(nullptr), scanner(nullptr), config_read(false) {
     m_url = QUrl("tv://");
     m_document = new TVDocument (this);
     m_player->settings ()->addPage (this);
@@ -379,8 +391,10 @@ KMPlayerTVSource::KMPlayerTVSource(KMPlayerApp* a)
 }
 
 KMPlayerTVSource::~KMPlayerTVSource () {
-    static_cast <TVDocument *> (m_document.ptr ())->sync
-        (QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + "/kmplayer/tv.xml");
+    // device pages edit attributes, which don't change the tree version
+    TVDocument *doc = static_cast <TVDocument *> (m_document.ptr ());
+    if (doc->resolved)
+        doc->save (QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + "/kmplayer/tv.xml");
 }
 
 void KMPlayerTVSource::activate () {
@@ -501,6 +515,21 @@ void KMPlayerTVSource::setCurrent (KMPlayer::Mrl *mrl) {
             tvdevice->getAttribute (KMPlayer::Ids::attr_height).toInt ());
     m_options = QString::asprintf ("-tv noaudio:driver=%s:%s:width=%d:height=%d -slave -nocache -quiet", tvdriver.toLatin1 ().data (), command.toLatin1 ().data (), width (), height ());
     m_recordcmd = QString::asprintf ("-tv %s:driver=%s:%s:width=%d:height=%d", m_audiodevice.isEmpty () ? "noaudio" : QString(QLatin1String ("forceaudio:adevice=") + m_audiodevice).toLatin1 ().data(), tvdriver.toLatin1 ().data (), command.toLatin1 ().data (), width (), height ());
+    if (timeshift_size > 0) {
+        // mencoder captures into the time shift buffer, mplayer plays from it
+        if (!m_time_shift)
+            setTimeShift (new KMPlayer::TimeShift (this, 1024LL * 1024 * timeshift_size));
+        QStringList args;
+        args << "tv://" << m_recordcmd.split (QChar (' '), Qt::SkipEmptyParts);
+        args << "-ovc" << "lavc" << "-oac" << "lavc";
+        args << "-lavcopts" << "vcodec=mpeg2video:vbitrate=4000:acodec=mp2";
+        args << "-of" << "mpeg" << "-quiet" << "-o" << "%o";
+        m_time_shift->setCapture (QString ("mencoder"), args);
+        // m_options stays for when capturing fails to start
+        m_time_shift->setPlaybackOptions (QString ("-slave -nocache -quiet"));
+    } else {
+        setTimeShift (nullptr);
+    }
 }
 
 void KMPlayerTVSource::menuClicked (int id) {
@@ -537,9 +566,12 @@ QString KMPlayerTVSource::prettyName () {
 void KMPlayerTVSource::write (KSharedConfigPtr m_config) {
     if (!config_read) return;
     KConfigGroup (m_config, strTV).writeEntry (strTVDriver, tvdriver);
-    static_cast <TVDocument *> (m_document.ptr ())->writeToFile
-        (QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + "/kmplayer/tv.xml");
-    qCDebug(LOG_KMPLAYER_APP) << "KMPlayerTVSource::write XML";
+    KConfigGroup (m_config, strTV).writeEntry (strTVTimeShift, timeshift_size);
+    // device pages edit attributes, which don't change the tree version
+    TVDocument *doc = static_cast <TVDocument *> (m_document.ptr ());
+    if (doc->resolved)
+        doc->save (QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + "/kmplayer/tv.xml");
+    qCDebug(LOG_KMPLAYER_APP) << "KMPlayerTVSource::write";
 }
 
 void KMPlayerTVSource::readXML () {
@@ -554,6 +586,8 @@ void KMPlayerTVSource::readXML () {
 void KMPlayerTVSource::read (KSharedConfigPtr m_config) {
     tvdriver = KConfigGroup (m_config, strTV).readEntry (
             strTVDriver, QString ("v4l2"));
+    timeshift_size = KConfigGroup (m_config, strTV).readEntry (
+            strTVTimeShift, 0);
 }
 
 void KMPlayerTVSource::sync (bool fromUI) {
@@ -564,12 +598,17 @@ void KMPlayerTVSource::sync (bool fromUI) {
         m_app->hideBroadcastConfig ();
     if (fromUI) {
         tvdriver = m_configpage->driver->text ();
+        if (timeshift_size != m_configpage->timeshift->value ()) {
+            timeshift_size = m_configpage->timeshift->value ();
+            setTimeShift (nullptr); // applied on next channel selection
+        }
         for (KMPlayer::Node *d=m_document->firstChild();d; d=d->nextSibling())
             if (d->id == id_node_tv_device)
                 static_cast <TVDevice *> (d)->updateDevicePage ();
         m_player->playModel()->updateTree(tree_id, m_document, nullptr, false, false);
     } else {
         m_configpage->driver->setText (tvdriver);
+        m_configpage->timeshift->setValue (timeshift_size);
         for (KMPlayer::Node *dp = m_document->firstChild (); dp; dp = dp->nextSibling ())
             if (dp->id == id_node_tv_device)
                 addTVDevicePage (KMPlayer::convertNode <TVDevice> (dp));
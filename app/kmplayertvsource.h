@@ -31,6 +31,7 @@ class QTabWidget;
 class QLineEdit;
 class QCheckBox;
 class QPushButton;
+class QSpinBox;
 
 
 class TVDevicePage : public QFrame
@@ -61,6 +62,7 @@ public:
     ~KMPlayerPrefSourcePageTV () override {}
     QLineEdit * driver;
     KUrlRequester * device;
+    QSpinBox * timeshift;
     QPushButton * scan;
     QTabWidget * notebook;
 protected:
@@ -213,6 +215,7 @@ private:
     KMPlayerApp* m_app;
     QMenu * m_channelmenu;
     QString tvdriver;
+    int timeshift_size; // MB, 0 for no time shifting
     KMPlayerPrefSourcePageTV * m_configpage;
     TVDeviceScannerSource * scanner;
     int tree_id;
@@ -17,6 +17,8 @@ extern "C" {
 #include <stdlib.h>
 #include <sys/types.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+#include <errno.h>
 #include <fcntl.h>
 
 #include <glib/gprintf.h>
@@ -71,8 +73,10 @@ static NPClass js_class;
 static GTree *stream_list;
 static gpointer current_stream_id;
 static uint32_t stream_chunk_size;
-static char stream_buf[64 * 1024];
-static unsigned int stream_buf_pos;
+static char stream_buf[64 * 1024]; /* ring buffer for stdin */
+static unsigned int stream_buf_head;
+static unsigned int stream_buf_fill;
+static int stdin_retry_timer;
 static int stream_id_counter;
 static GTree *identifiers;
 typedef struct _StreamInfo {
@@ -82,6 +86,7 @@ typedef struct _StreamInfo {
     unsigned int total;
     unsigned int reason;
     unsigned int post_len;
+    uint32_t credit;
     char *url;
     char *mimetype;
     char *target;
@@ -106,6 +111,7 @@ static const char *iface_stream = "org.kde.kmplayer.stream";
 static const char *iface_callback = "org.kde.kmplayer.callback";
 static void callFunction(int stream, const char *iface, const char *func, int first_arg_type, ...);
 static void readStdin (gpointer d, gint src, GdkInputCondition cond);
+static gboolean retryStdin (void *p);
 static char *evaluate (const char *script, bool store);
 
 static
@@ -236,6 +242,19 @@ static void removeStream (void * p) {
     }
 }
 
+/* tell the player how much the plugin accepts, so it can throttle the stream */
+static void reportCredit (gpointer p, StreamInfo *si, int32_t ready) {
+    uint32_t credit = ready > 0 ? (uint32_t) ready : 0;
+    if (credit > 1024 * 1024)
+        credit = 1024 * 1024;
+    credit &= ~(uint32_t) 0x3fff; /* avoid a message for every small change */
+    if (callback_service && credit != si->credit) {
+        si->credit = credit;
+        callFunction ((int)(long)p, iface_stream, "writeReady",
+                DBUS_TYPE_UINT32, &credit, DBUS_TYPE_INVALID);
+    }
+}
+
 static int32_t writeStream (gpointer p, char *buf, uint32_t count) {
     int32_t sz = -1;
     StreamInfo *si = (StreamInfo *) g_tree_lookup (stream_list, p);
@@ -258,8 +277,10 @@ static int32_t writeStream (gpointer p, char *buf, uint32_t count) {
                 print ("newStream %d type:%d\n", (long) p, stype);
                 si->called_plugin = true;
             }
-            if (count) /* urls with a target returns zero bytes */
+            if (count) { /* urls with a target returns zero bytes */
                 sz = np_funcs.writeready (npp, &si->np_stream);
+                reportCredit (p, si, sz);
+            }
             if (sz > 0) {
                 sz = np_funcs.write (npp, &si->np_stream, si->stream_pos,
                         (int32_t) count > sz ? sz : (int32_t) count, buf);
@@ -1141,38 +1162,68 @@ static void shutDownPlugin() {
     }
 }
 
-static void readStdin (gpointer p, gint src, GdkInputCondition cond) {
-    char *buf_ptr = stream_buf;
-    gsize bytes_read = read (src,
-            stream_buf + stream_buf_pos,
-            sizeof (stream_buf) - stream_buf_pos);
-    (void)cond; (void)p;
-    if (bytes_read > 0)
-        stream_buf_pos += bytes_read;
+/* contiguous bytes readable from the ring buffer head */
+static unsigned int streamBufContiguous () {
+    if (stream_buf_head + stream_buf_fill > sizeof (stream_buf))
+        return sizeof (stream_buf) - stream_buf_head;
+    return stream_buf_fill;
+}
 
-    /*print ("readStdin %d\n", bytes_read);*/
-    while (buf_ptr < stream_buf + stream_buf_pos) {
+static void streamBufPeek (char *dest, unsigned int len) {
+    for (unsigned int i = 0; i < len; ++i)
+        dest[i] = stream_buf[(stream_buf_head + i) % sizeof (stream_buf)];
+}
+
+static void streamBufConsume (unsigned int len) {
+    stream_buf_head = (stream_buf_head + len) % sizeof (stream_buf);
+    stream_buf_fill -= len;
+    if (!stream_buf_fill)
+        stream_buf_head = 0;
+}
+
+/* free space of the ring buffer as at most two segments, returns count */
+static int streamBufFree (struct iovec *iov) {
+    unsigned int tail = (stream_buf_head + stream_buf_fill) % sizeof (stream_buf);
+    if (stream_buf_fill == sizeof (stream_buf))
+        return 0;
+    iov[0].iov_base = stream_buf + tail;
+    if (tail < stream_buf_head) {
+        iov[0].iov_len = stream_buf_head - tail;
+        return 1;
+    }
+    iov[0].iov_len = sizeof (stream_buf) - tail;
+    if (!stream_buf_head)
+        return 1;
+    iov[1].iov_base = stream_buf;
+    iov[1].iov_len = stream_buf_head;
+    return 2;
+}
+
+/* feed buffered data to the streams, returns false if the plugin blocked */
+static bool feedStreams () {
+    while (stream_buf_fill) {
         uint32_t write_len;
         int32_t bytes_written;
 
         if (callback_service && !stream_chunk_size) {
             /* read header info */
-            if (stream_buf + stream_buf_pos < buf_ptr + 2 * sizeof (uint32_t))
+            uint32_t header[2];
+            if (stream_buf_fill < sizeof (header))
                 break; /* need more data */
-            current_stream_id = (gpointer)(long)*(uint32_t*)(buf_ptr);
-            stream_chunk_size = *((uint32_t *)(buf_ptr + sizeof (uint32_t)));
+            streamBufPeek ((char *) header, sizeof (header));
+            streamBufConsume (sizeof (header));
+            current_stream_id = (gpointer)(long)header[0];
+            stream_chunk_size = header[1];
         /*print ("header %d %d\n",(long)current_stream_id, stream_chunk_size);*/
-            buf_ptr += 2 * sizeof (uint32_t);
-            if (stream_chunk_size && stream_buf + stream_buf_pos == buf_ptr) {
-                stream_buf_pos = 0;
+            if (stream_chunk_size && !stream_buf_fill)
                 break; /* only read the header for chunk with data */
-            }
         }
         /* feed it to the stream */
-        write_len = stream_buf + stream_buf_pos - buf_ptr;
+        write_len = streamBufContiguous ();
         if (callback_service && write_len > stream_chunk_size)
             write_len = stream_chunk_size;
-        bytes_written = writeStream (current_stream_id, buf_ptr, write_len);
+        bytes_written = writeStream (current_stream_id,
+                stream_buf + stream_buf_head, write_len);
         if (bytes_written < 0) {
             print ("couldn't write to stream %d\n", (long)current_stream_id);
             bytes_written = write_len; /* assume stream destroyed, skip */
@@ -1180,32 +1231,69 @@ static void readStdin (gpointer p, gint src, GdkInputCondition cond) {
 
         /* update chunk status */
         if (bytes_written > 0) {
-            buf_ptr += bytes_written;
+            streamBufConsume (bytes_written);
            /*print ("update chunk %d %d\n", bytes_written, stream_chunk_size);*/
             stream_chunk_size -= bytes_written;
-        } else {
-            /* FIXME if plugin didn't accept the data retry later, suspend stdin reading */
-            break;
+        } else if (write_len) {
+            return false; /* plugin didn't accept the data, retry later */
         }
+    }
+    return true;
+}
 
+static void suspendStdin () {
+    if (stdin_read_watch) {
+        gdk_input_remove (stdin_read_watch);
+        stdin_read_watch = 0;
     }
-    /* update buffer */
-    /*print ("buffer written:%d bufpos:%d\n", buf_ptr-stream_buf, stream_buf_pos);*/
-    if (stream_buf + stream_buf_pos == buf_ptr) {
-        stream_buf_pos = 0;
-    } else {
-        g_assert (buf_ptr < stream_buf + stream_buf_pos);
-        stream_buf_pos -= (stream_buf + stream_buf_pos - buf_ptr);
-        memmove (stream_buf, buf_ptr, stream_buf_pos);
+    if (!stdin_retry_timer)
+        stdin_retry_timer = g_timeout_add (20, retryStdin, nullptr);
+}
+
+static gboolean retryStdin (void *p) {
+    (void)p;
+    stdin_retry_timer = 0;
+    if (!feedStreams ()) {
+        stdin_retry_timer = g_timeout_add (20, retryStdin, nullptr);
+    } else if (!stdin_read_watch) {
+        stdin_read_watch = gdk_input_add (0, GDK_INPUT_READ, readStdin, nullptr);
     }
+    return 0; /* single shot */
+}
+
+static void readStdin (gpointer p, gint src, GdkInputCondition cond) {
+    struct iovec iov[2];
+    ssize_t bytes_read;
+    int iov_count = streamBufFree (iov);
+    (void)cond; (void)p;
+    if (!iov_count) {
+        /* buffer full, wait for the plugin to consume (back pressure) */
+        suspendStdin ();
+        return;
+    }
+    bytes_read = readv (src, iov, iov_count);
+    if (bytes_read < 0 && (errno == EINTR || errno == EAGAIN))
+        return;
+    if (bytes_read > 0)
+        stream_buf_fill += bytes_read;
+
+    /*print ("readStdin %d\n", bytes_read);*/
+    if (!feedStreams ())
+        suspendStdin ();
     if (bytes_read <= 0) { /* eof of stdin, only for 'cat foo | knpplayer' */
         StreamInfo*si=(StreamInfo*)g_tree_lookup(stream_list,current_stream_id);
-        si->reason = NPRES_DONE;
-        removeStream (current_stream_id);
+        if (si) {
+            si->reason = NPRES_DONE;
+            removeStream (current_stream_id);
+        }
         if (stdin_read_watch) {
             gdk_input_remove (stdin_read_watch);
             stdin_read_watch = 0;
         }
+        if (stdin_retry_timer) {
+            g_source_remove (stdin_retry_timer);
+            stdin_retry_timer = 0;
+        }
     }
 }
 
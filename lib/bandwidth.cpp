@@ -0,0 +1,49 @@
+/*
+    This file belong to the KMPlayer project, a movie player plugin for Konqueror
+    SPDX-FileCopyrightText: 2026 The KMPlayer authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "config-kmplayer.h"
+
+#include "kmplayercommon_log.h"
+#include "bandwidth.h"
+
+using namespace KMPlayer;
+
+static const qint64 sample_time = 500; // ms, measuring window
+static const qint64 sample_bytes = 16 * 1024; // minimal bytes of a sample
+static const qint64 max_pause = 1000; // ms without arrivals ends a window
+
+BandwidthEstimator::BandwidthEstimator ()
+ : m_window_bytes (0),
+   m_estimate (0) {}
+
+void BandwidthEstimator::received (int bytes) {
+    if (bytes <= 0)
+        return;
+    if (!m_last_arrival.isValid () || m_last_arrival.elapsed () > max_pause) {
+        // when this data was on its way is unknown, it only starts a window
+        m_window.start ();
+        m_last_arrival.start ();
+        m_window_bytes = 0;
+        return;
+    }
+    m_last_arrival.start ();
+    m_window_bytes += bytes;
+    const qint64 ms = m_window.elapsed ();
+    if (ms < sample_time || m_window_bytes < sample_bytes)
+        return;
+    const qint64 rate = qMin (qint64 (0x7fffffff), 8000 * m_window_bytes / ms);
+    // weighted average, recent samples count most
+    m_estimate = m_estimate ? int ((3 * qint64 (m_estimate) + rate) / 4) : int (rate);
+    m_window.start ();
+    m_window_bytes = 0;
+    qCDebug(LOG_KMPLAYER_COMMON) << "BandwidthEstimator: sample " << rate << " estimate " << m_estimate;
+}
+
+void BandwidthEstimator::throttled () {
+    m_last_arrival.invalidate ();
+    m_window_bytes = 0;
+}
@@ -0,0 +1,49 @@
+/*
+    This file belong to the KMPlayer project, a movie player plugin for Konqueror
+    SPDX-FileCopyrightText: 2026 The KMPlayer authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#ifndef _KMPLAYER_BANDWIDTH_H_
+#define _KMPLAYER_BANDWIDTH_H_
+
+#include "config-kmplayer.h"
+
+#include <QElapsedTimer>
+
+#include "kmplayercommon_export.h"
+
+namespace KMPlayer {
+
+/*
+ * Estimates the connection speed from the data as it arrives, of downloads
+ * and of the backends filling their cache. Arrivals of all transfers add
+ * up in a measuring window, each full window is a sample that is averaged
+ * into the estimate. A pause in the arrivals starts a new window, so idle
+ * time doesn't count. Flow controlled transfers report when they are held
+ * back, a window with such a stall would only measure the reader.
+ */
+class KMPLAYERCOMMON_EXPORT BandwidthEstimator
+{
+public:
+    BandwidthEstimator ();
+
+    /* bytes of some transfer just arrived */
+    void received (int bytes);
+    /* a transfer is held back by its reader, so the arrivals until now
+     * don't tell the connection speed */
+    void throttled ();
+    /* in bits per second, or 0 if not yet known */
+    int estimate () const { return m_estimate; }
+
+private:
+    QElapsedTimer m_window;
+    QElapsedTimer m_last_arrival;
+    qint64 m_window_bytes;
+    int m_estimate;
+};
+
+} // namespace
+
+#endif
@@ -0,0 +1,350 @@
+/*
+    This file belong to the KMPlayer project, a movie player plugin for Konqueror
+    SPDX-FileCopyrightText: 2026 The KMPlayer authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "config-kmplayer.h"
+
+#include <algorithm>
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QLocale>
+#include <QLockFile>
+#include <QPair>
+#include <QSaveFile>
+#include <QSet>
+#include <QStandardPaths>
+#include <QStringList>
+#include <QVector>
+
+#include "kmplayercommon_log.h"
+#include "diskcache.h"
+
+using namespace KMPlayer;
+
+static const int index_write_interval = 16; // changes before saving the index
+static const quint32 index_magic = 0x4b4d4843; // 'KMHC'
+static const quint32 index_version = 1;
+static const qint64 max_heuristic_age = 24 * 3600 * 1000; // ms
+static const qint64 orphan_grace = 3600; // s, another instance may be storing
+
+namespace KMPlayer {
+
+QDataStream &operator << (QDataStream &out, const DiskCache::Entry &e) {
+    out << e.mime << e.etag << e.last_modified;
+    out << e.expires << e.size << e.used;
+    return out;
+}
+
+QDataStream &operator >> (QDataStream &in, DiskCache::Entry &e) {
+    in >> e.mime >> e.etag >> e.last_modified;
+    in >> e.expires >> e.size >> e.used;
+    return in;
+}
+
+} // namespace
+
+static QDateTime httpDate (const QString &value) {
+    QDateTime t = QLocale::c ().toDateTime (value, "ddd, dd MMM yyyy hh:mm:ss 'GMT'");
+    t.setTimeSpec (Qt::UTC);
+    return t;
+}
+
+/* validators and freshness from the response headers, false for no-store */
+static bool parseHeaders (const QString &headers, DiskCache::Entry &e) {
+    const qint64 now = QDateTime::currentMSecsSinceEpoch ();
+    qint64 max_age = -1;
+    bool no_cache = false;
+    QString expires;
+    const QStringList lines = headers.split (QChar ('\n'));
+    const QStringList::const_iterator end = lines.constEnd ();
+    for (QStringList::const_iterator i = lines.constBegin (); i != end; ++i) {
+        const int pos = i->indexOf (QChar (':'));
+        if (pos <= 0)
+            continue;
+        const QString name = i->left (pos).trimmed ().toLower ();
+        const QString value = i->mid (pos + 1).trimmed ();
+        if (name == "etag") {
+            e.etag = value;
+        } else if (name == "last-modified") {
+            e.last_modified = value;
+        } else if (name == "expires") {
+            expires = value;
+        } else if (name == "cache-control") {
+            const QStringList directives = value.toLower ().split (QChar (','));
+            for (int j = 0; j < directives.size (); ++j) {
+                const QString d = directives[j].trimmed ();
+                if (d == "no-store")
+                    return false;
+                else if (d == "no-cache")
+                    no_cache = true;
+                else if (d.startsWith ("max-age="))
+                    max_age = d.mid (8).toLongLong ();
+            }
+        }
+    }
+    e.expires = 0;
+    if (no_cache) {
+        // always revalidated
+    } else if (max_age >= 0) {
+        e.expires = now + 1000 * max_age;
+    } else if (!expires.isEmpty ()) {
+        const QDateTime t = httpDate (expires);
+        if (t.isValid ())
+            e.expires = t.toMSecsSinceEpoch ();
+    } else if (!e.last_modified.isEmpty ()) {
+        // a tenth of its age, as browsers do
+        const QDateTime t = httpDate (e.last_modified);
+        if (t.isValid () && t.toMSecsSinceEpoch () < now)
+            e.expires = now + qMin ((now - t.toMSecsSinceEpoch ()) / 10,
+                    max_heuristic_age);
+    }
+    return true;
+}
+
+DiskCache::DiskCache (qint64 max_size)
+ : m_dir (QStandardPaths::writableLocation (QStandardPaths::GenericCacheLocation) + "/kmplayer/http"),
+   m_max_size (max_size),
+   m_size (0),
+   m_dirty (0) {
+    readIndex ();
+    sweep ();
+}
+
+DiskCache::~DiskCache () {
+    if (m_dirty)
+        writeIndex ();
+}
+
+QString DiskCache::fileName (const QString &url) const {
+    const QByteArray hash = QCryptographicHash::hash (url.toUtf8 (), QCryptographicHash::Md5).toHex ();
+    return m_dir + QChar ('/') + QString::fromLatin1 (hash);
+}
+
+bool DiskCache::read (const QString &url, const Entry &e, QByteArray &data) {
+    QFile file (fileName (url));
+    if (file.open (QIODevice::ReadOnly)) {
+        data = file.readAll ();
+        if (data.size () == e.size)
+            return true;
+    }
+    qCDebug(LOG_KMPLAYER_COMMON) << "DiskCache: lost " << url;
+    data.resize (0);
+    remove (url);
+    return false;
+}
+
+bool DiskCache::get (const QString &url, QString &mime, QByteArray &data) {
+    QHash <QString, Entry>::iterator i = m_entries.find (url);
+    if (i == m_entries.end () ||
+            i.value ().expires <= QDateTime::currentMSecsSinceEpoch ())
+        return false;
+    i.value ().used = QDateTime::currentMSecsSinceEpoch ();
+    const Entry e = i.value ();
+    if (!read (url, e, data))
+        return false;
+    mime = e.mime;
+    changed ();
+    return true;
+}
+
+QString DiskCache::conditionalHeaders (const QString &url) const {
+    QHash <QString, Entry>::const_iterator i = m_entries.constFind (url);
+    if (i == m_entries.constEnd ())
+        return QString ();
+    QStringList headers;
+    if (!i.value ().etag.isEmpty ())
+        headers << QString ("If-None-Match: ") + i.value ().etag;
+    if (!i.value ().last_modified.isEmpty ())
+        headers << QString ("If-Modified-Since: ") + i.value ().last_modified;
+    return headers.join ("\r\n");
+}
+
+void DiskCache::store (const QString &url, const QString &mime,
+        const QByteArray &data, const QString &headers) {
+    Entry e;
+    if (!parseHeaders (headers, e) || data.size () > m_max_size / 8 ||
+            (e.expires <= QDateTime::currentMSecsSinceEpoch () &&
+             e.etag.isEmpty () && e.last_modified.isEmpty ())) {
+        remove (url); // it can't be reused
+        return;
+    }
+    QDir ().mkpath (m_dir);
+    QSaveFile file (fileName (url));
+    if (!file.open (QIODevice::WriteOnly) ||
+            file.write (data) != data.size () || !file.commit ()) {
+        qCWarning(LOG_KMPLAYER_COMMON) << "DiskCache: can't write " << file.fileName ();
+        remove (url);
+        return;
+    }
+    e.mime = mime;
+    e.size = data.size ();
+    e.used = QDateTime::currentMSecsSinceEpoch ();
+    QHash <QString, Entry>::iterator i = m_entries.find (url);
+    if (i != m_entries.end ()) {
+        m_size += e.size - i.value ().size;
+        i.value () = e;
+    } else {
+        m_size += e.size;
+        m_entries.insert (url, e);
+    }
+    m_removed.remove (url);
+    if (m_size > m_max_size)
+        expire ();
+    changed ();
+}
+
+bool DiskCache::revalidated (const QString &url, const QString &headers,
+        QString &mime, QByteArray &data) {
+    QHash <QString, Entry>::iterator i = m_entries.find (url);
+    if (i == m_entries.end ())
+        return false;
+    Entry e = i.value ();
+    if (!parseHeaders (headers, e))
+        e.expires = 0;
+    if (e.etag.isEmpty ()) // not all servers repeat them
+        e.etag = i.value ().etag;
+    if (e.last_modified.isEmpty ())
+        e.last_modified = i.value ().last_modified;
+    e.used = QDateTime::currentMSecsSinceEpoch ();
+    i.value () = e;
+    if (!read (url, e, data))
+        return false;
+    mime = e.mime;
+    changed ();
+    return true;
+}
+
+void DiskCache::remove (const QString &url) {
+    QHash <QString, Entry>::iterator i = m_entries.find (url);
+    if (i != m_entries.end ()) {
+        m_size -= i.value ().size;
+        m_entries.erase (i);
+        m_removed.insert (url);
+        QFile::remove (fileName (url));
+        changed ();
+    }
+}
+
+void DiskCache::expire () {
+    typedef QPair <qint64, QString> Use;
+    QVector <Use> uses;
+    uses.reserve (m_entries.size ());
+    const QHash <QString, Entry>::const_iterator e = m_entries.constEnd ();
+    for (QHash <QString, Entry>::const_iterator i = m_entries.constBegin (); i != e; ++i)
+        uses.append (qMakePair (i.value ().used, i.key ()));
+    std::sort (uses.begin (), uses.end ());
+    // remove down to three quarters, so this doesn't run for each store
+    for (int i = 0; i < uses.size () && m_size > m_max_size * 3 / 4; ++i)
+        remove (uses[i].second);
+    qCDebug(LOG_KMPLAYER_COMMON) << "DiskCache: " << m_entries.size () << " entries " << m_size << " bytes";
+}
+
+void DiskCache::changed () {
+    if (++m_dirty >= index_write_interval)
+        writeIndex ();
+}
+
+static bool loadIndex (const QString &path, QHash <QString, DiskCache::Entry> &entries) {
+    QFile file (path);
+    if (!file.open (QIODevice::ReadOnly))
+        return false;
+    QDataStream in (&file);
+    in.setVersion (QDataStream::Qt_5_0);
+    quint32 magic, version;
+    in >> magic >> version;
+    if (magic != index_magic || version != index_version) {
+        qCDebug(LOG_KMPLAYER_COMMON) << "DiskCache: ignoring index " << path;
+        return false;
+    }
+    in >> entries;
+    if (in.status () != QDataStream::Ok) {
+        qCWarning(LOG_KMPLAYER_COMMON) << "DiskCache: corrupt index " << path;
+        entries.clear ();
+        return false;
+    }
+    return true;
+}
+
+/* cache files are named after the md5 of their url */
+static bool isCacheFile (const QString &name) {
+    if (name.size () != 32)
+        return false;
+    for (int i = 0; i < name.size (); ++i) {
+        const char c = name[i].toLatin1 ();
+        if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f')))
+            return false;
+    }
+    return true;
+}
+
+void DiskCache::readIndex () {
+    loadIndex (m_dir + "/index", m_entries);
+    const QHash <QString, Entry>::const_iterator e = m_entries.constEnd ();
+    for (QHash <QString, Entry>::const_iterator i = m_entries.constBegin (); i != e; ++i)
+        m_size += i.value ().size;
+}
+
+void DiskCache::sweep () {
+    // files stored after the last index write, eg. before a crash. Skip
+    // temporary files and recent ones, another instance may not have
+    // written its index yet
+    QSet <QString> known;
+    const QHash <QString, Entry>::const_iterator e = m_entries.constEnd ();
+    for (QHash <QString, Entry>::const_iterator i = m_entries.constBegin (); i != e; ++i)
+        known.insert (QFileInfo (fileName (i.key ())).fileName ());
+    const QDateTime old = QDateTime::currentDateTime ().addSecs (-orphan_grace);
+    QDir dir (m_dir);
+    const QFileInfoList files = dir.entryInfoList (QDir::Files | QDir::Hidden);
+    const QFileInfoList::const_iterator fe = files.constEnd ();
+    for (QFileInfoList::const_iterator i = files.constBegin (); i != fe; ++i)
+        if (isCacheFile (i->fileName ()) && !known.contains (i->fileName ()) &&
+                i->lastModified () < old) {
+            qCDebug(LOG_KMPLAYER_COMMON) << "DiskCache: removing orphan " << i->fileName ();
+            dir.remove (i->fileName ());
+        }
+}
+
+void DiskCache::writeIndex () {
+    QDir ().mkpath (m_dir);
+    QLockFile lock (m_dir + "/index.lock");
+    if (!lock.tryLock (500)) {
+        qCDebug(LOG_KMPLAYER_COMMON) << "DiskCache: index locked, retrying later";
+        return;
+    }
+    m_dirty = 0;
+    // other instances share the directory, keep what they stored
+    QHash <QString, Entry> stored;
+    if (loadIndex (m_dir + "/index", stored)) {
+        const QHash <QString, Entry>::const_iterator e = stored.constEnd ();
+        for (QHash <QString, Entry>::const_iterator i = stored.constBegin (); i != e; ++i) {
+            if (m_removed.contains (i.key ()))
+                continue;
+            QHash <QString, Entry>::iterator j = m_entries.find (i.key ());
+            if (j == m_entries.end ()) {
+                m_size += i.value ().size;
+                m_entries.insert (i.key (), i.value ());
+            } else if (j.value ().used < i.value ().used) {
+                m_size += i.value ().size - j.value ().size;
+                j.value () = i.value ();
+            }
+        }
+    }
+    m_removed.clear ();
+    QSaveFile file (m_dir + "/index");
+    if (!file.open (QIODevice::WriteOnly)) {
+        qCWarning(LOG_KMPLAYER_COMMON) << "DiskCache: can't write " << file.fileName ();
+        return;
+    }
+    QDataStream out (&file);
+    out.setVersion (QDataStream::Qt_5_0);
+    out << index_magic << index_version << m_entries;
+    file.commit ();
+}
@@ -0,0 +1,78 @@
+/*
+    This file belong to the KMPlayer project, a movie player plugin for Konqueror
+    SPDX-FileCopyrightText: 2026 The KMPlayer authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#ifndef _KMPLAYER_DISKCACHE_H_
+#define _KMPLAYER_DISKCACHE_H_
+
+#include "config-kmplayer.h"
+
+#include <QString>
+#include <QByteArray>
+#include <QHash>
+#include <QSet>
+
+#include "kmplayercommon_export.h"
+
+namespace KMPlayer {
+
+/*
+ * Http responses kept on disk between sessions, one file per url and an
+ * index with the mime type and the validators. A fresh entry is used as
+ * is, a stale one is revalidated with a conditional get. The least
+ * recently used entries are removed when the total size gets too large.
+ * The index is written every few changes, merged under a lock file with
+ * what other instances wrote. Old cache files missing from it are removed
+ * on startup.
+ */
+class KMPLAYERCOMMON_EXPORT DiskCache
+{
+public:
+    struct Entry {
+        Entry () : expires (0), size (0), used (0) {}
+        QString mime;
+        QString etag;
+        QString last_modified;
+        qint64 expires; // ms since epoch, fresh before this time
+        qint64 size;
+        qint64 used;    // ms since epoch
+    };
+
+    DiskCache (qint64 max_size = 64 * 1024 * 1024);
+    ~DiskCache ();
+
+    /* mime and body of url if it's cached and fresh */
+    bool get (const QString &url, QString &mime, QByteArray &data);
+    /* request headers for a conditional get of url, or empty if not cached */
+    QString conditionalHeaders (const QString &url) const;
+    /* a response for url, headers as KIO passes them in HTTP-Headers */
+    void store (const QString &url, const QString &mime,
+            const QByteArray &data, const QString &headers);
+    /* url wasn't modified, returns the cached mime and body */
+    bool revalidated (const QString &url, const QString &headers,
+            QString &mime, QByteArray &data);
+
+private:
+    QString fileName (const QString &url) const KMPLAYERCOMMON_NO_EXPORT;
+    bool read (const QString &url, const Entry &e, QByteArray &data) KMPLAYERCOMMON_NO_EXPORT;
+    void remove (const QString &url) KMPLAYERCOMMON_NO_EXPORT;
+    void expire () KMPLAYERCOMMON_NO_EXPORT;
+    void changed () KMPLAYERCOMMON_NO_EXPORT;
+    void readIndex () KMPLAYERCOMMON_NO_EXPORT;
+    void sweep () KMPLAYERCOMMON_NO_EXPORT;
+    void writeIndex () KMPLAYERCOMMON_NO_EXPORT;
+
+    QHash <QString, Entry> m_entries;
+    QSet <QString> m_removed; // since the last index write
+    QString m_dir;
+    qint64 m_max_size;
+    qint64 m_size;
+    int m_dirty;
+};
+
+} // namespace
+
+#endif
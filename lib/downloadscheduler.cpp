@@ -0,0 +1,393 @@
+/*
+    This file belong to the KMPlayer project, a movie player plugin for Konqueror
+    SPDX-FileCopyrightText: 2026 The KMPlayer authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "config-kmplayer.h"
+
+#include <QElapsedTimer>
+#include <QPointer>
+#include <QStringList>
+
+#include <KIO/Job>
+
+#include "kmplayercommon_log.h"
+#include "downloadscheduler.h"
+#include "mediaobject.h"
+#include "bandwidth.h"
+#include "diskcache.h"
+
+using namespace KMPlayer;
+
+static const int max_transfers = 16;
+static const int max_host_transfers = 6;
+static const int max_resumes = 3;
+static const int max_store_size = 4 * 1024 * 1024; // larger isn't cached
+
+struct DownloadScheduler::Transfer {
+    Transfer (const QUrl &u, int p, quint64 o)
+        : url (u), job (nullptr), latency (-1), received (0), skip (0),
+          order (o), priority (p), resumes (0), answered (false),
+          store (false) {}
+    QUrl url;
+    QString mime;
+    QByteArray body; // for the disk cache
+    QList <MediaInfo *> receivers;
+    QList <MediaInfo *> waiting; // came after the first data
+    QList <MediaInfo *> mime_pending; // came after the mimetype
+    QHash <MediaInfo *, int> priorities; // of the receivers
+    KIO::TransferJob *job;
+    QElapsedTimer time;
+    qint64 latency;
+    qint64 received;
+    qint64 skip; // bytes that a resumed transfer sends again
+    quint64 order;
+    int priority;
+    int resumes;
+    bool answered; // the running job got data
+    bool store;
+};
+
+typedef QList <QPointer <MediaInfo> > GuardedList;
+
+static GuardedList guarded (const QList <MediaInfo *> &list) {
+    GuardedList guarded_list;
+    const QList <MediaInfo *>::const_iterator e = list.constEnd ();
+    for (QList <MediaInfo *>::const_iterator i = list.constBegin (); i != e; ++i)
+        guarded_list.append (QPointer <MediaInfo> (*i));
+    return guarded_list;
+}
+
+static bool isHttp (const QUrl &url) {
+    return url.scheme () == "http" || url.scheme () == "https";
+}
+
+static bool resumable (const QUrl &url, int error) {
+    return isHttp (url) &&
+        (KIO::ERR_CONNECTION_BROKEN == error ||
+         KIO::ERR_SERVER_TIMEOUT == error ||
+         KIO::ERR_COULD_NOT_READ == error);
+}
+
+DownloadScheduler::DownloadScheduler ()
+ : m_delivering (nullptr),
+   m_disk_cache (new DiskCache),
+   m_order (0) {}
+
+DownloadScheduler::~DownloadScheduler () {
+    const QHash <QString, Transfer *>::const_iterator e = m_transfers.constEnd ();
+    for (QHash <QString, Transfer *>::const_iterator i = m_transfers.constBegin (); i != e; ++i) {
+        if (i.value ()->job)
+            i.value ()->job->kill (); // quiet, no result signal
+        delete i.value ();
+    }
+    delete m_disk_cache;
+}
+
+void DownloadScheduler::get (MediaInfo *info, const QUrl &url, Priority priority) {
+    const QString key = url.url ();
+    Transfer *t = m_transfers.value (key);
+    if (t) {
+        if (t->received) {
+            t->waiting.append (info);
+        } else {
+            t->receivers.append (info);
+            t->priorities.insert (info, priority);
+            reprioritize (t);
+        }
+        m_requests.insert (info, t);
+        m_metrics.shared++;
+        if (!t->received && !t->mime.isEmpty ()) {
+            // the others got the mimetype already, this one gets it too,
+            // but not from within its own request
+            t->mime_pending.append (info);
+            QMetaObject::invokeMethod (this, "slotPendingMimetypes", Qt::QueuedConnection);
+        }
+        return;
+    }
+    t = new Transfer (url, priority, m_order++);
+    t->receivers.append (info);
+    t->priorities.insert (info, priority);
+    m_transfers.insert (key, t);
+    m_requests.insert (info, t);
+    enqueue (t);
+    startTransfers ();
+}
+
+void DownloadScheduler::cancel (MediaInfo *info) {
+    Transfer *t = m_requests.take (info);
+    if (!t)
+        return;
+    t->receivers.removeAll (info);
+    t->waiting.removeAll (info);
+    t->mime_pending.removeAll (info);
+    t->priorities.remove (info);
+    if (t->receivers.isEmpty () && t != m_delivering)
+        remove (t);
+    else
+        reprioritize (t);
+}
+
+void DownloadScheduler::setPriority (MediaInfo *info, Priority priority) {
+    Transfer *t = m_requests.value (info);
+    if (t && t->priorities.contains (info)) {
+        t->priorities.insert (info, priority);
+        reprioritize (t);
+    }
+}
+
+void DownloadScheduler::reprioritize (Transfer *t) {
+    // a shared transfer is as urgent as its most urgent receiver
+    int priority = PriorityPrefetch;
+    const QHash <MediaInfo *, int>::const_iterator e = t->priorities.constEnd ();
+    for (QHash <MediaInfo *, int>::const_iterator i = t->priorities.constBegin (); i != e; ++i)
+        priority = qMin (priority, i.value ());
+    if (priority != t->priority) {
+        t->priority = priority;
+        if (!t->job && m_queue.removeAll (t))
+            enqueue (t);
+    }
+}
+
+void DownloadScheduler::enqueue (Transfer *t) {
+    int i = m_queue.size ();
+    while (i > 0 && (m_queue[i-1]->priority > t->priority ||
+                (m_queue[i-1]->priority == t->priority &&
+                 m_queue[i-1]->order > t->order)))
+        --i;
+    m_queue.insert (i, t);
+}
+
+void DownloadScheduler::start (Transfer *t) {
+    t->job = KIO::get (t->url, KIO::NoReload, KIO::HideProgressInfo);
+    t->job->addMetaData ("PropagateHttpHeader", "true");
+    t->job->addMetaData ("errorPage", "false");
+    if (t->received > 0) {
+        t->job->addMetaData ("resume", QString::number (t->received));
+    } else {
+        m_metrics.transfers++;
+        t->store = isHttp (t->url);
+        const QString conditional = t->store
+            ? m_disk_cache->conditionalHeaders (t->url.url ())
+            : QString ();
+        if (!conditional.isEmpty ()) {
+            t->job->addMetaData ("customHTTPHeader", conditional);
+            t->job->addMetaData ("cache", "reload"); // it's validated here
+        }
+    }
+    t->answered = false;
+    if (!t->time.isValid ())
+        t->time.start ();
+    m_host_connections[t->url.host ()]++;
+    m_jobs.insert (t->job, t);
+    connect (t->job, &KIO::TransferJob::data,
+            this, &DownloadScheduler::slotData);
+    connect (t->job, &KJob::result,
+            this, &DownloadScheduler::slotResult);
+    connect (t->job, QOverload<KIO::Job*, const QString&>::of(&KIO::TransferJob::mimetype),
+            this, &DownloadScheduler::slotMimetype);
+}
+
+void DownloadScheduler::startTransfers () {
+    for (int i = 0; i < m_queue.size () && m_jobs.size () < max_transfers; ) {
+        Transfer *t = m_queue[i];
+        if (m_host_connections.value (t->url.host ()) >= max_host_transfers) {
+            ++i;
+            continue;
+        }
+        m_queue.removeAt (i);
+        start (t);
+    }
+}
+
+void DownloadScheduler::release (Transfer *t) {
+    m_jobs.remove (t->job);
+    t->job = nullptr;
+    QHash <QString, int>::iterator i = m_host_connections.find (t->url.host ());
+    if (i != m_host_connections.end () && --i.value () <= 0)
+        m_host_connections.erase (i);
+}
+
+void DownloadScheduler::remove (Transfer *t) {
+    if (t->job) {
+        t->job->kill (); // quiet, no result signal
+        release (t);
+    } else {
+        m_queue.removeAll (t);
+    }
+    m_transfers.remove (t->url.url ());
+    const GuardedList waiting = guarded (t->waiting);
+    for (int i = 0; i < t->waiting.size (); ++i)
+        m_requests.remove (t->waiting[i]);
+    delete t;
+    startTransfers ();
+    // nobody got it, let the others ask for it again
+    for (int i = 0; i < waiting.size (); ++i)
+        if (waiting[i])
+            waiting[i]->sharedDownloadDone ();
+}
+
+void DownloadScheduler::finish (Transfer *t, int error) {
+    const qint64 ms = t->time.elapsed ();
+    qCDebug(LOG_KMPLAYER_COMMON) << "DownloadScheduler: " << t->url.url () << " error " << error << " " << t->received << " bytes in " << ms << "ms latency " << t->latency << "ms " << (ms > 0 ? 8000 * t->received / ms : 0) << " bit/s";
+    m_metrics.time += ms;
+    if (t->latency > 0)
+        m_metrics.latency += t->latency;
+    m_transfers.remove (t->url.url ());
+    for (int i = 0; i < t->receivers.size (); ++i)
+        m_requests.remove (t->receivers[i]);
+    for (int i = 0; i < t->waiting.size (); ++i)
+        m_requests.remove (t->waiting[i]);
+    const GuardedList receivers = guarded (t->receivers);
+    const GuardedList waiting = guarded (t->waiting);
+    delete t;
+    startTransfers ();
+    for (int i = 0; i < receivers.size (); ++i)
+        if (receivers[i])
+            receivers[i]->downloadResult (error);
+    for (int i = 0; i < waiting.size (); ++i)
+        if (waiting[i])
+            waiting[i]->sharedDownloadDone ();
+}
+
+void DownloadScheduler::slotData (KIO::Job *job, const QByteArray &qb) {
+    Transfer *t = m_jobs.value (job);
+    if (!t || qb.isEmpty ())
+        return;
+    if (!t->answered) {
+        t->answered = true;
+        if (t->latency < 0)
+            t->latency = t->time.elapsed ();
+        if (t->received > 0 && !job->queryMetaData ("HTTP-Headers").contains
+                (QString ("Content-Range"), Qt::CaseInsensitive))
+            t->skip = t->received; // server ignored the range, starts over
+    }
+    QByteArray chunk = qb;
+    if (t->skip > 0) {
+        const int skipped = (int) qMin (t->skip, qint64 (chunk.size ()));
+        t->skip -= skipped;
+        if (skipped == chunk.size ())
+            return;
+        chunk = chunk.mid (skipped);
+    }
+    t->received += chunk.size ();
+    m_metrics.bytes += chunk.size ();
+    MediaManager *mgr = (MediaManager *) t->receivers.first ()->node->document ()->role (RoleMediaManager);
+    if (mgr)
+        mgr->bandwidth ()->received (chunk.size ());
+    if (t->store) {
+        if (t->body.size () + chunk.size () > max_store_size) {
+            t->store = false;
+            t->body = QByteArray ();
+        } else {
+            t->body.append (chunk);
+        }
+    }
+    deliverData (t, chunk);
+}
+
+void DownloadScheduler::slotMimetype (KIO::Job *job, const QString &mime) {
+    Transfer *t = m_jobs.value (job);
+    if (!t)
+        return;
+    t->mime = mime;
+    deliverMimetype (t, mime);
+}
+
+void DownloadScheduler::slotPendingMimetypes () {
+    // by url, as a delivery may end other transfers
+    QStringList urls;
+    const QHash <QString, Transfer *>::const_iterator e = m_transfers.constEnd ();
+    for (QHash <QString, Transfer *>::const_iterator i = m_transfers.constBegin (); i != e; ++i)
+        if (!i.value ()->mime_pending.isEmpty ())
+            urls.append (i.key ());
+    for (int i = 0; i < urls.size (); ++i) {
+        Transfer *t = m_transfers.value (urls[i]);
+        if (t && !t->mime_pending.isEmpty ())
+            deliverPendingMimetype (t);
+    }
+}
+
+void DownloadScheduler::slotResult (KJob *job) {
+    Transfer *t = m_jobs.value (job);
+    if (!t)
+        return;
+    const QString code = t->job->queryMetaData ("responsecode");
+    const QString headers = t->job->queryMetaData ("HTTP-Headers");
+    release (t); // signal KIO::Job::result deletes itself
+    const int error = job->error ();
+    if (t->store && code == "304") {
+        QString mime;
+        QByteArray data;
+        if (!m_disk_cache->revalidated (t->url.url (), headers, mime, data)) {
+            finish (t, KIO::ERR_NO_CONTENT);
+            return;
+        }
+        qCDebug(LOG_KMPLAYER_COMMON) << "DownloadScheduler: not modified " << t->url.url ();
+        if (deliverMimetype (t, mime) && deliverData (t, data))
+            finish (t, 0);
+        return;
+    }
+    if (error && t->received > 0 && t->resumes < max_resumes &&
+            resumable (t->url, error)) {
+        t->resumes++;
+        m_metrics.resumes++;
+        qCDebug(LOG_KMPLAYER_COMMON) << "DownloadScheduler: resume " << t->url.url () << " at " << t->received;
+        enqueue (t);
+        startTransfers ();
+        return;
+    }
+    if (!error && t->store && !t->resumes)
+        m_disk_cache->store (t->url.url (), t->mime, t->body, headers);
+    finish (t, error);
+}
+
+bool DownloadScheduler::deliverData (Transfer *t, const QByteArray &data) {
+    if (!t->mime_pending.isEmpty () && !deliverPendingMimetype (t))
+        return false;
+    const GuardedList receivers = guarded (t->receivers);
+    m_delivering = t;
+    for (int i = 0; i < receivers.size (); ++i)
+        if (receivers[i] && t->receivers.contains (receivers[i]))
+            receivers[i]->downloadData (data);
+    m_delivering = nullptr;
+    if (t->receivers.isEmpty ()) {
+        remove (t);
+        return false;
+    }
+    return true;
+}
+
+bool DownloadScheduler::deliverMimetype (Transfer *t, const QString &mime) {
+    t->mime_pending.clear ();
+    const GuardedList receivers = guarded (t->receivers);
+    m_delivering = t;
+    for (int i = 0; i < receivers.size (); ++i)
+        if (receivers[i] && t->receivers.contains (receivers[i]))
+            receivers[i]->downloadMimetype (mime);
+    m_delivering = nullptr;
+    if (t->receivers.isEmpty ()) {
+        remove (t);
+        return false;
+    }
+    return true;
+}
+
+bool DownloadScheduler::deliverPendingMimetype (Transfer *t) {
+    const GuardedList receivers = guarded (t->mime_pending);
+    t->mime_pending.clear ();
+    m_delivering = t;
+    for (int i = 0; i < receivers.size (); ++i)
+        if (receivers[i] && t->receivers.contains (receivers[i]))
+            receivers[i]->downloadMimetype (t->mime);
+    m_delivering = nullptr;
+    if (t->receivers.isEmpty ()) {
+        remove (t);
+        return false;
+    }
+    return true;
+}
+
+#include "moc_downloadscheduler.cpp"
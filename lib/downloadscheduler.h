@@ -0,0 +1,100 @@
+/*
+    This file belong to the KMPlayer project, a movie player plugin for Konqueror
+    SPDX-FileCopyrightText: 2026 The KMPlayer authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#ifndef _KMPLAYER_DOWNLOADSCHEDULER_H_
+#define _KMPLAYER_DOWNLOADSCHEDULER_H_
+
+#include "config-kmplayer.h"
+
+#include <QObject>
+#include <QString>
+#include <QList>
+#include <QHash>
+#include <QUrl>
+
+#include "kmplayercommon_export.h"
+
+class KJob;
+namespace KIO {
+    class Job;
+}
+
+namespace KMPlayer {
+
+class MediaInfo;
+class DiskCache;
+
+/*
+ * Queues the downloads of MediaInfo. Only a few transfers run at the same
+ * time per host, the others wait on priority, what's needed now before
+ * what's prefetched. Requests for an url that's already transferring share
+ * that transfer, those coming after its first data get the url again when
+ * it's done, from the memory cache. A broken http transfer resumes with a
+ * range request where it stopped. Http responses go into the disk cache,
+ * stale entries of it are revalidated with a conditional get.
+ */
+class KMPLAYERCOMMON_EXPORT DownloadScheduler : public QObject
+{
+    Q_OBJECT
+public:
+    enum Priority { PriorityNow = 0, PriorityPrefetch };
+    struct Metrics {
+        Metrics ()
+            : transfers (0), shared (0), resumes (0),
+              bytes (0), latency (0), time (0) {}
+        int transfers; // started
+        int shared;    // requests served by the transfer of another
+        int resumes;
+        qint64 bytes;
+        qint64 latency; // ms until the first data, summed over transfers
+        qint64 time;    // ms from start to end, summed over transfers
+    };
+
+    DownloadScheduler ();
+    ~DownloadScheduler () override;
+
+    void get (MediaInfo *info, const QUrl &url, Priority priority);
+    /* info doesn't want the data anymore */
+    void cancel (MediaInfo *info);
+    /* a waiting transfer moves in the queue, on its most urgent request */
+    void setPriority (MediaInfo *info, Priority priority);
+    const Metrics &metrics () const { return m_metrics; }
+    DiskCache *diskCache () const { return m_disk_cache; }
+
+private Q_SLOTS:
+    void slotData (KIO::Job *job, const QByteArray &qb) KMPLAYERCOMMON_NO_EXPORT;
+    void slotMimetype (KIO::Job *job, const QString &mime) KMPLAYERCOMMON_NO_EXPORT;
+    void slotResult (KJob *job) KMPLAYERCOMMON_NO_EXPORT;
+    void slotPendingMimetypes () KMPLAYERCOMMON_NO_EXPORT;
+
+private:
+    struct Transfer;
+    void enqueue (Transfer *t) KMPLAYERCOMMON_NO_EXPORT;
+    void reprioritize (Transfer *t) KMPLAYERCOMMON_NO_EXPORT;
+    void start (Transfer *t) KMPLAYERCOMMON_NO_EXPORT;
+    void startTransfers () KMPLAYERCOMMON_NO_EXPORT;
+    void release (Transfer *t) KMPLAYERCOMMON_NO_EXPORT;
+    void remove (Transfer *t) KMPLAYERCOMMON_NO_EXPORT;
+    void finish (Transfer *t, int error) KMPLAYERCOMMON_NO_EXPORT;
+    bool deliverData (Transfer *t, const QByteArray &data) KMPLAYERCOMMON_NO_EXPORT;
+    bool deliverMimetype (Transfer *t, const QString &mime) KMPLAYERCOMMON_NO_EXPORT;
+    bool deliverPendingMimetype (Transfer *t) KMPLAYERCOMMON_NO_EXPORT;
+
+    QList <Transfer *> m_queue; // on priority, then order of request
+    QHash <QString, Transfer *> m_transfers;
+    QHash <KJob *, Transfer *> m_jobs;
+    QHash <MediaInfo *, Transfer *> m_requests;
+    QHash <QString, int> m_host_connections;
+    Transfer *m_delivering;
+    DiskCache *m_disk_cache;
+    Metrics m_metrics;
+    quint64 m_order;
+};
+
+} // namespace
+
+#endif
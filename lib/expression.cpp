@@ -11,6 +11,7 @@
 #include <cstring>
 #include <ctime>
 #include <QUrl>
+#include <QHash>
 #include "expression.h"
 
 #include <QRegExp>
@@ -133,6 +134,7 @@ struct AST : public Expression {
     virtual Type type(bool calc) const;
     void setRoot (Node *root) override;
     void setRoot (const NodeValue &value);
+    bool dependsOnValues () const override;
 #ifdef KMPLAYER_EXPR_DEBUG
     virtual void dump () const;
 #endif
@@ -267,6 +269,7 @@ struct PredicateFilter : public SequenceBase {
     }
 
     ExprIterator* exprIterator(ExprIterator* parent) const override;
+    bool dependsOnValues () const override { return true; }
 #ifdef KMPLAYER_EXPR_DEBUG
     virtual void dump () const {
         fprintf (stderr, "Predicate ");
@@ -417,12 +420,14 @@ struct SubSequence : public SequenceBase {
     SubSequence (EvalState *ev) : SequenceBase (ev) {}
 
     ExprIterator* exprIterator(ExprIterator* parent) const override;
+    bool dependsOnValues () const override { return true; }
 };
 
 struct Tokenize : public SequenceBase {
     Tokenize (EvalState *ev) : SequenceBase (ev) {}
 
     ExprIterator* exprIterator(ExprIterator* parent) const override;
+    bool dependsOnValues () const override { return true; }
 };
 
 struct Multiply : public AST {
@@ -592,6 +597,13 @@ void AST::setRoot (const NodeValue& value) {
     eval_state->sequence++;
 }
 
+bool AST::dependsOnValues () const {
+    for (AST *child = first_child; child; child = child->next_sibling)
+        if (child->dependsOnValues ())
+            return true;
+    return false;
+}
+
 #ifdef KMPLAYER_EXPR_DEBUG
 void AST::dump () const {
     if (first_child) {
@@ -2210,6 +2222,40 @@ Expression* KMPlayer::evaluateExpr(const QByteArray& expr, const QString &root)
     }
     return nullptr;
 }
+namespace {
+
+struct ExprCache {
+    ~ExprCache () {
+        clear ();
+    }
+    void clear () {
+        const QHash <QString, Expression *>::iterator e = map.end ();
+        for (QHash <QString, Expression *>::iterator i = map.begin (); i != e; ++i)
+            delete i.value ();
+        map.clear ();
+    }
+    QHash <QString, Expression *> map;
+};
+
+static const int expr_cache_size = 512;
+
+}
+
+Expression* KMPlayer::cachedExpr(const QString& expr, const QString &root) {
+    static ExprCache cache;
+    QString key = root;
+    key += QChar ('\n');
+    key += expr;
+    QHash <QString, Expression *>::const_iterator i = cache.map.constFind (key);
+    if (i != cache.map.constEnd ())
+        return i.value (); // also caches parse errors as null
+    if (cache.map.size () >= expr_cache_size)
+        cache.clear ();
+    Expression *res = evaluateExpr (expr.toUtf8 (), root);
+    cache.map.insert (key, res);
+    return res;
+}
+
 /*
 int main (int argc, char **argv) {
     AST ast;
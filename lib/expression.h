@@ -52,10 +52,20 @@ public:
     virtual iterator begin() const = 0;
     virtual iterator end() const = 0;
     virtual void setRoot (Node *root) = 0;
+    /* resulting nodes may change by a value change, not only by tree changes */
+    virtual bool dependsOnValues () const = 0;
 };
 
 Expression* evaluateExpr(const QByteArray& expr, const QString& root = QString());
 
+/*
+ * Parsed once and shared by all callers with the same expr and root tag.
+ * Don't delete the result, and set the root before every evaluation.
+ * Only for expressions evaluated at once, not for iterating while the
+ * document may change, as the same instance may be evaluated from there.
+ */
+Expression* cachedExpr(const QString& expr, const QString& root = QString());
+
 }
 
 #endif
@@ -15,6 +15,7 @@
 #include <QRegExp>
 #include <QTimer>
 #include <QBuffer>
+#include <QSet>
 
 #include <KIO/Job>
 
@@ -145,6 +146,14 @@ static Node *findHeadNode (SMIL::Smil *s)
     return nullptr;
 }
 
+static Node *findBodyNode (SMIL::Smil *s)
+{
+    for (Node *b = s ? s->firstChild () : nullptr; b; b = b->nextSibling ())
+        if (SMIL::id_node_body == b->id)
+            return b;
+    return nullptr;
+}
+
 static SMIL::Transition *findTransition (Node *n, const QString &id)
 {
     Node *head = findHeadNode (SMIL::Smil::findSmilNode (n));
@@ -287,6 +296,7 @@ void Runtime::init ()
     }
     repeat = repeat_count = 1;
     trans_in_dur = 0;
+    seek_offset = 0;
     timingstate = TimingsInit;
     for (int i = 0; i < (int) DurTimeLast; i++)
         durations [i].clear ();
@@ -307,6 +317,24 @@ void Runtime::initialize ()
     timingstate = Runtime::TimingsInitialized;
 }
 
+namespace {
+
+/*
+ * Payload of a statechange(expr) listener. Keeps the state nodes selected
+ * by expr, as long as the structure of the state doesn't change.
+ */
+struct StateListener : public VirtualVoid {
+    StateListener (Expression *e) : expr (e), version (0) {}
+    ~StateListener () override {
+        delete expr;
+    }
+    Expression *expr;
+    QSet <Node *> nodes;
+    unsigned int version;
+};
+
+}
+
 static
 void setDurationItem (Node *n, const QString &val, Runtime::DurationItem *itm) {
     int dur = -2; // also 0 for 'media' duration, so it will not update then
@@ -392,7 +420,9 @@ void setDurationItem (Node *n, const QString &val, Runtime::DurationItem *itm) {
                 if (op > -1) {
                     int cp = vl.indexOf (')', op + 1);
                     if (cp > -1) {
-                        payload = evaluateExpr(vl.mid(op + 1, cp - op - 1).toUtf8(), "data");
+                        Expression *expr = evaluateExpr(vl.mid(op + 1, cp - op - 1).toUtf8(), "data");
+                        if (expr)
+                            payload = new StateListener (expr);
                         dur = Runtime::DurStateChanged;
                     }
                 }
@@ -454,12 +484,11 @@ void setDurationItems (Node *n, const QString &s, Runtime::DurationItem *item) {
 static bool disabledByExpr (Runtime *rt) {
     bool b = false;
     if (!rt->expr.isEmpty ()) {
-        Expression* res = evaluateExpr(rt->expr.toUtf8(), "data");
+        Expression* res = cachedExpr(rt->expr, "data");
         if (res) {
             SMIL::Smil *smil = SMIL::Smil::findSmilNode (rt->element);
             res->setRoot (smil ? smil->state_node.ptr() : nullptr);
             b = !res->toBool ();
-            delete res;
         }
     }
     return b;
@@ -508,9 +537,15 @@ void Runtime::start () {
         default:
             break;
     }
-    if (stop)   // wait for event
+    if (!stop && seek_offset > 0 && offset > 0) { // begin passed already
+        const int skip = qMin (offset, seek_offset);
+        offset -= skip;
+        seek_offset -= skip;
+    }
+    if (stop) {   // wait for event
+        seek_offset = 0;
         tryFinish ();
-    else if (offset > 0)               // start timer
+    } else if (offset > 0)               // start timer
         begin_timer = element->document ()->post (element,
                 new TimerPosting (10 * offset, begin_timer_id));
     else                               // start now
@@ -636,6 +671,7 @@ void Runtime::message (MessageType msg, void *content) {
                 element->deliver (MsgEventStarted, event);
                 if (guard) {
                     element->begin ();
+                    seek_offset = 0; // handed to the children by begin ()
                     if (!element->document ()->postponed ())
                         tryFinish ();
                 }
@@ -793,9 +829,27 @@ void Runtime::setDuration () {
     } else if (endTime ().durval == DurTimer) {
         duration = endTime ().offset;
     }
+    if (seek_offset > 0) { // skip the repeats that played already
+        int simple = duration;
+        if (simple <= 0) {
+            SMIL::Smil *smil = SMIL::Smil::findSmilNode (element);
+            const int i = smil ? smil->timeline.find (element) : -1;
+            if (i > -1)
+                simple = smil->timeline.interval (i).simple;
+        }
+        if (simple > 0 && SmilTimeline::Indefinite != simple) {
+            int laps = seek_offset / simple;
+            if (DurIndefinite != repeat_count) {
+                laps = qMax (0, qMin (laps, repeat_count - 1));
+                repeat_count -= laps;
+            }
+            seek_offset -= laps * simple;
+        }
+    }
     if (duration > 0)
         duration_timer = element->document ()->post (element,
-                new TimerPosting (10 * duration, dur_timer_id));
+                new TimerPosting (10 * qMax (0, duration - seek_offset),
+                    dur_timer_id));
 }
 
 bool Runtime::started () const {
@@ -1378,6 +1432,11 @@ Node *SMIL::Smil::childFromTag (const QString & tag) {
 
 void SMIL::Smil::activate () {
     resolved = true;
+    struct timeval tv;
+    document ()->timeOfDay (tv); // starts the clock if not yet running
+    begin_time = document ()->currentTime ();
+    postponed_time = document ()->postponed () ? begin_time : -1;
+    document_postponed.connect (document (), MsgEventPostponed, this);
     if (layout_node)
         Element::activate ();
     else
@@ -1385,6 +1444,7 @@ void SMIL::Smil::activate () {
 }
 
 void SMIL::Smil::deactivate () {
+    document_postponed.disconnect ();
     Mrl::deactivate ();
 }
 
@@ -1406,6 +1466,18 @@ void SMIL::Smil::message (MessageType msg, void *content) {
         break;
     }
 
+    case MsgEventPostponed: {
+        // the timers are shifted by the paused time, so is the start
+        PostponedEvent *pe = static_cast <PostponedEvent *> (content);
+        if (pe->is_postponed) {
+            postponed_time = document ()->currentTime ();
+        } else if (postponed_time > -1) {
+            begin_time += document ()->currentTime () - postponed_time;
+            postponed_time = -1;
+        }
+        return;
+    }
+
     case MsgSurfaceBoundsUpdate: {
         Layout *layout = convertNode <SMIL::Layout> (layout_node);
         if (layout && layout->root_layout)
@@ -1476,6 +1548,39 @@ void SMIL::Smil::jump (const QString & id) {
     }
 }
 
+bool SMIL::Smil::seek (int pos) {
+    Node *body = findBodyNode (this);
+    if (!body || !body->active ())
+        return false;
+    timeline.update (body);
+    const int t = 10 * pos;
+    if (t < 0 || t >= timeline.resolvedUntil ()) {
+        qCDebug(LOG_KMPLAYER_COMMON) << "Smil::seek " << pos << " not resolved";
+        return false;
+    }
+    body->reset ();
+    Runtime *rt = (Runtime *) body->role (RoleTiming);
+    rt->seek_offset = t;
+    begin_time = document ()->currentTime () - 10 * t;
+    if (postponed_time > -1)
+        postponed_time = begin_time + 10 * t;
+    body->activate ();
+    return true;
+}
+
+int SMIL::Smil::length () {
+    timeline.update (findBodyNode (this));
+    const int len = timeline.duration ();
+    return SmilTimeline::Unresolved == len || SmilTimeline::Indefinite == len
+        ? 0 : len / 10;
+}
+
+int SMIL::Smil::position () {
+    const int now = postponed_time > -1
+        ? postponed_time : document ()->currentTime ();
+    return qMax (0, now - begin_time) / 100;
+}
+
 SMIL::Smil * SMIL::Smil::findSmilNode (Node * node) {
     for (Node * e = node; e; e = e->parentNode ())
         if (e->id == SMIL::id_node_smil)
@@ -1484,13 +1589,11 @@ SMIL::Smil * SMIL::Smil::findSmilNode (Node * node) {
 }
 
 static QString exprStringValue (Node *node, const QString &str) {
-    Expression* res = evaluateExpr(str.toUtf8(), "data");
+    Expression* res = cachedExpr(str, "data");
     if (res) {
         SMIL::Smil *smil = SMIL::Smil::findSmilNode (node);
         res->setRoot (smil ? smil->state_node.ptr() : nullptr);
-        QString s = res->toString();
-        delete res;
-        return s;
+        return res->toString();
     }
     return str;
 }
@@ -1549,7 +1652,10 @@ void SMIL::Head::message (MessageType msg, void *content) {
 //-----------------------------------------------------------------------------
 
 SMIL::State::State (NodePtr &d)
- : Element (d, id_node_state), media_info (nullptr) {}
+ : Element (d, id_node_state),
+   media_info (nullptr),
+   m_tree_version (0),
+   m_structure_version (1) {}
 
 Node *SMIL::State::childFromTag (const QString &tag) {
     if (tag == "data")
@@ -1613,17 +1719,41 @@ QString SMIL::State::domain () {
 }
 
 void SMIL::State::stateChanged (Node *ref) {
+    if (m_tree_version != document ()->m_tree_version) {
+        m_tree_version = document ()->m_tree_version;
+        ++m_structure_version;
+    }
+    // selected elements only change by structure, unless predicates are used
+    const bool indexed = ref->isElementNode ();
     Connection *c = m_StateChangeListeners.first ();
     for (; c; c = m_StateChangeListeners.next ()) {
         if (c->payload && c->connecter) {
-            Expression *expr = (Expression *) c->payload;
-            expr->setRoot (this);
-            Expression::iterator it, e = expr->end();
-            for (it = expr->begin(); it != e; ++it) {
-                if (it->node == ref)
-                    document()->post (c->connecter,
-                                     new Posting (this, MsgStateChanged, expr));
+            StateListener *listener = static_cast <StateListener *> (c->payload);
+            Expression *expr = listener->expr;
+            bool changed = false;
+            if (indexed && !expr->dependsOnValues ()) {
+                if (listener->version != m_structure_version) {
+                    listener->nodes.clear ();
+                    expr->setRoot (this);
+                    Expression::iterator it, e = expr->end();
+                    for (it = expr->begin(); it != e; ++it)
+                        if (it->node && it->node->isElementNode ())
+                            listener->nodes.insert (it->node);
+                    listener->version = m_structure_version;
+                }
+                changed = listener->nodes.contains (ref);
+            } else {
+                expr->setRoot (this);
+                Expression::iterator it, e = expr->end();
+                for (it = expr->begin(); it != e; ++it)
+                    if (it->node == ref) {
+                        changed = true;
+                        break;
+                    }
             }
+            if (changed)
+                document()->post (c->connecter,
+                        new Posting (this, MsgStateChanged, listener));
         }
     }
 }
@@ -1631,9 +1761,12 @@ void SMIL::State::stateChanged (Node *ref) {
 void SMIL::State::setValue (Node *ref, const QString &value) {
     const QString old = ref->nodeValue ();
     const QString s = exprStringValue (this, value);
+    const bool known = m_tree_version == document ()->m_tree_version;
     ref->clearChildren ();
     if (!s.isEmpty ())
         ref->appendChild (new TextNode (m_doc, s));
+    if (known) // only the text of ref changed, not the elements
+        m_tree_version = document ()->m_tree_version;
     if (s != old)
         stateChanged (ref);
 }
@@ -2274,6 +2407,44 @@ void SMIL::GroupBase::finish () {
     runtime->finish ();
 }
 
+static bool freezes (Runtime *rt) {
+    bool auto_freeze = (Runtime::DurTimer == rt->durTime ().durval &&
+                0 == rt->durTime ().offset &&
+                Runtime::DurMedia == rt->endTime ().durval) &&
+        rt->fill_active != Runtime::fill_remove;
+    return auto_freeze || rt->fill_active == Runtime::fill_freeze ||
+        rt->fill_active == Runtime::fill_hold ||
+        rt->fill_active == Runtime::fill_transition;
+}
+
+/*
+ * On a seek, a time container passes the time since its begin to a child
+ * before activating it. A child that played before that time is set to
+ * finished as if it did, unless it freezes, and false is returned.
+ */
+static bool seekChild (Node *c, int t, bool freeze) {
+    Runtime *rt = (Runtime *) c->role (RoleTiming);
+    SMIL::Smil *smil = rt ? SMIL::Smil::findSmilNode (c) : nullptr;
+    const int i = smil ? smil->timeline.find (c) : -1;
+    if (i < 0)
+        return true;
+    const SmilTimeline::Interval &iv = smil->timeline.interval (i);
+    if (SmilTimeline::Unresolved == iv.begin)
+        return true; // waits for its event
+    if (SmilTimeline::Unresolved != iv.end && iv.end <= t) {
+        c->state = Node::state_activated; // as for a jump
+        static_cast <Element *> (c)->init ();
+        if (!freeze || !freezes (rt)) {
+            c->state = Node::state_finished;
+            rt->timingstate = Runtime::timings_stopped;
+            return false;
+        }
+        c->state = Node::state_init;
+    }
+    rt->seek_offset = t - iv.activate;
+    return true;
+}
+
 namespace {
 
 class GroupBaseInitVisitor : public Visitor {
@@ -2324,15 +2495,7 @@ class FreezeStateUpdater : public Visitor {
     bool freeze;
 
     void setFreezeState (Runtime *rt) {
-        bool auto_freeze = (Runtime::DurTimer == rt->durTime ().durval &&
-                    0 == rt->durTime ().offset &&
-                    Runtime::DurMedia == rt->endTime ().durval) &&
-            rt->fill_active != Runtime::fill_remove;
-        bool cfg_freeze = rt->fill_active == Runtime::fill_freeze ||
-            rt->fill_active == Runtime::fill_hold ||
-            rt->fill_active == Runtime::fill_transition;
-
-        bool do_freeze = freeze && (auto_freeze || cfg_freeze);
+        bool do_freeze = freeze && freezes (rt);
         if (do_freeze && rt->timingstate == Runtime::timings_stopped) {
             rt->timingstate = Runtime::timings_freezed;
             rt->element->message (MsgStateFreeze);
@@ -2355,6 +2518,12 @@ public:
 
     FreezeStateUpdater () : initial_node (true), freeze (true) {}
 
+    /* only child changed, its siblings keep their freeze state */
+    void updateChild (Node *child, bool frozen) {
+        initial_node = false;
+        freeze = frozen;
+        child->accept (this);
+    }
     void visit (Element *elm) override {
         updateNode (elm);
     }
@@ -2368,8 +2537,12 @@ public:
         updateNode (seq);
         freeze = freeze && seq->runtime->active ();
 
+        // skip the finished children, so a long seq isn't walked each time
+        Node *start = seq->first_active.ptr ();
+        if (!start || start->parentNode () != seq || !start->active ())
+            start = seq->firstChild ();
         Runtime *prev = nullptr;
-        for (NodePtr n = seq->firstChild (); n; n = n->nextSibling ()) {
+        for (NodePtr n = start; n; n = n->nextSibling ()) {
             if (n->active ()) {
                 Runtime *rt = (Runtime *) n->role (RoleTiming);
                 if (rt) {
@@ -2398,6 +2571,9 @@ public:
             if (prev->timingstate == Runtime::timings_stopped)
                 prev->element->deactivate();
         }
+        while (start && !start->active ())
+            start = start->nextSibling ();
+        seq->first_active = start;
 
         freeze = old_freeze;
     }
@@ -2556,8 +2732,10 @@ void SMIL::GroupBase::setJumpNode (NodePtr n) {
 void SMIL::Par::begin () {
     jump_node = nullptr; // TODO: adjust timings
     setState (state_began);
+    const int seek = runtime->seek_offset;
     for (NodePtr e = firstChild (); e; e = e->nextSibling ())
-        e->activate ();
+        if (seek <= 0 || seekChild (e, seek, true))
+            e->activate ();
 }
 
 void SMIL::Par::reset () {
@@ -2589,9 +2767,12 @@ void SMIL::Par::message (MessageType msg, void *content) {
         return;
 
     case MsgChildFinished: {
+        Posting *post = (Posting *) content;
         if (unfinished ()) {
-            FreezeStateUpdater visitor;
-            accept (&visitor);
+            if (post->source) {
+                FreezeStateUpdater visitor;
+                visitor.updateChild (post->source, runtime->active ());
+            }
             runtime->tryFinish ();
         }
         return;
@@ -2615,8 +2796,42 @@ void *SMIL::Par::role (RoleType msg, void *content) {
 
 //-----------------------------------------------------------------------------
 
+/*
+ * Seq::begin on a seek, finishes the children played before the seek time
+ * and activates the one at it
+ */
+static bool seekSeq (SMIL::Seq *seq, int t) {
+    SMIL::Smil *smil = SMIL::Smil::findSmilNode (seq);
+    const int i = smil ? smil->timeline.find (seq) : -1;
+    if (i < 0)
+        return false;
+    const int cur = smil->timeline.childAt (i, t);
+    Node *target = cur > -1 ? smil->timeline.interval (cur).node.ptr () : nullptr;
+    for (Node *c = seq->firstChild (); c; c = c->nextSibling ()) {
+        if (c == target) {
+            seq->starting_connection.connect (c, MsgEventStarted, seq);
+            seekChild (c, t, false);
+            c->activate ();
+            return true;
+        }
+        c->state = Node::state_activated;
+        if (c->isElementNode ())
+            static_cast <Element *> (c)->init ();
+        c->state = Node::state_finished;
+        Runtime *rt = (Runtime *) c->role (RoleTiming);
+        if (rt)
+            rt->timingstate = Runtime::timings_stopped;
+    }
+    seq->runtime->tryFinish (); // seek time is past the children
+    return true;
+}
+
 void SMIL::Seq::begin () {
     setState (state_began);
+    first_active = nullptr;
+    if (!jump_node && runtime->seek_offset > 0 &&
+            seekSeq (this, runtime->seek_offset))
+        return;
     if (jump_node) {
         starting_connection.disconnect ();
         trans_connection.disconnect ();
@@ -2741,8 +2956,9 @@ namespace {
 
 class ExclActivateVisitor : public Visitor {
     SMIL::Excl *excl;
+    int seek;
 public:
-    ExclActivateVisitor (SMIL::Excl *ex) : excl (ex) {}
+    ExclActivateVisitor (SMIL::Excl *ex, int t) : excl (ex), seek (t) {}
 
     using Visitor::visit;
 
@@ -2752,7 +2968,7 @@ public:
             s->accept (this);
     }
     void visit (Element *elm) override {
-        if (elm->role (RoleTiming)) {
+        if (elm->role (RoleTiming) && (seek <= 0 || seekChild (elm, seek, false))) {
             // make aboutToStart connection with Timing
             excl->started_event_list =
                 new SMIL::Excl::ConnectionItem (excl->started_event_list);
@@ -2880,7 +3096,7 @@ SMIL::Excl::~Excl () {
 void SMIL::Excl::begin () {
     Node *n = firstChild ();
     if (n) {
-        ExclActivateVisitor visitor (this);
+        ExclActivateVisitor visitor (this, runtime->seek_offset);
         n->accept (&visitor);
     }
 }
@@ -3067,7 +3283,7 @@ Node *SMIL::Switch::chosenOne () {
                                 } else if (int (mt->bitrate) <= max) {
                                     int delta1 = pref > currate ? pref-currate : currate-pref;
                                     int delta2 = pref > int (mt->bitrate) ? pref-mt->bitrate : mt->bitrate-pref;
-                                    if (delta2 < delta1) {
+                                    if (delta2 < delta1 || currate > max) {
                                         chosen_one = e;
                                         currate = mt->bitrate;
                                     }
@@ -3318,7 +3534,7 @@ void SMIL::MediaType::parseParam (const TrieString &para, const QString & val) {
         pan_zoom->height = coords[3];
     } else if (parseBackgroundParam (background_color, para, val) ||
             parseMediaOpacityParam (media_opacity, para, val)) {
-    } else if (para == "system-bitrate") {
+    } else if (para == "system-bitrate" || para == "systemBitrate") {
         bitrate = val.toInt ();
     } else if (parseTransitionParam (this, transition, runtime, para, val)) {
     } else if (para == "sensitivity") {
@@ -3430,6 +3646,8 @@ void SMIL::MediaType::undefer () {
 void SMIL::MediaType::begin () {
     if (!src.isEmpty () && !media_info)
         prefetch ();
+    if (media_info)
+        media_info->setPrefetch (false);
     if (media_info && media_info->downloading ()) {
         postpone_lock = document ()->postpone ();
         state = state_began;
@@ -3438,13 +3656,19 @@ void SMIL::MediaType::begin () {
 
     SMIL::RegionBase *r = findRegion (this, param (Ids::attr_region));
     transition.cancelTimer (this); // eg transOut and we're repeating
+    const int seek = runtime->seek_offset;
     for (NodePtr c = firstChild (); c; c = c->nextSibling ())
-        if (SMIL::id_node_param != c->id && c != external_tree)
+        if (SMIL::id_node_param != c->id && c != external_tree &&
+                (seek <= 0 || seekChild (c, seek, true)))
             c->activate (); // activate set/animate.. children
     if (r) {
         region_node = r;
         region_attach.connect (r, MsgSurfaceAttach, this);
         r->repaint ();
+        if (seek > 0 && media_info && media_info->media &&
+                MediaManager::AudioVideo == media_info->media->type ())
+            static_cast <AudioVideoMedia *> (media_info->media)->start_position
+                = seek / 10;
         clipStart ();
         transition.begin (this, runtime);
     } else {
@@ -3610,8 +3834,11 @@ void SMIL::MediaType::message (MessageType msg, void *content) {
         case MsgMediaPrefetch:
             if (content) {
                 init ();
-                if (!src.isEmpty () && !media_info)
+                if (!src.isEmpty () && !media_info) {
                     prefetch ();
+                    if (media_info)
+                        media_info->setPrefetch (true);
+                }
             } else if (media_info) {
                 delete media_info;
                 media_info = nullptr;
@@ -3744,7 +3971,7 @@ namespace {
                     MediaManager::Image == mrl->media_info->type) {
                 ImageMedia *im=static_cast<ImageMedia*>(mrl->media_info->media);
                 if (im)
-                    im->updateRender ();
+                    im->updateRender (this);
             }
         }
 
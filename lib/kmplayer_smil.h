@@ -12,6 +12,7 @@
 #include <QStringList>
 
 #include "kmplayerplaylist.h"
+#include "smiltimeline.h"
 #include "surface.h"
 
 struct TransTypeInfo;
@@ -115,6 +116,7 @@ public:
     void initialize ();
     bool parseParam (const TrieString & name, const QString & value);
     TimingState state () const { return timingstate; }
+    int repeats () const { return repeat; }
     void message (MessageType msg, void *content=nullptr);
     void *role (RoleType msg, void *content=nullptr);
     /**
@@ -161,6 +163,7 @@ public:
     Fill fill_active;
     Element *element;
     int trans_in_dur;
+    int seek_offset; // on a seek, time since activation to skip
 private:
     void propagateStop (bool forced);
     void propagateStart ();
@@ -323,7 +326,7 @@ const short id_node_last = 200; // reserve 100 ids
  */
 class Smil : public Mrl {
 public:
-    Smil (NodePtr & d) : Mrl (d, id_node_smil) {}
+    Smil (NodePtr & d) : Mrl (d, id_node_smil), begin_time (0), postponed_time (-1) {}
     Node *childFromTag (const QString & tag) override;
     const char * nodeName () const override { return "smil"; }
     PlayType playType () override { return play_type_video; }
@@ -334,10 +337,20 @@ public:
     void message (MessageType msg, void *content=nullptr) override;
     void accept (Visitor *v) override { v->visit (this); }
     void jump (const QString & id);
+    /* seek (pos) restarts the body at pos deci-seconds, if resolved */
+    bool seek (int pos);
+    /* position () returns position in deci-seconds */
+    int position ();
+    /* length () returns length in deci-seconds, 0 if unresolved */
+    int length ();
     static Smil * findSmilNode (Node * node);
 
     NodePtrW layout_node;
     NodePtrW state_node;
+    SmilTimeline timeline;
+    int begin_time;                               // document time of start
+    int postponed_time;                           // document time of pause or -1
+    ConnectionLink document_postponed;            // pauses position too
 };
 
 /**
@@ -385,6 +398,8 @@ public:
     PostponePtr postpone_lock;                    // pause while loading src
     MediaInfo *media_info;
     QString m_url;
+    unsigned int m_tree_version;                  // document version last seen
+    unsigned int m_structure_version;             // bumped on element changes
 };
 
 /**
@@ -594,6 +609,7 @@ public:
     void accept (Visitor * v) override { v->visit (this); }
     ConnectionLink starting_connection;
     ConnectionLink trans_connection;
+    NodePtrW first_active; // children before it are deactivated
 protected:
     Seq (NodePtr & d, short id) : GroupBase(d, id) {}
 };
@@ -160,6 +160,8 @@ static const char * strVCDDevice = "VCD Device";
 const char * strUrlBackend = "URL Backend";
 static const char * strClickToPlay = "Click to Play";
 static const char * strAllowHref = "Allow HREF";
+static const char * strPlaylistThumbnails = "Playlist Thumbnails";
+static const char * strProbeMedia = "Probe Media";
 // postproc thingies
 static const char * strPPGroup = "Post processing options";
 static const char * strPostProcessing = "Post processing";
@@ -310,6 +312,8 @@ void Settings::readConfig () {
     audiodriver = mplayer.readEntry (strAoDriver, 0);
     clicktoplay = mplayer.readEntry (strClickToPlay, false);
     grabhref = mplayer.readEntry (strAllowHref, false);
+    playlistthumbnails = mplayer.readEntry (strPlaylistThumbnails, false);
+    probemedia = mplayer.readEntry (strProbeMedia, false);
 
     // recording
     KConfigGroup rec_cfg (m_config, strRecordingGroup);
@@ -425,6 +429,8 @@ void Settings::show (const char * pagename) {
     configdialog->m_GeneralPageGeneral->framedrop->setChecked (framedrop);
     configdialog->m_GeneralPageGeneral->adjustvolume->setChecked (autoadjustvolume);
     configdialog->m_GeneralPageGeneral->adjustcolors->setChecked (autoadjustcolors);
+    configdialog->m_GeneralPageGeneral->thumbnails->setChecked (playlistthumbnails);
+    configdialog->m_GeneralPageGeneral->probeMedia->setChecked (probemedia);
     //configdialog->m_GeneralPageGeneral->autoHideSlider->setChecked (autohideslider);
     configdialog->m_GeneralPageGeneral->showConfigButton->setChecked (showcnfbutton);
     configdialog->m_GeneralPageGeneral->showPlaylistButton->setChecked (showplaylistbutton);
@@ -565,6 +571,8 @@ void Settings::writeConfig () {
     mplayer_cfg.writeEntry (strAoDriver, audiodriver);
     mplayer_cfg.writeEntry (strClickToPlay, clicktoplay);
     mplayer_cfg.writeEntry (strAllowHref, grabhref);
+    mplayer_cfg.writeEntry (strPlaylistThumbnails, playlistthumbnails);
+    mplayer_cfg.writeEntry (strProbeMedia, probemedia);
     mplayer_cfg.writeEntry (strAddConfigButton, showcnfbutton);
     mplayer_cfg.writeEntry (strAddPlaylistButton, showplaylistbutton);
     mplayer_cfg.writeEntry (strAddRecordButton, showrecordbutton);
@@ -686,6 +694,8 @@ void Settings::okPressed () {
     framedrop = configdialog->m_GeneralPageGeneral->framedrop->isChecked ();
     autoadjustvolume = configdialog->m_GeneralPageGeneral->adjustvolume->isChecked ();
     autoadjustcolors = configdialog->m_GeneralPageGeneral->adjustcolors->isChecked ();
+    playlistthumbnails = configdialog->m_GeneralPageGeneral->thumbnails->isChecked ();
+    probemedia = configdialog->m_GeneralPageGeneral->probeMedia->isChecked ();
     showcnfbutton = configdialog->m_GeneralPageGeneral->showConfigButton->isChecked ();
     showplaylistbutton = configdialog->m_GeneralPageGeneral->showPlaylistButton->isChecked ();
     showrecordbutton = configdialog->m_GeneralPageGeneral->showRecordButton->isChecked ();
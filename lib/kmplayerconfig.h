@@ -129,6 +129,8 @@ public:
     bool autohideslider : 1;
     bool clicktoplay : 1;
     bool grabhref : 1;
+    bool playlistthumbnails : 1;
+    bool probemedia : 1;
 // postproc thingies
     bool postprocessing : 1;
     bool disableppauto : 1;
@@ -49,6 +49,9 @@
 #include "kmplayerconfig.h"
 #include "kmplayer_smil.h"
 #include "mediaobject.h"
+#include "mediaprober.h"
+#include "timeshift.h"
+#include "bandwidth.h"
 #include "partadaptor.h"
 
 namespace KMPlayer {
@@ -93,6 +96,7 @@ PartBase::PartBase (QWidget * wparent, QObject * parent, KSharedConfigPtr config
    m_settings (new Settings (this, config)),
    m_media_manager (new MediaManager (this)),
    m_play_model (new PlayModel (this, KIconLoader::global ())),
+   m_media_prober (nullptr),
    m_source (nullptr),
    m_bookmark_menu (nullptr),
    m_update_tree_timer (0),
@@ -272,6 +276,17 @@ void PartBase::settingsChanged () {
     if (!m_settings->showbroadcastbutton)
         m_view->controlPanel ()->broadcastButton ()->hide ();
     keepMovieAspect (m_settings->sizeratio);
+    m_play_model->setShowThumbnails (m_settings->playlistthumbnails);
+    if (m_settings->probemedia && !m_media_prober) {
+        m_media_prober = new MediaProber (this);
+        connect (m_media_prober, &MediaProber::probed,
+                this, &PartBase::mediaProbed);
+        if (m_source)
+            m_media_prober->probe (m_source->root ());
+    } else if (!m_settings->probemedia && m_media_prober) {
+        delete m_media_prober;
+        m_media_prober = nullptr;
+    }
     m_settings->applyColorSetting (true);
 }
 
@@ -553,6 +568,12 @@ void PartBase::slotPlayingStopped () {
     playingStarted ();
 }
 
+void PartBase::mediaProbed (Mrl *mrl) {
+    if (m_source && m_source->current () == mrl && mrl->length > 0)
+        m_source->setLength (mrl, mrl->length);
+    m_play_model->nodeChanged (mrl);
+}
+
 void PartBase::setPosition (int position, int length) {
     if (m_view && !m_bPosSliderPressed) {
         if (m_media_manager->processes ().size () > 1)
@@ -661,8 +682,11 @@ void PartBase::updateTree (bool full, bool force) {
     if (force) {
         m_in_update_tree = true;
         if (m_update_tree_full) {
-            if (m_source)
+            if (m_source) {
                 Q_EMIT treeChanged (0, m_source->root (), m_source->current (), true, false);
+                if (m_media_prober)
+                    m_media_prober->probe (m_source->root ());
+            }
         }
         m_in_update_tree = false;
         if (m_update_tree_timer) {
@@ -836,6 +860,8 @@ void PartBase::stop () {
 void PartBase::seek (qlonglong msec) {
     if (m_media_manager->processes ().size () == 1)
         m_media_manager->processes ().first ()->seek (msec/100, true);
+    else if (m_source)
+        m_source->seekTimeline (msec/100);
 }
 
 void PartBase::adjustVolume (int incdec) {
@@ -862,6 +888,8 @@ void PartBase::posSliderReleased () {
     const QSlider * posSlider = ::qobject_cast<const QSlider *> (sender ());
     if (m_media_manager->processes ().size () == 1)
         m_media_manager->processes ().first ()->seek (posSlider->value(), true);
+    else if (m_source)
+        m_source->seekTimeline (posSlider->value ());
 }
 
 void PartBase::volumeChanged (int val) {
@@ -993,7 +1021,8 @@ Source::Source (const QString&, PartBase * player, const char * n)
  : QObject (player),
    m_name (n), m_player (player),
    m_identified (false), m_auto_play (true), m_avoid_redirects (false),
-   m_frequency (0), m_xvport (0), m_xvencoding (-1), m_doc_timer (0) {
+   m_frequency (0), m_xvport (0), m_xvencoding (-1), m_time_shift (nullptr),
+   m_doc_timer (0) {
     init ();
 }
 
@@ -1078,16 +1107,66 @@ void Source::setAspect (NodePtr node, float a) {
         Q_EMIT dimensionsChanged ();
 }
 
-void Source::setLength (NodePtr, int len) {
+void Source::setLength (NodePtr node, int len) {
+    Mrl *mrl = node ? node->mrl () : nullptr;
+    if (mrl && len > 0)
+        mrl->length = len;
     m_length = len;
     m_player->setPosition (m_position, m_length);
 }
 
+void Source::setTimeShift (TimeShift *ts) {
+    if (ts == m_time_shift)
+        return;
+    delete m_time_shift;
+    m_time_shift = ts;
+    if (ts)
+        connect (ts, &TimeShift::progress, this, &Source::timeShiftProgress);
+}
+
+void Source::timeShiftProgress (int pos, int len) {
+    if (!m_time_shift || !m_time_shift->running ())
+        return;
+    const bool show_slider = !m_length && len > 0;
+    m_length = len;
+    m_position = pos;
+    m_player->setPosition (pos, len);
+    if (show_slider && m_player->view ())
+        m_player->viewWidget ()->controlPanel ()->showPositionSlider (true);
+}
+
 void Source::setPosition (int pos) {
     m_position = pos;
     m_player->setPosition (pos, m_length);
 }
 
+SMIL::Smil *Source::smil () const {
+    return m_current ? SMIL::Smil::findSmilNode (m_current.ptr ()) : nullptr;
+}
+
+void Source::timelineProgress () {
+    SMIL::Smil *s = smil ();
+    if (!s || !s->active () ||
+            !m_player->mediaManager ()->processes ().isEmpty ())
+        return; // a playing backend reports its own position
+    const int len = s->length ();
+    if (len <= 0)
+        return;
+    const bool show_slider = !m_length;
+    m_length = len;
+    setPosition (qMin (s->position (), len));
+    if (show_slider && m_player->view ())
+        m_player->viewWidget ()->controlPanel ()->showPositionSlider (true);
+}
+
+bool Source::seekTimeline (int pos) {
+    SMIL::Smil *s = smil ();
+    if (!s || !s->seek (pos))
+        return false;
+    timelineProgress ();
+    return true;
+}
+
 void Source::setLoading (int percentage) {
     m_player->setLoaded (percentage);
 }
@@ -1159,6 +1238,8 @@ void Source::reset () {
         m_document = doc;
         m_player->updateTree ();
     }
+    if (m_time_shift)
+        m_time_shift->stop ();
     init ();
 }
 
@@ -1197,9 +1278,10 @@ void Source::setTimeout (int ms) {
 }
 
 void Source::timerEvent (QTimerEvent * e) {
-    if (e->timerId () == m_doc_timer && m_document && m_document->active ())
+    if (e->timerId () == m_doc_timer && m_document && m_document->active ()) {
         m_document->document ()->timer (); // will call setTimeout()
-    else
+        timelineProgress ();
+    } else
         killTimer (e->timerId ());
 }
 
@@ -1208,6 +1290,8 @@ void Source::setCurrent (Mrl *mrl) {
     m_width = mrl->size.width;
     m_height = mrl->size.height;
     m_aspect = mrl->aspect;
+    if (mrl->length > 0) // probed or played before
+        setLength (mrl, mrl->length);
 }
 
 void Source::stateElementChanged (Node *elm, Node::State os, Node::State ns) {
@@ -1242,6 +1326,13 @@ void Source::stateElementChanged (Node *elm, Node::State os, Node::State ns) {
 void Source::bitRates (int & preferred, int & maximal) {
     preferred = 1024 * m_player->settings ()->prefbitrate;
     maximal= 1024 * m_player->settings ()->maxbitrate;
+    // don't pick more than the connection was measured to carry
+    const int measured = m_player->mediaManager ()->bandwidth ()->estimate ();
+    if (measured > 0 && measured < maximal) {
+        maximal = measured;
+        if (preferred > maximal)
+            preferred = maximal;
+    }
 }
 
 void Source::openUrl (const QUrl &url, const QString &t, const QString &srv) {
@@ -42,6 +42,8 @@ class BookmarkOwner;
 class PlayModel;
 class Settings;
 class MediaManager;
+class MediaProber;
+class TimeShift;
 
 
 /**
@@ -93,6 +95,9 @@ public:
     KMPLAYERCOMMON_NO_EXPORT const QString & tuner () const { return m_tuner; }
     KMPLAYERCOMMON_NO_EXPORT const char* name() const { return m_name; }
     KMPLAYERCOMMON_NO_EXPORT Mrl *current() { return m_current ? m_current->mrl() : nullptr;}
+    /* if set and running, playback is from the time shift buffer */
+    KMPLAYERCOMMON_NO_EXPORT TimeShift *timeShift () const { return m_time_shift; }
+    void setTimeShift (TimeShift *ts);
     virtual void setCurrent (Mrl *mrl);
     QString plugin (const QString &mime) const;
     virtual NodePtr document ();
@@ -113,6 +118,8 @@ public:
     void setLength (NodePtr, int len);
     /* setPosition (pos) set position in deci-seconds */
     void setPosition (int pos) KMPLAYERCOMMON_NO_EXPORT;
+    /* seekTimeline (pos) seeks a SMIL presentation to pos deci-seconds */
+    bool seekTimeline (int pos);
     virtual void setIdentified (bool b = true);
     KMPLAYERCOMMON_NO_EXPORT void setAutoPlay (bool b) { m_auto_play = b; }
     KMPLAYERCOMMON_NO_EXPORT bool autoPlay () const { return m_auto_play; }
@@ -178,7 +185,11 @@ protected:
     QString m_plugin;
     LangInfoPtr m_audio_infos;
     LangInfoPtr m_subtitle_infos;
+    TimeShift *m_time_shift;
 private:
+    SMIL::Smil *smil () const KMPLAYERCOMMON_NO_EXPORT;
+    void timelineProgress () KMPLAYERCOMMON_NO_EXPORT;
+
     int m_width;
     int m_height;
     float m_aspect;
@@ -187,6 +198,7 @@ private:
     int m_doc_timer;
 private Q_SLOTS:
     void changedUrl();
+    void timeShiftProgress (int position, int length) KMPLAYERCOMMON_NO_EXPORT;
 };
 
 class KMPLAYERCOMMON_EXPORT SourceDocument : public Document
@@ -260,6 +272,8 @@ public:
     void connectSource (Source * old_source, Source * source);
     MediaManager *mediaManager () const { return m_media_manager; }
     PlayModel *playModel () const { return m_play_model; }
+    /* null unless media probing is enabled in the settings */
+    MediaProber *mediaProber () const { return m_media_prober; }
     Source * source () const { return m_source; }
     QMap <QString, Source *> & sources () { return m_sources; }
     KSharedConfigPtr config () const { return m_config; }
@@ -351,6 +365,7 @@ protected Q_SLOTS:
     void settingsChanged ();
     void audioSelected (QAction*) KMPLAYERCOMMON_NO_EXPORT;
     void subtitleSelected (QAction*) KMPLAYERCOMMON_NO_EXPORT;
+    void mediaProbed (KMPlayer::Mrl *mrl) KMPLAYERCOMMON_NO_EXPORT;
 protected:
     QUrl m_docbase;
     NodePtr m_record_doc;
@@ -360,6 +375,7 @@ protected:
     Settings *m_settings;
     MediaManager *m_media_manager;
     PlayModel *m_play_model;
+    MediaProber *m_media_prober;
     Source * m_source;
     QMap <QString, Source *> m_sources;
     KBookmarkManager * m_bookmark_manager;
@@ -6,8 +6,15 @@
 
 #include "config-kmplayer.h"
 #include <ctime>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
 
+#include <QIODevice>
 #include <QTextStream>
+#include <QHash>
+#include <QVector>
 #ifdef KMPLAYER_WITH_EXPAT
 #include <expat.h>
 #endif
@@ -351,6 +358,7 @@ void Node::clear () {
 void Node::clearChildren () {
     if (m_doc)
         document()->m_tree_version++;
+    invalidateXML ();
     while (m_first_child != m_last_child) {
         // avoid stack abuse with 10k children derefing each other
         m_last_child->m_parent = nullptr;
@@ -365,6 +373,7 @@ void Node::clearChildren () {
 template <>
 void TreeNode<Node>::appendChild (Node *c) {
     static_cast <Node *> (this)->document()->m_tree_version++;
+    static_cast <Node *> (this)->invalidateXML ();
     Q_ASSERT (!c->parentNode ());
     appendChildImpl (c);
 }
@@ -373,17 +382,20 @@ template <>
 void TreeNode<Node>::insertBefore (Node *c, Node *b) {
     Q_ASSERT (!c->parentNode ());
     static_cast <Node *> (this)->document()->m_tree_version++;
+    static_cast <Node *> (this)->invalidateXML ();
     insertBeforeImpl (c, b);
 }
 
 template <>
 void TreeNode<Node>::removeChild (NodePtr c) {
     static_cast <Node *> (this)->document()->m_tree_version++;
+    static_cast <Node *> (this)->invalidateXML ();
     removeChildImpl (c);
 }
 
 void Node::replaceChild (NodePtr _new, NodePtr old) {
     document()->m_tree_version++;
+    invalidateXML ();
     if (old->m_prev) {
         old->m_prev->m_next = _new;
         _new->m_prev = old->m_prev;
@@ -448,43 +460,138 @@ QString Node::innerText () const {
     return buf;
 }
 
-static void getOuterXML (const Node *p, QTextStream & out, int depth) {
-    if (!p->isElementNode ()) { // #text or #cdata
-        if (p->id == id_node_cdata)
-            out << "<![CDATA[" << p->nodeValue () << "]]>" << QChar ('\n');
-        else
-            out << XMLStringlet (p->nodeValue ()) << QChar ('\n');
+static void appendEscaped (QByteArray &out, const char *p, int len) {
+    int run = 0;
+    for (int i = 0; i < len; ++i) {
+        const char *entity;
+        switch (p[i]) {
+        case '<':
+            entity = "&lt;";
+            break;
+        case '>':
+            entity = "&gt;";
+            break;
+        case '"':
+            entity = "&quot;";
+            break;
+        case '&':
+            entity = "&amp;";
+            break;
+        default:
+            continue;
+        }
+        out.append (p + run, i - run);
+        out.append (entity);
+        run = i + 1;
+    }
+    out.append (p + run, len - run);
+}
+
+static void appendEscaped (QByteArray &out, const QString &s) {
+    const QByteArray u = s.toUtf8 ();
+    appendEscaped (out, u.constData (), u.size ());
+}
+
+void Node::writeXML (QByteArray &out, int depth) const {
+    if (!isElementNode ()) { // #text or #cdata
+        if (id == id_node_cdata) {
+            out += "<![CDATA[";
+            out += nodeValue ().toUtf8 ();
+            out += "]]>";
+        } else {
+            appendEscaped (out, nodeValue ());
+        }
+        out += '\n';
+        return;
+    }
+    const Element *e = static_cast <const Element *> (this);
+    const char *name = nodeName ();
+    const QByteArray indent (depth, ' ');
+    out += indent;
+    out += '<';
+    appendEscaped (out, name, strlen (name));
+    for (Attribute *a = e->attributes().first(); a; a = a->nextSibling()) {
+        out += ' ';
+        appendEscaped (out, a->name ().toString ());
+        out += "=\"";
+        appendEscaped (out, a->value ());
+        out += '"';
+    }
+    if (hasChildNodes ()) {
+        out += ">\n";
+        for (Node *c = firstChild (); c; c = c->nextSibling ())
+            c->writeXML (out, depth + 1);
+        out += indent;
+        out += "</";
+        appendEscaped (out, name, strlen (name));
+        out += ">\n";
     } else {
-        const Element *e = static_cast <const Element *> (p);
-        QString indent (QString ().fill (QChar (' '), depth));
-        out << indent << QChar ('<') << XMLStringlet (e->nodeName ());
-        for (Attribute *a = e->attributes().first(); a; a = a->nextSibling())
-            out << " " << XMLStringlet (a->name ().toString ()) <<
-                "=\"" << XMLStringlet (a->value ()) << "\"";
-        if (e->hasChildNodes ()) {
-            out << QChar ('>') << QChar ('\n');
-            for (Node *c = e->firstChild (); c; c = c->nextSibling ())
-                getOuterXML (c, out, depth + 1);
-            out << indent << QString("</") << XMLStringlet (e->nodeName()) <<
-                QChar ('>') << QChar ('\n');
-        } else
-            out << QString ("/>") << QChar ('\n');
+        out += "/>\n";
+    }
+}
+
+void Node::invalidateXML () {
+    if (m_doc)
+        document ()->m_xml_version++;
+}
+
+QByteArray Node::innerXMLData () const {
+    QByteArray out;
+    for (Node *c = firstChild (); c; c = c->nextSibling ())
+        c->writeXML (out, 0);
+    return out;
+}
+
+QByteArray Node::outerXMLData () const {
+    QByteArray out;
+    writeXML (out, 0);
+    return out;
+}
+
+bool Node::writeInnerXML (QIODevice *out) const {
+    for (Node *c = firstChild (); c; c = c->nextSibling ()) {
+        QByteArray xml;
+        c->writeXML (xml, 0);
+        if (out->write (xml) != xml.size ())
+            return false;
     }
+    return true;
+}
+
+bool Node::writeOuterXML (QIODevice *out) const {
+    if (!isElementNode () || !hasChildNodes ())
+        return out->write (outerXMLData ()) > -1;
+    const char *name = nodeName ();
+    QByteArray tag ("<");
+    appendEscaped (tag, name, strlen (name));
+    for (Attribute *a = static_cast <const Element *> (this)->attributes ().first (); a; a = a->nextSibling ()) {
+        tag += ' ';
+        appendEscaped (tag, a->name ().toString ());
+        tag += "=\"";
+        appendEscaped (tag, a->value ());
+        tag += '"';
+    }
+    tag += ">\n";
+    if (out->write (tag) != tag.size ())
+        return false;
+    for (Node *c = firstChild (); c; c = c->nextSibling ()) {
+        QByteArray xml;
+        c->writeXML (xml, 1);
+        if (out->write (xml) != xml.size ())
+            return false;
+    }
+    tag = "</";
+    appendEscaped (tag, name, strlen (name));
+    tag += ">\n";
+    return out->write (tag) == tag.size ();
 }
 
 QString Node::innerXML () const {
-    QString buf;
-    QTextStream out (&buf, QIODevice::WriteOnly);
-    for (Node *e = firstChild (); e; e = e->nextSibling ())
-        getOuterXML (e, out, 0);
-    return buf;
+    return QString::fromUtf8 (innerXMLData ());
 }
 
 QString Node::outerXML () const {
-    QString buf;
-    QTextStream out (&buf, QIODevice::WriteOnly);
-    getOuterXML (this, out, 0);
-    return buf;
+    return QString::fromUtf8 (outerXMLData ());
 }
 
 Node::PlayType Node::playType () {
@@ -550,101 +657,100 @@ QString Node::nodeValue () const {
 
 namespace {
     struct ParamValue {
+        ParamValue () {}
+        ParamValue (const TrieString &n, const QString &v) : name (n), val (v) {}
+        QString value () const {
+            return modifications.isEmpty () ? val : modifications.back ();
+        }
+
+        TrieString name;
         QString val;
-        QStringList  * modifications;
-        ParamValue (const QString & v) : val (v), modifications (nullptr) {}
-        ~ParamValue () { delete modifications; }
-        QString value ();
-        void setValue (const QString & v) { val = v; }
+        QStringList modifications; // override stack
     };
-    typedef QMap <TrieString, ParamValue *> ParamMap;
 }
 
 namespace KMPlayer {
+    /*
+     * Few params per element, a linear scan over the interned names is
+     * just a pointer compare per entry. Only allocated once a param is set.
+     */
     class ElementPrivate
     {
     public:
-        ~ElementPrivate ();
-        ParamMap params;
-        void clear ();
+        int indexOf (const TrieString &name) const;
+        QVector <ParamValue> params;
     };
 }
 
-QString ParamValue::value() {
-    return modifications && modifications->size ()
-        ? modifications->back () : val;
-}
-
-ElementPrivate::~ElementPrivate () {
-    clear ();
-}
-
-void ElementPrivate::clear () {
-    const ParamMap::iterator e = params.end ();
-    for (ParamMap::iterator i = params.begin (); i != e; ++i)
-        delete i.value ();
-    params.clear ();
+int ElementPrivate::indexOf (const TrieString &name) const {
+    for (int i = 0; i < params.size (); ++i)
+        if (params[i].name == name)
+            return i;
+    return -1;
 }
 
 Element::Element (NodePtr & d, short id)
-    : Node (d, id), d (new ElementPrivate) {}
+    : Node (d, id), d (nullptr) {}
 
 Element::~Element () {
     delete d;
 }
 
+void Element::clearParams () {
+    delete d;
+    d = nullptr;
+}
+
 void Element::setParam (const TrieString &name, const QString &val, int *mid) {
-    ParamValue * pv = d->params [name];
-    if (!pv) {
-        pv = new ParamValue (mid ? getAttribute (name) : val);
-        d->params.insert (name, pv);
-    }
+    if (!d)
+        d = new ElementPrivate;
+    int i = d->indexOf (name);
+    if (i < 0) {
+        i = d->params.size ();
+        d->params.append (ParamValue (name, mid ? getAttribute (name) : val));
+    }
+    ParamValue &pv = d->params[i];
     if (mid) {
-        if (!pv->modifications)
-            pv->modifications = new QStringList;
-        if (*mid >= 0 && *mid < int (pv->modifications->size ())) {
-            (*pv->modifications) [*mid] = val;
+        if (*mid >= 0 && *mid < pv.modifications.size ()) {
+            pv.modifications[*mid] = val;
         } else {
-            *mid = pv->modifications->size ();
-            pv->modifications->push_back (val);
+            *mid = pv.modifications.size ();
+            pv.modifications.push_back (val);
         }
     } else {
-        pv->setValue (val);
+        pv.val = val;
     }
     parseParam (name, val);
 }
 
 QString Element::param (const TrieString & name) {
-    ParamValue * pv = d->params [name];
-    if (pv)
-        return pv->value ();
+    const int i = d ? d->indexOf (name) : -1;
+    if (i > -1)
+        return d->params[i].value ();
     return getAttribute (name);
 }
 
 void Element::resetParam (const TrieString &name, int mid) {
-    ParamValue * pv = d->params [name];
-    if (pv && pv->modifications) {
-        if (int (pv->modifications->size ()) > mid && mid > -1) {
-            (*pv->modifications) [mid] = QString ();
-            while (pv->modifications->size () > 0 &&
-                    pv->modifications->back ().isNull ())
-                pv->modifications->pop_back ();
-        }
-        QString val = pv->value ();
-        if (pv->modifications->size () == 0) {
-            delete pv->modifications;
-            pv->modifications = nullptr;
-            if (val.isNull ()) {
-                delete pv;
-                d->params.remove (name);
-            }
+    const int i = d ? d->indexOf (name) : -1;
+    if (i > -1 && !d->params[i].modifications.isEmpty ()) {
+        QStringList &mods = d->params[i].modifications;
+        if (mods.size () > mid && mid > -1) {
+            mods[mid] = QString ();
+            while (mods.size () > 0 && mods.back ().isNull ())
+                mods.pop_back ();
         }
+        QString val = d->params[i].value ();
+        if (mods.isEmpty () && val.isNull ())
+            d->params.remove (i);
         parseParam (name, val);
     } else
         qCCritical(LOG_KMPLAYER_COMMON) << "resetting " << name.toString() << " that doesn't exists" << endl;
 }
 
 void Element::setAttribute (const TrieString & name, const QString & value) {
+    if (name == Ids::attr_id && m_doc)
+        document ()->m_tree_version++; // invalidates the id index
+    invalidateXML ();
     for (Attribute *a = m_attributes.first (); a; a = a->nextSibling ())
         if (name == a->name ()) {
             if (value.isNull ())
@@ -665,7 +771,7 @@ QString Element::getAttribute (const TrieString & name) {
 }
 
 void Element::init () {
-    d->clear();
+    clearParams ();
     for (Attribute *a = attributes ().first (); a; a = a->nextSibling ()) {
         QString v = a->value ();
         int p = v.indexOf ('{');
@@ -679,17 +785,28 @@ void Element::init () {
 }
 
 void Element::reset () {
-    d->clear();
+    clearParams ();
     Node::reset ();
 }
 
 void Element::clear () {
     m_attributes = AttributeList (); // remove attributes
-    d->clear();
+    invalidateXML ();
+    clearParams ();
     Node::clear ();
 }
 
+static bool hasIdAttribute (const AttributeList &attrs) {
+    for (Attribute *a = attrs.first (); a; a = a->nextSibling ())
+        if (a->name () == Ids::attr_id)
+            return true;
+    return false;
+}
+
 void Element::setAttributes (const AttributeList &attrs) {
+    if (m_doc && (hasIdAttribute (m_attributes) || hasIdAttribute (attrs)))
+        document ()->m_tree_version++; // invalidates the id index
+    invalidateXML ();
     m_attributes = attrs;
 }
 
@@ -732,7 +849,7 @@ static bool hasMrlChildren (const NodePtr & e) {
 Mrl::Mrl (NodePtr & d, short id)
     : Element (d, id), cached_ismrl_version (~0),
       media_info (nullptr),
-      aspect (0), repeat (0),
+      aspect (0), length (0), repeat (0),
       view_mode (SingleMode),
       resolved (false), bookmarkable (true), access_granted (false) {}
 
@@ -940,9 +1057,11 @@ Document::Document (const QString & s, PlayListNotify * n)
  : Mrl (dummy_element, id_node_document),
    notify_listener (n),
    m_tree_version (0),
+   m_xml_version (0),
    event_queue (nullptr),
    paused_queue (nullptr),
    cur_event (nullptr),
+   m_id_index (nullptr),
    cur_timeout (-1) {
     m_doc = m_self; // just-in-time setting fragile m_self to m_doc
     src = s;
@@ -950,6 +1069,7 @@ Document::Document (const QString & s, PlayListNotify * n)
 
 Document::~Document () {
     qCDebug(LOG_KMPLAYER_COMMON) << "~Document " << src;
+    delete m_id_index;
 }
 
 static Node *getElementByIdImpl (Node *n, const QString & id, bool inter) {
@@ -968,12 +1088,111 @@ static Node *getElementByIdImpl (Node *n, const QString & id, bool inter) {
     return elm;
 }
 
+namespace KMPlayer {
+
+/*
+ * Elements by id in document order, including those of child documents.
+ * Valid as long as the tree version of this and all child documents
+ * is unchanged, setting an id attribute bumps the tree version too.
+ */
+class DocumentIdIndex
+{
+public:
+    typedef QHash <QString, QList <NodePtrW> > IdMap;
+    typedef QList <QPair <NodePtrW, unsigned int> > VersionList;
+
+    void build (Document *doc);
+    bool valid (Document *doc) const;
+
+    IdMap ids;
+    VersionList versions;
+};
+
+}
+
+void DocumentIdIndex::build (Document *doc) {
+    ids.clear ();
+    versions.clear ();
+    versions.append (qMakePair (NodePtrW (doc), doc->m_tree_version));
+    Node *n = doc;
+    while (n) {
+        if (n->isElementNode ()) {
+            Document *d = n->document ();
+            if (d && d != doc) {
+                bool known = false;
+                const VersionList::const_iterator e = versions.constEnd ();
+                for (VersionList::const_iterator i = versions.constBegin (); i != e; ++i)
+                    if (i->first.ptr () == d) {
+                        known = true;
+                        break;
+                    }
+                if (!known)
+                    versions.append (qMakePair (NodePtrW (d), d->m_tree_version));
+            }
+            const QString id = static_cast <Element *> (n)->getAttribute (Ids::attr_id);
+            if (!id.isEmpty ())
+                ids[id].append (n);
+        }
+        // pre-order walk, like getElementByIdImpl
+        if (n->firstChild ()) {
+            n = n->firstChild ();
+        } else {
+            while (n && n != doc && !n->nextSibling ())
+                n = n->parentNode ();
+            n = n && n != doc ? n->nextSibling () : nullptr;
+        }
+    }
+}
+
+bool DocumentIdIndex::valid (Document *doc) const {
+    if (versions.isEmpty () || versions.first ().first.ptr () != doc)
+        return false;
+    const VersionList::const_iterator e = versions.constEnd ();
+    for (VersionList::const_iterator i = versions.constBegin (); i != e; ++i) {
+        Node *d = i->first.ptr ();
+        if (!d || static_cast <Document *> (d)->m_tree_version != i->second)
+            return false;
+    }
+    return true;
+}
+
+// whether getElementByIdImpl starting at start would get to n
+static bool inIdScope (Node *start, Node *n, bool inter) {
+    for (Node *c = n; c != start; ) {
+        Node *p = c->parentNode ();
+        if (!p || !p->isElementNode ())
+            return false;
+        if (!inter && c->mrl () && c->mrl ()->opener.ptr () == p)
+            return false;
+        c = p;
+    }
+    return start->isElementNode ();
+}
+
 Node *Document::getElementById (const QString & id) {
-    return getElementByIdImpl (this, id, true);
+    return getElementById (this, id, true);
 }
 
 Node *Document::getElementById (Node *n, const QString & id, bool inter) {
-    return getElementByIdImpl (n, id, inter);
+    Node *top = n;
+    while (top->parentNode ())
+        top = top->parentNode ();
+    if (top != this || id.isEmpty ()) // not attached, can't use the index
+        return getElementByIdImpl (n, id, inter);
+    if (!m_id_index)
+        m_id_index = new DocumentIdIndex;
+    if (!m_id_index->valid (this))
+        m_id_index->build (this);
+    DocumentIdIndex::IdMap::const_iterator it = m_id_index->ids.constFind (id);
+    if (it == m_id_index->ids.constEnd ())
+        return nullptr;
+    const QList <NodePtrW>::const_iterator e = it.value ().constEnd ();
+    for (QList <NodePtrW>::const_iterator i = it.value ().constBegin (); i != e; ++i) {
+        Node *elm = i->ptr ();
+        if (elm && inIdScope (n, elm, inter))
+            return elm;
+    }
+    return nullptr;
 }
 
 Node *Document::childFromTag (const QString & tag) {
@@ -985,6 +1204,8 @@ Node *Document::childFromTag (const QString & tag) {
 
 void Document::dispose () {
     clear ();
+    delete m_id_index;
+    m_id_index = nullptr;
     m_doc = nullptr;
 }
 
@@ -1065,6 +1286,14 @@ void Document::timeOfDay (struct timeval & tv) {
     }
 }
 
+int Document::currentTime () const {
+    if (!first_event_time.tv_sec)
+        return 0;
+    struct timeval tv;
+    gettimeofday (&tv, nullptr);
+    return diffTime (tv, first_event_time);
+}
+
 static bool postponedSensible (MessageType msg) {
     return msg == MsgEventTimer ||
         msg == MsgEventStarted ||
@@ -1314,6 +1543,7 @@ TextNode::TextNode (NodePtr & d, const QString & s, short i)
 
 void TextNode::appendText (const QString & s) {
     text += s;
+    invalidateXML ();
 }
 
 QString TextNode::nodeValue () const {
@@ -1395,21 +1625,211 @@ void Visitor::visit (TextNode *text) {
 
 //-----------------------------------------------------------------------------
 
+static const size_t chunk_size = 16 * 1024; // also the chunk alignment
+static const size_t block_align = 16;
+
+struct CacheAllocator::Chunk {
+    CacheAllocator *owner;
+    Chunk *prev;
+    Chunk *next;
+    void *free_list;
+    char *fresh;   // never used blocks start here
+    int used;
+    int unused;    // blocks left after fresh
+};
+
+static constexpr size_t alignedSize (size_t s) {
+    return (s + block_align - 1) & ~(block_align - 1);
+}
+
 CacheAllocator::CacheAllocator (size_t s)
-    : pool ((void**) malloc (10 * sizeof (void *))), size (s), count (0) {}
+ : partial (nullptr),
+   spare (nullptr),
+   size (alignedSize (s < sizeof (void *) ? sizeof (void *) : s)),
+   blocks_per_chunk ((chunk_size - alignedSize (sizeof (Chunk))) / size),
+   chunk_count (0),
+   in_use (0),
+   total_allocs (0) {}
+
+CacheAllocator::~CacheAllocator () {
+    // the shared ones of forSize are never destroyed. Only empty chunks are
+    // freed, those with blocks in use, full ones aren't even listed, are
+    // left as their blocks can still be deallocated
+    while (partial) {
+        Chunk *c = partial;
+        partial = c->next;
+        if (!c->used)
+            free (c);
+    }
+    free (spare);
+}
+
+CacheAllocator::Chunk *CacheAllocator::newChunk () {
+    Chunk *c = spare;
+    if (c) {
+        spare = nullptr;
+    } else {
+        void *mem = nullptr;
+        if (posix_memalign (&mem, chunk_size, chunk_size))
+            return nullptr;
+        c = (Chunk *) mem;
+        c->owner = this;
+        chunk_count++;
+    }
+    c->prev = nullptr;
+    c->next = nullptr;
+    c->free_list = nullptr;
+    c->fresh = (char *) c + alignedSize (sizeof (Chunk));
+    c->used = 0;
+    c->unused = blocks_per_chunk;
+    return c;
+}
 
 void *CacheAllocator::alloc () {
-    return count ? pool[--count] : malloc (size);
+    if (!partial) {
+        partial = newChunk ();
+        if (!partial)
+            return malloc (size); // never, dealloc would crash anyway
+    }
+    Chunk *c = partial;
+    void *p;
+    if (c->free_list) {
+        p = c->free_list;
+        c->free_list = *(void **) p;
+    } else {
+        p = c->fresh;
+        c->fresh += size;
+        c->unused--;
+    }
+    c->used++;
+    if (!c->free_list && !c->unused) { // full, remove from partial list
+        partial = c->next;
+        if (partial)
+            partial->prev = nullptr;
+        c->next = nullptr;
+    }
+    in_use++;
+    total_allocs++;
+    return p;
 }
 
 void CacheAllocator::dealloc (void *p) {
-    if (count < 10)
-        pool[count++] = p;
-    else
-        free (p);
+    if (!p)
+        return;
+    Chunk *c = (Chunk *) ((uintptr_t) p & ~(uintptr_t) (chunk_size - 1));
+    const bool was_full = !c->free_list && !c->unused;
+    *(void **) p = c->free_list;
+    c->free_list = p;
+    c->used--;
+    in_use--;
+    if (was_full) {
+        c->prev = nullptr;
+        c->next = partial;
+        if (partial)
+            partial->prev = c;
+        partial = c;
+    }
+    if (!c->used && (partial != c || c->next)) {
+        // keep a single chunk in the partial list, one as spare
+        if (c->prev)
+            c->prev->next = c->next;
+        else
+            partial = c->next;
+        if (c->next)
+            c->next->prev = c->prev;
+        if (spare) {
+            free (c);
+            chunk_count--;
+        } else {
+            spare = c;
+        }
+    }
+}
+
+CacheAllocator *CacheAllocator::forSize (size_t s) {
+    static CacheAllocator *allocators [max_block_size / block_align];
+    if (!s || s > max_block_size)
+        return nullptr;
+    const int i = (alignedSize (s) / block_align) - 1;
+    if (!allocators[i])
+        allocators[i] = new CacheAllocator ((i + 1) * block_align);
+    return allocators[i];
 }
 
-KMPLAYERCOMMON_EXPORT CacheAllocator *KMPlayer::shared_data_cache_allocator = nullptr;
+CacheAllocator *CacheAllocator::owner (void *p) {
+    return ((Chunk *) ((uintptr_t) p & ~(uintptr_t) (chunk_size - 1)))->owner;
+}
+
+/*
+ * Node allocations start with room for the node's SharedData, so that a
+ * node and its refcounts take a single block and share cache lines. The
+ * block is freed once both the node and the SharedData are gone.
+ */
+namespace {
+    struct NodeHeader {
+        char shared [sizeof (SharedData<Node>)];
+        int alive;
+    };
+    enum { node_alive = 0x01, data_alive = 0x02 };
+}
+
+static const size_t node_header_size = alignedSize (sizeof (NodeHeader));
+static void *pending_node; // last Node::operator new, for Item<Node>
+
+static inline NodeHeader *nodeHeader (void *node) {
+    return (NodeHeader *) ((char *) node - node_header_size);
+}
+
+void *Node::operator new (size_t s) {
+    CacheAllocator *a = CacheAllocator::forSize (s + node_header_size);
+    if (!a)
+        return ::operator new (s); // too big, gets a separate SharedData
+    NodeHeader *h = (NodeHeader *) a->alloc ();
+    h->alive = node_alive;
+    pending_node = (char *) h + node_header_size;
+    return pending_node;
+}
+
+void Node::operator delete (void *p, size_t s) {
+    CacheAllocator *a = CacheAllocator::forSize (s + node_header_size);
+    if (!a) {
+        ::operator delete (p);
+        return;
+    }
+    if (pending_node == p) // constructor threw
+        pending_node = nullptr;
+    NodeHeader *h = nodeHeader (p);
+    h->alive &= ~node_alive;
+    if (!h->alive)
+        a->dealloc (h);
+}
+
+template <> Item<Node>::Item () {
+    Node *self = static_cast <Node *> (this);
+    if (self == pending_node) {
+        pending_node = nullptr;
+        NodeHeader *h = nodeHeader (self);
+        m_self.data = ::new (h->shared) SharedData<Node> (self, true);
+        h->alive |= data_alive;
+    } else { // not at the start of a block from Node::operator new
+        m_self.data = new SharedData<Node> (self, true);
+    }
+}
+
+void KMPlayer::releaseEmbeddedData (void *p) {
+    NodeHeader *h = (NodeHeader *) p;
+    h->alive &= ~data_alive;
+    if (!h->alive)
+        CacheAllocator::owner (h)->dealloc (h);
+}
+
+void *Attribute::operator new (size_t s) {
+    return CacheAllocator::forSize (s)->alloc ();
+}
+
+void Attribute::operator delete (void *p, size_t s) {
+    CacheAllocator::forSize (s)->dealloc (p);
+}
 
 //-----------------------------------------------------------------------------
 
@@ -1617,6 +2037,53 @@ void KMPlayer::readXML (NodePtr root, QTextStream & in, const QString & firstlin
     //return ok;
 }
 
+namespace KMPlayer {
+
+class IncrementalXMLReaderPrivate
+{
+public:
+    IncrementalXMLReaderPrivate (NodePtr r, bool set_opener)
+     : builder (r, set_opener), root (r),
+       parser (XML_ParserCreate (0L)), ok (true) {
+        XML_SetUserData (parser, &builder);
+        XML_SetElementHandler (parser, startTag, endTag);
+        XML_SetCharacterDataHandler (parser, characterData);
+        XML_SetCdataSectionHandler (parser, cdataStart, cdataEnd);
+    }
+    ~IncrementalXMLReaderPrivate () {
+        XML_ParserFree (parser);
+    }
+    DocumentBuilder builder;
+    NodePtr root;
+    XML_Parser parser;
+    bool ok;
+};
+
+} // namespace KMPlayer
+
+IncrementalXMLReader::IncrementalXMLReader (NodePtr root, bool set_opener)
+ : d (new IncrementalXMLReaderPrivate (root, set_opener)) {}
+
+IncrementalXMLReader::~IncrementalXMLReader () {
+    delete d;
+}
+
+void IncrementalXMLReader::feed (const QString &data) {
+    if (!d->ok)
+        return;
+    const QByteArray ba = data.toUtf8 ();
+    d->ok = XML_Parse (d->parser, ba.constData (), ba.size (), false) != XML_STATUS_ERROR;
+    if (!d->ok)
+        qCWarning(LOG_KMPLAYER_COMMON) << XML_ErrorString(XML_GetErrorCode(d->parser)) << " at " << XML_GetCurrentLineNumber(d->parser) << " col " << XML_GetCurrentColumnNumber(d->parser);
+}
+
+void IncrementalXMLReader::finish () {
+    if (d->ok && XML_Parse (d->parser, "", 0, true) == XML_STATUS_ERROR)
+        qCWarning(LOG_KMPLAYER_COMMON) << XML_ErrorString(XML_GetErrorCode(d->parser)) << " at " << XML_GetCurrentLineNumber(d->parser) << " col " << XML_GetCurrentColumnNumber(d->parser);
+    d->ok = false;
+    d->root->normalize ();
+}
+
 //-----------------------------------------------------------------------------
 #else // KMPLAYER_WITH_EXPAT
 
@@ -1715,6 +2182,57 @@ void KMPlayer::readXML (NodePtr root, QTextStream & in, const QString & firstlin
     //qCDebug(LOG_KMPLAYER_COMMON) << root->outerXML ();
 }
 
+namespace KMPlayer {
+
+class IncrementalXMLReaderPrivate
+{
+public:
+    IncrementalXMLReaderPrivate (NodePtr r, bool set_opener)
+     : builder (r, set_opener), parser (builder), root (r) {}
+    DocumentBuilder builder;
+    SimpleSAXParser parser;
+    NodePtr root;
+    QString pending; // after the last '>', so no token is split
+};
+
+} // namespace KMPlayer
+
+IncrementalXMLReader::IncrementalXMLReader (NodePtr root, bool set_opener)
+ : d (new IncrementalXMLReaderPrivate (root, set_opener)) {
+    root->opened ();
+}
+
+IncrementalXMLReader::~IncrementalXMLReader () {
+    delete d;
+}
+
+void IncrementalXMLReader::feed (const QString &data) {
+    d->pending += data;
+    const int pos = d->pending.lastIndexOf (QChar ('>'));
+    if (pos < 0)
+        return;
+    QString part = d->pending.left (pos + 1);
+    d->pending.remove (0, pos + 1);
+    QTextStream in (&part, QIODevice::ReadOnly);
+    d->parser.parse (in);
+}
+
+void IncrementalXMLReader::finish () {
+    if (!d->pending.isEmpty ()) {
+        QTextStream in (&d->pending, QIODevice::ReadOnly);
+        d->parser.parse (in);
+        d->pending.clear ();
+    }
+    NodePtr root = d->root;
+    if (root->open) // endTag may have closed it
+        root->closed ();
+    for (NodePtr e = root->parentNode (); e; e = e->parentNode ()) {
+        if (e->open)
+            break;
+        e->closed ();
+    }
+}
+
 void SimpleSAXParser::push () {
     if (next_token->string.size ()) {
         prev_token = token;
@@ -20,6 +20,7 @@
 
 typedef struct _cairo_surface cairo_surface_t;
 
+class QIODevice;
 class QTextStream;
 class QUrl;
 
@@ -31,6 +32,7 @@ class TextNode;
 class Posting;
 class Mrl;
 class ElementPrivate;
+class DocumentIdIndex;
 class Visitor;
 class MediaInfo;
 
@@ -212,6 +214,8 @@ public:
     Attribute () {}
     Attribute (const TrieString &ns, const TrieString &n, const QString &v);
     ~Attribute () {}
+    static void *operator new (size_t s);
+    static void operator delete (void *p, size_t s);
     TrieString ns () const { return m_namespace; }
     TrieString name () const { return m_name; }
     QString value () const { return m_value; }
@@ -425,6 +429,10 @@ public:
         play_type_image, play_type_audio, play_type_video
     };
     virtual ~Node ();
+    // small nodes come from the slab allocators, see CacheAllocator, in
+    // one block with their SharedData
+    static void *operator new (size_t s);
+    static void operator delete (void *p, size_t s);
     Document * document ();
     virtual Mrl * mrl ();
     virtual Node *childFromTag (const QString & tag);
@@ -432,6 +440,14 @@ public:
     QString innerText () const;
     QString innerXML () const;
     QString outerXML () const;
+    /* as innerXML/outerXML, but in utf-8 */
+    QByteArray innerXMLData () const;
+    QByteArray outerXMLData () const;
+    /* writes the xml to out, child by child */
+    bool writeInnerXML (QIODevice *out) const;
+    bool writeOuterXML (QIODevice *out) const;
+    /* the serialized xml of the document changed, see m_xml_version */
+    void invalidateXML ();
     virtual const char * nodeName () const;
     virtual QString nodeValue () const;
     virtual void setNodeName (const QString &) {}
@@ -529,6 +545,8 @@ public:
 protected:
     Node(NodePtr& d, short _id=0);
     NodePtr m_doc;
+private:
+    void writeXML (QByteArray &out, int depth) const KMPLAYERCOMMON_NO_EXPORT;
 public:
     State state;
     short id;
@@ -585,6 +603,7 @@ protected:
     Element (NodePtr & d, short id=0);
     AttributeList m_attributes;
 private:
+    void clearParams () KMPLAYERCOMMON_NO_EXPORT;
     ElementPrivate * d;
 };
 
@@ -655,6 +674,7 @@ public:
     QString mimetype;
     SSize size;
     float aspect;
+    int length; // deci-seconds, 0 if unknown
     int repeat;
     unsigned char view_mode;
     bool resolved;
@@ -792,6 +812,8 @@ public:
     void unpausePosting (Posting *e, int ms);
 
     void timeOfDay (struct timeval &);
+    /* ms since the first event, unlike timeOfDay leaves last_event_time */
+    int currentTime () const;
     PostponePtr postpone ();
     bool postponed () const { return !!postpone_ref || !! postpone_lock; }
     /**
@@ -806,6 +828,7 @@ public:
 
     PlayListNotify *notify_listener;
     unsigned int m_tree_version;
+    unsigned int m_xml_version; // also bumped on attribute and text changes
     unsigned int last_event_time;
 private:
     void proceed (const struct timeval & postponed_time);
@@ -818,6 +841,7 @@ private:
     EventData *event_queue;
     EventData *paused_queue;
     EventData *cur_event;
+    DocumentIdIndex *m_id_index;
     int cur_timeout;
     struct timeval first_event_time;
 };
@@ -900,7 +924,7 @@ public:
     TextNode(NodePtr& d, const QString& s, short _id = id_node_text);
     ~TextNode () override {}
     void appendText (const QString & s);
-    void setText (const QString & txt) { text = txt; }
+    void setText (const QString & txt) { text = txt; invalidateXML (); }
     const char * nodeName () const override { return "#text"; }
     void accept (Visitor *v) override { v->visit (this); }
     QString nodeValue () const override;
@@ -962,11 +986,32 @@ public:
 
 KMPLAYERCOMMON_EXPORT
 void readXML (NodePtr root, QTextStream & in, const QString & firstline, bool set_opener=true);
+
+class IncrementalXMLReaderPrivate;
+
+/**
+ * Reads xml into root as it arrives, like readXML does at once
+ */
+class KMPLAYERCOMMON_EXPORT IncrementalXMLReader
+{
+public:
+    IncrementalXMLReader (NodePtr root, bool set_opener=true);
+    ~IncrementalXMLReader ();
+    /* parses what's complete of data, the rest with the next feed */
+    void feed (const QString &data);
+    /* end of the data, closes what's still open */
+    void finish ();
+private:
+    IncrementalXMLReaderPrivate *d;
+};
 KMPLAYERCOMMON_EXPORT Node * fromXMLDocumentTag (NodePtr & d, const QString & tag);
 
 template <class T>
 inline Item<T>::Item () : m_self (static_cast <T*> (this), true) {}
 
+// uses the refcount block allocated along with the Node, if any
+template <> Item<Node>::Item ();
+
 template <class T> inline void List<T>::append (T *c) {
     if (!m_first) {
         m_first = c->m_self;
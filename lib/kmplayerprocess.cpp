@@ -41,6 +41,9 @@
 #include "kmplayercontrolpanel.h"
 #include "kmplayerprocess.h"
 #include "kmplayerpartbase.h"
+#include "timeshift.h"
+#include "watchdog.h"
+#include "bandwidth.h"
 #include "masteradaptor.h"
 #include "streammasteradaptor.h"
 #ifdef KMPLAYER_WITH_NPP
@@ -264,11 +267,17 @@ bool Process::play () {
     Mrl *m = mrl ();
     if (!m)
         return false;
+    crashed = false;
     bool nonstdurl = m->src.startsWith ("tv:/") ||
         m->src.startsWith ("dvd:") ||
         m->src.startsWith ("cdda:") ||
         m->src.startsWith ("vcd:");
     QString url = nonstdurl ? m->src : m->absolutePath ();
+    TimeShift *ts = m_source ? m_source->timeShift () : nullptr;
+    if (ts && ts->start ()) {
+        url = ts->playbackFile ();
+        nonstdurl = false;
+    }
     bool changed = m_url != url;
     m_url = url;
     if (user) // FIXME: remove check
@@ -463,8 +472,10 @@ void MPlayerBase::processStopped () {
     setState (IProcess::Ready);
 }
 
-void MPlayerBase::processStopped (int, QProcess::ExitStatus) {
+void MPlayerBase::processStopped (int, QProcess::ExitStatus status) {
     qCDebug(LOG_KMPLAYER_COMMON) << "process stopped" << endl;
+    if (QProcess::CrashExit == status && m_state > IProcess::Ready)
+        crashed = true;
     commands.clear ();
     processStopped ();
 }
@@ -491,7 +502,9 @@ MPlayer::MPlayer (QObject *parent, ProcessInfo *pinfo, Settings *settings)
  : MPlayerBase (parent, pinfo, settings),
    m_widget (nullptr),
    m_transition_state (NotRunning),
-   aid (-1), sid (-1)
+   aid (-1), sid (-1),
+   m_cache_size (0),
+   m_cache_fill (0.0)
 {}
 
 MPlayer::~MPlayer () {
@@ -524,6 +537,8 @@ bool MPlayer::deMediafiedPlay () {
             this, &MPlayer::processOutput);
 
     m_process_output = QString ();
+    m_cache_size = 0;
+    m_cache_fill = 0.0;
     m_source->setPosition (0);
     if (!m_needs_restarted) {
         if (m_source->identified ()) {
@@ -598,7 +613,10 @@ bool MPlayer::deMediafiedPlay () {
         }
     }
 
-    args << KShell::splitArgs (m_source->options ());
+    // playing from a running time shift, the source options are for its capture
+    TimeShift *ts = m_source->timeShift ();
+    args << KShell::splitArgs (ts && ts->running ()
+            ? ts->playbackOptions () : m_source->options ());
 
     const QUrl url = QUrl::fromUserInput(m_url);
     if (!url.isEmpty ()) {
@@ -615,8 +633,10 @@ bool MPlayer::deMediafiedPlay () {
             int cache = cfg_page->cachesize;
             if (cache > 3 && !url.url ().startsWith (QString ("dvd")) &&
                     !url.url ().startsWith (QString ("vcd")) &&
-                    !m_url.startsWith (QString ("tv://")))
+                    !m_url.startsWith (QString ("tv://"))) {
                 args << "-cache" << QString::number (cache);
+                m_cache_size = cache;
+            }
             if (m_url.startsWith (QString ("cdda:/")) &&
                     !m_url.startsWith (QString ("cdda://")))
                 m_url = QString ("cdda://") + m_url.mid (6);
@@ -669,6 +689,9 @@ void MPlayer::unpause () {
 }
 
 bool MPlayer::seek (int pos, bool absolute) {
+    TimeShift *ts = m_source ? m_source->timeShift () : nullptr;
+    if (ts && ts->running ())
+        return ts->seek (pos, absolute);
     if (!m_source || !m_source->hasLength () ||
             (absolute && m_source->position () == pos))
         return false;
@@ -805,7 +828,14 @@ void MPlayer::processOutput () {
                     setState (Playing);
                 }
             } else if (m_cacheRegExp.indexIn (out) > -1) {
-                m_source->setLoading (int (m_cacheRegExp.cap(1).toDouble()));
+                const double fill = m_cacheRegExp.cap (1).toDouble ();
+                // while playing, the cache fills as fast as it's played
+                if (m_cache_size > 0 && fill > m_cache_fill &&
+                        IProcess::Playing != m_state)
+                    process_info->manager->bandwidth ()->received
+                        (int ((fill - m_cache_fill) * m_cache_size * 1024 / 100));
+                m_cache_fill = fill;
+                m_source->setLoading (int (fill));
             }
         } else if (out.startsWith ("ID_LENGTH")) {
             int pos = out.indexOf ('=');
@@ -927,6 +957,8 @@ void MPlayer::processOutput () {
             }
         }
     } while (slen > 0);
+    if (m_source)
+        process_info->manager->watchdog ()->heartbeat (this, m_source->position ());
 }
 
 void MPlayer::processStopped () {
@@ -1296,14 +1328,17 @@ void MasterProcessInfo::running (const QString &srv) {
             static_cast <Process *> (*i)->setState (IProcess::Ready);
 }
 
-void MasterProcessInfo::agentStopped (int, QProcess::ExitStatus)
+void MasterProcessInfo::agentStopped (int, QProcess::ExitStatus status)
 {
     m_agent_service.truncate (0);
     MediaManager::ProcessList &pl = manager->processes ();
     const MediaManager::ProcessList::iterator e = pl.end ();
     for (MediaManager::ProcessList::iterator i = pl.begin (); i != e; ++i)
-        if (this == (*i)->process_info)
+        if (this == (*i)->process_info) {
+            if (QProcess::CrashExit == status && (*i)->state () > IProcess::Ready)
+                (*i)->crashed = true;
             static_cast <Process *> (*i)->setState (IProcess::NotRunning);
+        }
 }
 
 void MasterProcessInfo::agentOutput ()
@@ -1374,6 +1409,7 @@ void MasterProcess::playing () {
 
 void MasterProcess::progress (uint64_t pos) {
     m_source->setPosition (pos);
+    process_info->manager->watchdog ()->heartbeat (this, pos);
 }
 
 void MasterProcess::pause () {
@@ -1706,16 +1742,23 @@ IProcess *NppProcessInfo::create (PartBase *p, ProcessUser *usr) {
 
 #ifdef KMPLAYER_WITH_NPP
 
+// bounds for the amount of data buffered per stream before suspending the job
+static const uint32_t min_stream_credit = 16 * 1024;
+static const uint32_t max_stream_credit = 1024 * 1024;
+
 NpStream::NpStream (NpPlayer *p, uint32_t sid, const QString &u, const QByteArray &ps)
  : QObject (p),
    url (u),
    post (ps),
+   pending_size (0),
    job (nullptr), bytes (0),
+   credit (64000),
    stream_id (sid),
    content_length (0),
    finish_reason (NoReason),
    received_data (false) {
     data_arrival.tv_sec = 0;
+    open_time.tv_sec = 0;
     (void) new StreamAdaptor (this);
     QString objpath = QString ("%1/stream_%2").arg (p->objectPath ()).arg (sid);
     QDBusConnection::sessionBus().registerObject (objpath, this);
@@ -1727,18 +1770,18 @@ NpStream::~NpStream () {
 
 void NpStream::open () {
     qCDebug(LOG_KMPLAYER_COMMON) << "NpStream " << stream_id << " open " << url;
+    gettimeofday (&open_time, nullptr);
     if (url.startsWith ("javascript:")) {
         NpPlayer *npp = static_cast <NpPlayer *> (parent ());
         QString result = npp->evaluate (url.mid (11), false);
         if (!result.isEmpty ()) {
             QByteArray cr = result.toLocal8Bit ();
             int len = strlen (cr.constData ());
-            pending_buf.resize (len + 1);
-            memcpy (pending_buf.data (), cr.constData (), len);
-            pending_buf.data ()[len] = 0;
+            pending_chunks.append (QByteArray (cr.constData (), len + 1));
+            pending_size = len + 1;
             gettimeofday (&data_arrival, nullptr);
         }
-        qCDebug(LOG_KMPLAYER_COMMON) << "result is " << pending_buf.constData ();
+        qCDebug(LOG_KMPLAYER_COMMON) << "result is " << result;
         finish_reason = BecauseDone;
         Q_EMIT stateChanged ();
     } else {
@@ -1807,10 +1850,37 @@ void NpStream::close () {
 }
 
 void NpStream::destroy () {
-    pending_buf.clear ();
+    pending_chunks.clear ();
+    pending_size = 0;
     static_cast <NpPlayer *> (parent ())->destroyStream (stream_id);
 }
 
+/**
+ * Called by the backend with the amount the plugin reported it can take
+ * from this stream. Used as the high water mark for buffering KIO data.
+ */
+void NpStream::writeReady (uint cr) {
+    credit = qBound (min_stream_credit, (uint32_t) cr, max_stream_credit);
+    if (job && job->isSuspended () && pending_size < (int) credit) {
+        job->resume ();
+        // data may have been on hold until now
+        static_cast <NpPlayer *> (parent ())->process_info->manager->bandwidth ()->throttled ();
+    }
+}
+
+/**
+ * Average bytes per second passed to the backend since open()
+ */
+uint32_t NpStream::throughput () const {
+    if (!open_time.tv_sec)
+        return 0;
+    timeval now;
+    gettimeofday (&now, nullptr);
+    qint64 ms = (now.tv_sec - open_time.tv_sec) * 1000LL +
+        (now.tv_usec - open_time.tv_usec) / 1000;
+    return ms > 0 ? (uint32_t) (1000LL * bytes / ms) : 0;
+}
+
 void NpStream::slotResult (KJob *jb) {
     qCDebug(LOG_KMPLAYER_COMMON) << "slotResult " << stream_id << " " << bytes << " err:" << jb->error ();
     finish_reason = jb->error () ? BecauseError : BecauseDone;
@@ -1820,16 +1890,19 @@ void NpStream::slotResult (KJob *jb) {
 
 void NpStream::slotData (KIO::Job*, const QByteArray& qb) {
     if (job) {
-        int sz = pending_buf.size ();
-        if (sz) {
-            pending_buf.resize (sz + qb.size ());
-            memcpy (pending_buf.data () + sz, qb.constData (), qb.size ());
-        } else {
-            pending_buf = qb;
+        NpPlayer *player = static_cast <NpPlayer *> (parent ());
+        int sz = pending_size;
+        if (qb.size ()) {
+            pending_chunks.append (qb);
+            pending_size += qb.size ();
+            player->process_info->manager->bandwidth ()->received (qb.size ());
+        }
+        if (pending_size > (int) credit && !job->isSuspended ()) {
+            if (job->suspend ())
+                player->process_info->manager->bandwidth ()->throttled ();
+            else
+                qCCritical(LOG_KMPLAYER_COMMON) << "suspend not supported" << endl;
         }
-        if (sz + qb.size () > 64000 &&
-                !job->isSuspended () && !job->suspend ())
-            qCCritical(LOG_KMPLAYER_COMMON) << "suspend not supported" << endl;
         if (!sz)
             gettimeofday (&data_arrival, nullptr);
         if (!received_data) {
@@ -2206,12 +2279,13 @@ void NpPlayer::processStreams () {
         if (ns->finish_reason == NpStream::BecauseStopped ||
                 ns->finish_reason == NpStream::BecauseError ||
                 (ns->finish_reason == NpStream::BecauseDone &&
-                 ns->pending_buf.size () == 0)) {
+                 ns->pending_size == 0)) {
+            qCDebug(LOG_KMPLAYER_COMMON) << "stream " << i.key () << " " << ns->bytes << " bytes " << ns->throughput () << " B/s";
             sendFinish (i.key(), ns->bytes, ns->finish_reason);
             i = streams.erase (i);
             delete ns;
         } else {
-            if (ns->pending_buf.size () > 0 &&
+            if (ns->pending_size > 0 &&
                     (ns->data_arrival.tv_sec < tv.tv_sec ||
                      (ns->data_arrival.tv_sec == tv.tv_sec &&
                       ns->data_arrival.tv_usec < tv.tv_usec))) {
@@ -2238,19 +2312,25 @@ void NpPlayer::processStreams () {
             QDBusConnection::sessionBus().send (msg);
         }
         const int header_len = 2 * sizeof (qint32);
-        qint32 chunk = stream->pending_buf.size ();
-        send_buf.resize (chunk + header_len);
+        qint32 chunk = stream->pending_size;
+        send_buf.resize (header_len);
         memcpy (send_buf.data (), &stream_id, sizeof (qint32));
         memcpy (send_buf.data() + sizeof (qint32), &chunk, sizeof (qint32));
-        memcpy (send_buf.data ()+header_len,
-                stream->pending_buf.constData (), chunk);
-        stream->pending_buf = QByteArray ();
         /*fprintf (stderr, " => %d %d\n", (long)stream_id, chunk);*/
         stream->bytes += chunk;
         write_in_progress = true;
         m_process->write (send_buf);
-        if (stream->finish_reason == NpStream::NoReason)
+        // write the chunk chain as is, no need to join into one buffer
+        const QList<QByteArray>::const_iterator ce = stream->pending_chunks.constEnd ();
+        for (QList<QByteArray>::const_iterator c = stream->pending_chunks.constBegin (); c != ce; ++c)
+            m_process->write (*c);
+        stream->pending_chunks.clear ();
+        stream->pending_size = 0;
+        if (stream->finish_reason == NpStream::NoReason &&
+                stream->job->isSuspended ()) {
             stream->job->resume ();
+            process_info->manager->bandwidth ()->throttled ();
+        }
     }
     in_process_stream = false;
 }
@@ -2284,6 +2364,7 @@ NpStream::NpStream (NpPlayer *p, uint32_t sid, const QString &u, const QByteArra
     : QObject (p) {}
 
 NpStream::~NpStream () {}
+void NpStream::writeReady (uint) {}
 void NpStream::slotResult (KJob*) {}
 void NpStream::slotData (KIO::Job*, const QByteArray&) {}
 void NpStream::redirection(KIO::Job*, const QUrl&) {}
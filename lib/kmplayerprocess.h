@@ -178,6 +178,8 @@ private:
     State m_transition_state;
     int aid, sid;
     int old_volume;
+    int m_cache_size; // kB, 0 without a cache
+    double m_cache_fill; // percentage
 };
 
 #ifdef _KMPLAYERCONFIG_H_
@@ -421,13 +423,17 @@ public:
     void close ();
 
     void destroy ();
+    uint32_t throughput () const;
 
     QString url;
     QByteArray post;
-    QByteArray pending_buf;
+    QList <QByteArray> pending_chunks; // KIO data, shared not copied
+    int pending_size;
     KIO::TransferJob *job;
     timeval data_arrival;
+    timeval open_time;
     uint32_t bytes;
+    uint32_t credit;
     uint32_t stream_id;
     uint32_t content_length;
     Reason finish_reason;
@@ -437,6 +443,8 @@ public:
 Q_SIGNALS:
     void stateChanged ();
     void redirected(uint32_t, const QUrl&);
+public Q_SLOTS:
+    void writeReady (uint credit);
 private Q_SLOTS:
     void slotResult (KJob*);
     void slotData (KIO::Job*, const QByteArray& qb);
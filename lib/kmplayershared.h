@@ -16,22 +16,50 @@ extern int shared_data_count;
 #include <iostream>
 #endif
 
+#include <cstddef>
+
 #include "kmplayercommon_export.h"
 
 namespace KMPlayer {
 
+/**
+ * Slab allocator for small fixed size blocks. Blocks are carved from
+ * aligned chunks, each with its own free list, so a block finds its chunk
+ * back by masking its address. Emptied chunks are returned to the system,
+ * except for one spare.
+ **/
 class KMPLAYERCOMMON_EXPORT CacheAllocator {
-    void **pool;
+    struct Chunk;
+    Chunk *partial;   // chunks with free blocks
+    Chunk *spare;     // one completely free chunk
     size_t size;
-    int count;
+    int blocks_per_chunk;
+    int chunk_count;
+    int in_use;
+    int total_allocs;
+
+    Chunk *newChunk ();
 public:
     CacheAllocator (size_t s);
+    ~CacheAllocator ();
 
     void *alloc ();
     void dealloc (void *p);
+
+    size_t blockSize () const { return size; }
+    int allocated () const { return in_use; }
+    int reserved () const { return chunk_count * blocks_per_chunk; }
+    int allocations () const { return total_allocs; }
+
+    enum { max_block_size = 512 };
+    /* shared allocator for objects of size s, nullptr if s is too large */
+    static CacheAllocator *forSize (size_t s);
+    /* the allocator of block p, p must come from alloc() */
+    static CacheAllocator *owner (void *p);
 };
 
-extern CacheAllocator *shared_data_cache_allocator;
+/* frees a refcount block that is embedded in its Node's allocation */
+KMPLAYERCOMMON_EXPORT void releaseEmbeddedData (void *p);
 
 /**
  *  Shared data for SharedPtr and WeakPtr objects.
@@ -59,13 +87,15 @@ struct SharedData {
 };
 
 template <class T> inline void *SharedData<T>::operator new (size_t s) {
-    if (!shared_data_cache_allocator)
-        shared_data_cache_allocator = new CacheAllocator (s);
-    return shared_data_cache_allocator->alloc ();
+    return CacheAllocator::forSize (s)->alloc ();
 }
 
 template <class T> inline void SharedData<T>::operator delete (void *p) {
-    shared_data_cache_allocator->dealloc (p);
+    CacheAllocator *a = CacheAllocator::owner (p);
+    if (a == CacheAllocator::forSize (sizeof (SharedData<T>)))
+        a->dealloc (p);
+    else // lives in front of its object, see Node::operator new
+        releaseEmbeddedData (p);
 }
 
 template <class T> inline void SharedData<T>::addRef () {
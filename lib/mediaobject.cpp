@@ -5,19 +5,28 @@
     SPDX-License-Identifier: LGPL-2.0-or-later
 */
 
+#include <cctype>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+
 #include <QTextStream>
 #include <QApplication>
 #include <QMovie>
 #include <QBuffer>
 #include <QPainter>
+#include <QRectF>
 #include <QSvgRenderer>
 #include <QImage>
 #include <QFile>
+#include <QFileInfo>
 #include <QUrl>
 #include <QTextCodec>
 #include <QTextStream>
 #include <QMimeDatabase>
 #include <QMimeType>
+#include <QCache>
+#include <QMap>
 
 #include <KLocalizedString>
 #include <KIO/Job>
@@ -28,6 +37,9 @@
 #include "kmplayerview.h"
 #include "expression.h"
 #include "viewarea.h"
+#include "watchdog.h"
+#include "bandwidth.h"
+#include "downloadscheduler.h"
 #include "kmplayerpartbase.h"
 #include "kmplayercommon_log.h"
 
@@ -36,15 +48,22 @@ using namespace KMPlayer;
 namespace {
 
     typedef QMap <QString, ImageDataPtrW> ImageDataMap;
+    typedef QCache <QString, QString> MimeMap;
+
+    static const int max_sniffed_mimes = 256; // least recently used go
 
     static DataCache *memory_cache;
+    static DownloadScheduler *download_scheduler;
     static ImageDataMap *image_data_map;
+    static MimeMap *sniffed_mime_map; // mime database results per url
 
     struct GlobalMediaData : public GlobalShared<GlobalMediaData> {
         GlobalMediaData (GlobalMediaData **gb)
          : GlobalShared<GlobalMediaData> (gb) {
             memory_cache = new DataCache;
+            download_scheduler = new DownloadScheduler;
             image_data_map = new ImageDataMap;
+            sniffed_mime_map = new MimeMap (max_sniffed_mimes);
         }
         ~GlobalMediaData () override;
     };
@@ -52,8 +71,10 @@ namespace {
     static GlobalMediaData *global_media;
 
     GlobalMediaData::~GlobalMediaData () {
+        delete download_scheduler;
         delete memory_cache;
         delete image_data_map;
+        delete sniffed_mime_map;
         global_media = nullptr;
     }
 
@@ -74,7 +95,10 @@ namespace {
 
 //------------------------%<----------------------------------------------------
 
-MediaManager::MediaManager (PartBase *player) : m_player (player) {
+MediaManager::MediaManager (PartBase *player)
+ : m_player (player),
+   m_watchdog (new ProcessWatchdog (this)),
+   m_bandwidth (new BandwidthEstimator) {
     if (!global_media)
         (void) new GlobalMediaData (&global_media);
     else
@@ -134,6 +158,10 @@ MediaManager::~MediaManager () {
         if (m_media_objects.size ())
             qCCritical(LOG_KMPLAYER_COMMON) << "~MediaManager media list still not empty" << m_media_objects.size () << endl;
     }
+    delete m_watchdog;
+    m_watchdog = nullptr;
+    delete m_bandwidth;
+    m_bandwidth = nullptr;
     global_media->unref ();
 }
 
@@ -190,9 +218,15 @@ void MediaManager::stateChange (AudioVideoMedia *media,
     bool is_rec = id_node_record_document == mrl->id;
     m_player->updateStatus (i18n ("Player %1 %2",
                 media->process->process_info->name, statemap[news]));
+    if (!is_rec)
+        m_watchdog->stateChange (media, olds, news);
     if (IProcess::Playing == news) {
         if (Element::state_deferred == mrl->state)
             mrl->undefer ();
+        if (media->start_position > 0) {
+            media->process->seek (media->start_position, true);
+            media->start_position = 0;
+        }
         bool has_video = !is_rec;
         if (is_rec && m_recorders.contains(media->process))
             m_player->recorderPlaying ();
@@ -210,6 +244,8 @@ void MediaManager::stateChange (AudioVideoMedia *media,
         if (AudioVideoMedia::ask_delete == media->request) {
             delete media;
         } else if (mrl->unfinished ()) {
+            if (!is_rec && media->process->crashed && m_watchdog->restart (media))
+                return;
             mrl->document ()->post (mrl, new Posting (mrl, MsgMediaFinished));
         }
     } else if (IProcess::Ready == news) {
@@ -218,6 +254,9 @@ void MediaManager::stateChange (AudioVideoMedia *media,
         } else if (AudioVideoMedia::ask_grab == media->request) {
             grabPicture (media);
         } else {
+            if (!is_rec && olds > IProcess::Ready &&
+                    media->process->crashed && m_watchdog->restart (media))
+                return;
             if (!is_rec && Mrl::SingleMode == mrl->view_mode) {
                 ProcessList::ConstIterator i, e = m_processes.constEnd ();
                 for (i = m_processes.constBegin(); i != e; ++i)
@@ -233,10 +272,13 @@ void MediaManager::stateChange (AudioVideoMedia *media,
             if (AudioVideoMedia::ask_delete == media->request) {
                 delete media;
             } else if (olds > IProcess::Ready) {
-                if (is_rec)
+                if (is_rec) {
                     mrl->message (MsgMediaFinished, nullptr); // FIXME
-                else
+                } else {
+                    if (!media->process->crashed)
+                        m_watchdog->finished (media);
                     mrl->document()->post(mrl, new Posting (mrl, MsgMediaFinished));
+                }
             }
         }
     } else if (IProcess::Buffering == news) {
@@ -253,6 +295,11 @@ void MediaManager::playAudioVideo (AudioVideoMedia *media) {
     media->request = AudioVideoMedia::ask_nothing;
     if (!mrl ||!m_player->view ())
         return;
+    if (id_node_record_document != mrl->id && m_watchdog->poisoned (media)) {
+        qCWarning(LOG_KMPLAYER_COMMON) << "skipping failing " << mrl->absolutePath ();
+        mrl->document ()->post (mrl, new Posting (mrl, MsgMediaFinished));
+        return;
+    }
     if (Mrl::SingleMode == mrl->view_mode) {
         ProcessList::ConstIterator i, e = m_processes.constEnd ();
         for (i = m_processes.constBegin(); i != e; ++i)
@@ -274,6 +321,8 @@ void MediaManager::processDestroyed (IProcess *process) {
     qCDebug(LOG_KMPLAYER_COMMON) << "processDestroyed " << process << endl;
     m_processes.removeAll (process);
     m_recorders.removeAll (process);
+    if (m_watchdog)
+        m_watchdog->processDestroyed (process);
 }
 
 //------------------------%<----------------------------------------------------
@@ -301,8 +350,6 @@ void DataCache::add (const QString & url, const QString &mime, const QByteArray
     QByteArray bytes;
     bytes = data;
     cache_map.insert (url, qMakePair (mime, bytes));
-    preserve_map.remove (url);
-    Q_EMIT preserveRemoved (url);
 }
 
 bool DataCache::get (const QString & url, QString &mime, QByteArray & data) {
@@ -315,76 +362,144 @@ bool DataCache::get (const QString & url, QString &mime, QByteArray & data) {
     return false;
 }
 
-bool DataCache::preserve (const QString & url) {
-    PreserveMap::const_iterator it = preserve_map.constFind (url);
-    if (it == preserve_map.constEnd ()) {
-        preserve_map.insert (url, true);
-        return true;
-    }
-    return false;
-}
+//------------------------%<----------------------------------------------------
+
+static const int playlist_batch = 1000; // items added per event loop pass
+static const qint64 max_playlist_size = 256 * 1024 * 1024; // pls and m3u
+static const qint64 max_xml_playlist_size = 2000000; // parsed into a tree
+
+/* playlist mime types that aren't matched on a prefix, sorted */
+static const char * const playlist_mimes [] = {
+    "application/x-mplayer2",
+    "audio/m3u",
+    "audio/mpegurl",
+    "audio/vnd.rn-realaudio",
+    "audio/x-m3u",
+    "audio/x-mpegurl",
+    "audio/x-pn-realaudio",
+    "audio/x-scpls",
+    "audio/x-shoutcast-stream",
+    "image/svg+xml",
+    "image/vnd.rn-realpix"
+};
 
-bool DataCache::isPreserved (const QString & url) {
-    return preserve_map.find (url) != preserve_map.end ();
+static int compareMime (const void *key, const void *entry) {
+    return strcmp ((const char *) key, *(const char * const *) entry);
 }
 
-bool DataCache::unpreserve (const QString & url) {
-    const PreserveMap::iterator it = preserve_map.find (url);
-    if (it == preserve_map.end ())
-        return false;
-    preserve_map.erase (it);
-    Q_EMIT preserveRemoved (url);
-    return true;
+static bool isPlayListMime (const QString & mime) {
+    const int plugin_pos = mime.indexOf ("-plugin");
+    const QByteArray ba = (plugin_pos > 0 ? mime.left (plugin_pos) : mime).toLatin1 ();
+    const char *m = ba.constData ();
+    if (!strncmp (m, "text/", 5) ||
+            !strncmp (m, "video/x-ms", 10) ||
+            !strncmp (m, "audio/x-ms", 10))
+        return true;
+    if (!strncasecmp (m, "application/", 12) &&
+            (!strncasecmp (m + 12, "smil", 4) ||
+             !strncasecmp (m + 12, "xml", 3) ||
+             strstr (m + 12, "+xml")))
+        return true;
+    return bsearch (m, playlist_mimes,
+            sizeof (playlist_mimes) / sizeof (playlist_mimes[0]),
+            sizeof (playlist_mimes[0]), compareMime);
 }
 
-//------------------------%<----------------------------------------------------
+/* whether data starts like xml, or is utf-16 which only xml is read as */
+static bool isXmlData (const char *d, int size) {
+    if (size > 1 && (((uchar) d[0] == 0xff && (uchar) d[1] == 0xfe) ||
+                ((uchar) d[0] == 0xfe && (uchar) d[1] == 0xff)))
+        return true;
+    int pos = size > 2 && !strncmp (d, "\xef\xbb\xbf", 3) ? 3 : 0;
+    while (pos < size && isspace ((unsigned char) d[pos]))
+        ++pos;
+    return pos < size && d[pos] == '<';
+}
+
+/* mime type of common formats from their first bytes, xml from its root
+ * element, or null if it takes the mime database to tell */
+static const char *sniffMime (const QByteArray &data) {
+    static const struct {
+        const char *root;
+        const char *mime;
+    } xml_roots [] = {
+        { "asx", "audio/x-ms-asx" },
+        { "feed", "application/atom+xml" },
+        { "opml", "text/x-opml+xml" },
+        { "playlist", "application/xspf+xml" },
+        { "rss", "application/rss+xml" },
+        { "smil", "application/smil+xml" },
+        { "svg", "image/svg+xml" }
+    };
+    const char *d = data.constData ();
+    const int size = data.size ();
+    if (size >= 8 && !memcmp (d, "\x89PNG\r\n\x1a\n", 8))
+        return "image/png";
+    if (size >= 3 && !memcmp (d, "\xff\xd8\xff", 3))
+        return "image/jpeg";
+    if (size >= 6 && (!memcmp (d, "GIF87a", 6) || !memcmp (d, "GIF89a", 6)))
+        return "image/gif";
+    if (size >= 7 && !memcmp (d, "#EXTM3U", 7))
+        return data.indexOf ("#EXT-X-") > -1 ? nullptr : "audio/x-mpegurl"; // HLS
+    if (size >= 10 && !strncasecmp (d, "[playlist]", 10))
+        return "audio/x-scpls";
+
+    int pos = size >= 3 && !memcmp (d, "\xef\xbb\xbf", 3) ? 3 : 0;
+    while (true) { // skip the xml declaration, doctype and comments
+        while (pos < size && isspace ((unsigned char) d[pos]))
+            ++pos;
+        if (pos + 1 >= size || d[pos] != '<')
+            return nullptr;
+        if (d[pos + 1] != '?' && d[pos + 1] != '!')
+            break;
+        const char *gt = (const char *) memchr (d + pos, '>', size - pos);
+        if (!gt)
+            return nullptr;
+        pos = gt - d + 1;
+    }
+    const int start = ++pos;
+    while (pos < size && (isalnum ((unsigned char) d[pos]) || d[pos] == '-'))
+        ++pos;
+    const int len = pos - start;
+    if (pos >= size || len <= 0)
+        return nullptr;
+    for (unsigned i = 0; i < sizeof (xml_roots) / sizeof (xml_roots[0]); ++i)
+        if (!strncasecmp (d + start, xml_roots[i].root, len) &&
+                !xml_roots[i].root[len])
+            return xml_roots[i].mime;
+    return nullptr;
+}
 
-static bool isPlayListMime (const QString & mime) {
-    QString m (mime);
-    int plugin_pos = m.indexOf ("-plugin");
-    if (plugin_pos > 0)
-        m.truncate (plugin_pos);
-    QByteArray ba = m.toLatin1 ();
-    const char * mimestr = ba.data ();
-    qCDebug(LOG_KMPLAYER_COMMON) << "isPlayListMime " << mimestr;
-    return mimestr && (!strcmp (mimestr, "audio/mpegurl") ||
-            !strcmp (mimestr, "audio/x-mpegurl") ||
-            !strncmp (mimestr, "video/x-ms", 10) ||
-            !strncmp (mimestr, "audio/x-ms", 10) ||
-            //!strcmp (mimestr, "video/x-ms-wmp") ||
-            //!strcmp (mimestr, "video/x-ms-asf") ||
-            //!strcmp (mimestr, "video/x-ms-wmv") ||
-            //!strcmp (mimestr, "video/x-ms-wvx") ||
-            //!strcmp (mimestr, "video/x-msvideo") ||
-            !strcmp (mimestr, "audio/x-scpls") ||
-            !strcmp (mimestr, "audio/x-shoutcast-stream") ||
-            !strcmp (mimestr, "audio/x-pn-realaudio") ||
-            !strcmp (mimestr, "audio/vnd.rn-realaudio") ||
-            !strcmp (mimestr, "audio/m3u") ||
-            !strcmp (mimestr, "audio/x-m3u") ||
-            !strncmp (mimestr, "text/", 5) ||
-            (!strncmp (mimestr, "application/", 12) &&
-             strstr (mimestr + 12,"+xml")) ||
-            !strncasecmp (mimestr, "application/smil", 16) ||
-            !strncasecmp (mimestr, "application/xml", 15) ||
-            //!strcmp (mimestr, "application/rss+xml") ||
-            //!strcmp (mimestr, "application/atom+xml") ||
-            !strcmp (mimestr, "image/svg+xml") ||
-            !strcmp (mimestr, "image/vnd.rn-realpix") ||
-            !strcmp (mimestr, "application/x-mplayer2"));
-}
-
-static QString mimeByContent (const QByteArray &data)
+static QString mimeByContent (const QString &url, const QByteArray &data)
 {
+    const char *sniffed = sniffMime (data);
+    if (sniffed)
+        return QString (sniffed);
+    if (!url.isEmpty ()) {
+        const QString *mime = sniffed_mime_map->object (url);
+        if (mime)
+            return *mime;
+    }
     const QMimeType mimeType = QMimeDatabase().mimeTypeForData(data);
-    if (mimeType.isValid())
-        return mimeType.name ();
-    return QString ();
+    const QString name = mimeType.isValid () ? mimeType.name () : QString ();
+    if (!url.isEmpty ())
+        sniffed_mime_map->insert (url, new QString (name));
+    return name;
+}
+
+/* a fresh disk cache hit is kept in memory too, for the next load */
+static bool diskCacheGet (const QString &str, const QUrl &url,
+        QString &mime, QByteArray &data) {
+    if (!download_scheduler->diskCache ()->get (url.url (), mime, data))
+        return false;
+    memory_cache->add (str, mime, data);
+    return true;
 }
 
 MediaInfo::MediaInfo (Node *n, MediaManager::MediaType t)
- : media (nullptr), type (t), node (n), job (nullptr),
-    preserve_wait (false), check_access (false) {
+ : media (nullptr), type (t), node (n), mapped_file (nullptr),
+    entries_pos (0), entries_update (0), entries_timer (0), entries_pls (false),
+    wget_pending (false), prefetch (false), check_access (false) {
 }
 
 MediaInfo::~MediaInfo () {
@@ -392,17 +507,20 @@ MediaInfo::~MediaInfo () {
 }
 
 void MediaInfo::killWGet () {
-    if (job) {
-        job->kill (); // quiet, no result signal
-        job = nullptr;
-        memory_cache->unpreserve (url);
-    } else if (preserve_wait) {
-        disconnect (memory_cache, &DataCache::preserveRemoved,
-                    this, &MediaInfo::cachePreserveRemoved);
-        preserve_wait = false;
+    if (wget_pending) {
+        download_scheduler->cancel (this);
+        wget_pending = false;
     }
 }
 
+void MediaInfo::setPrefetch (bool b) {
+    prefetch = b;
+    if (wget_pending)
+        download_scheduler->setPriority (this, prefetch
+                ? DownloadScheduler::PriorityPrefetch
+                : DownloadScheduler::PriorityNow);
+}
+
 /**
  * Gets contents from url and puts it in m_data
  */
@@ -474,7 +592,7 @@ bool MediaInfo::wget(const QString& str, const QString& domain) {
             maybe_playlist = isPlayListMime (mime); // get new mime
             if (file.open (QIODevice::ReadOnly)) {
                 if (only_playlist) {
-                    maybe_playlist &= file.size () < 2000000;
+                    maybe_playlist &= file.size () < max_playlist_size;
                     if (maybe_playlist) {
                         char databuf [512];
                         int nr_bytes = file.read (databuf, 512);
@@ -482,11 +600,30 @@ bool MediaInfo::wget(const QString& str, const QString& domain) {
                                 (::isBufferBinaryData (QByteArray (databuf, nr_bytes)) ||
                                  !strncmp (databuf, "RIFF", 4)))
                             maybe_playlist = false;
+                        else if (file.size () >= max_xml_playlist_size &&
+                                isXmlData (databuf, nr_bytes))
+                            maybe_playlist = false;
                     }
                     if (!maybe_playlist) {
                         ready ();
                         return true;
                     }
+                    // reading a truncated mapping faults, so only map
+                    // files of the user, others are read
+                    mapped_file = new QFile (file.fileName ());
+                    const uchar *mem =
+                        QFileInfo (file).ownerId () == ::getuid () &&
+                        mapped_file->open (QIODevice::ReadOnly)
+                        ? mapped_file->map (0, file.size (), QFileDevice::MapPrivateOption)
+                        : nullptr;
+                    if (mem) {
+                        data = QByteArray::fromRawData ((const char *) mem, file.size ());
+                        file.close ();
+                        ready ();
+                        return true;
+                    }
+                    delete mapped_file;
+                    mapped_file = nullptr;
                     file.reset ();
                 }
                 data = file.readAll ();
@@ -509,6 +646,7 @@ bool MediaInfo::wget(const QString& str, const QString& domain) {
     if (!check_access) {
         if (MediaManager::Data != type &&
                 (memory_cache->get (str, mime, data) ||
+                 diskCacheGet (str, kurl, mime, data) ||
                  protocol == "mms" || protocol == "rtsp" ||
                  protocol == "rtp" || protocol == "rtmp" ||
                  (only_playlist && !maybe_playlist && !mime.isEmpty ()))) {
@@ -519,120 +657,232 @@ bool MediaInfo::wget(const QString& str, const QString& domain) {
             return true;
         }
     }
-    if (check_access || memory_cache->preserve (str)) {
-        //qCDebug(LOG_KMPLAYER_COMMON) << "downloading " << str;
-        job = KIO::get (kurl, KIO::NoReload, KIO::HideProgressInfo);
-        job->addMetaData ("PropagateHttpHeader", "true");
-        job->addMetaData ("errorPage", "false");
-        connect (job, &KIO::TransferJob::data,
-                this, &MediaInfo::slotData);
-        connect (job, &KJob::result,
-                this, &MediaInfo::slotResult);
-        if (!check_access)
-            connect (job, QOverload<KIO::Job*, const QString&>::of(&KIO::TransferJob::mimetype),
-                    this, &MediaInfo::slotMimetype);
-    } else {
-        //qCDebug(LOG_KMPLAYER_COMMON) << "download preserved " << str;
-        connect (memory_cache, &DataCache::preserveRemoved,
-                 this, &MediaInfo::cachePreserveRemoved);
-        preserve_wait = true;
-    }
+    //qCDebug(LOG_KMPLAYER_COMMON) << "downloading " << str;
+    wget_pending = true;
+    download_scheduler->get (this, kurl, prefetch
+            ? DownloadScheduler::PriorityPrefetch
+            : DownloadScheduler::PriorityNow);
     return false;
 }
 
-bool MediaInfo::readChildDoc () {
-    QTextStream textstream (data, QIODevice::ReadOnly);
-    QString line;
-    NodePtr cur_elm = node;
-    do {
-        line = textstream.readLine ();
-    } while (!line.isNull () && line.trimmed ().isEmpty ());
-    if (!line.isNull ()) {
-        bool pls_groupfound =
-            line.startsWith ("[") && line.endsWith ("]") &&
-            line.mid (1, line.size () - 2).trimmed () == "playlist";
-        if ((pls_groupfound &&
-                    cur_elm->mrl ()->mimetype.startsWith ("audio/")) ||
-                cur_elm->mrl ()->mimetype == QString ("audio/x-scpls")) {
-            int nr = -1;
-            struct Entry {
-                QString url, title;
-            } * entries = nullptr;
-            do {
-                line = line.trimmed ();
-                if (!line.isEmpty ()) {
-                    if (line.startsWith ("[") && line.endsWith ("]")) {
-                        if (line.mid (1, line.size () - 2).trimmed () == "playlist")
-                            pls_groupfound = true;
-                        else
-                            break;
-                        qCDebug(LOG_KMPLAYER_COMMON) << "Group found: " << line;
-                    } else if (pls_groupfound) {
-                        int eq_pos = line.indexOf (QChar ('='));
-                        if (eq_pos > 0) {
-                            if (line.toLower ().startsWith (QString ("numberofentries"))) {
-                                nr = line.mid (eq_pos + 1).trimmed ().toInt ();
-                                qCDebug(LOG_KMPLAYER_COMMON) << "numberofentries : " << nr;
-                                if (nr > 0 && nr < 1024)
-                                    entries = new Entry[nr];
-                                else
-                                    nr = 0;
-                            } else if (nr > 0) {
-                                QString ll = line.toLower ();
-                                if (ll.startsWith (QString ("file"))) {
-                                    int i = line.mid (4, eq_pos-4).toInt ();
-                                    if (i > 0 && i <= nr)
-                                        entries[i-1].url = line.mid (eq_pos + 1).trimmed ();
-                                } else if (ll.startsWith (QString ("title"))) {
-                                    int i = line.mid (5, eq_pos-5).toInt ();
-                                    if (i > 0 && i <= nr)
-                                        entries[i-1].title = line.mid (eq_pos + 1).trimmed ();
-                                }
-                            }
-                        }
-                    }
-                }
-                line = textstream.readLine ();
-            } while (!line.isNull ());
-            NodePtr doc = node->document ();
-            for (int i = 0; i < nr; i++)
-                if (!entries[i].url.isEmpty ())
-                    cur_elm->appendChild (new GenericURL (doc,
-                           QUrl::fromPercentEncoding (entries[i].url.toUtf8 ()),
-                           entries[i].title));
-            delete [] entries;
-        } else if (line.trimmed ().startsWith (QChar ('<'))) {
-            readXML (cur_elm, textstream, line);
-            //cur_elm->normalize ();
-        } else if (line.toLower () != QString ("[reference]")) {
-            bool extm3u = line.startsWith ("#EXTM3U");
-            QString title;
-            NodePtr doc = node->document ();
-            if (extm3u)
-                line = textstream.readLine ();
-            while (!line.isNull ()) {
-             /* TODO && m_document.size () < 1024 / * support 1k entries * /);*/
-                QString mrl = line.trimmed ();
-                if (line == QString ("--stop--"))
-                    break;
-                if (mrl.toLower ().startsWith (QString ("asf ")))
-                    mrl = mrl.mid (4).trimmed ();
-                if (!mrl.isEmpty ()) {
-                    if (extm3u && mrl.startsWith (QChar ('#'))) {
-                        if (line.startsWith ("#EXTINF:"))
-                            title = line.mid (9);
-                        else
-                            title = mrl.mid (1);
-                    } else if (!line.startsWith (QChar ('#'))) {
-                        cur_elm->appendChild (new GenericURL (doc, mrl, title));
-                        title.truncate (0);
-                    }
+/* next line from pos, [start, end) is the line without surrounding space */
+static bool nextLine (const char *d, int size, int &pos, int &begin,
+        int &start, int &end) {
+    if (pos >= size)
+        return false;
+    begin = pos;
+    while (pos < size && d[pos] != '\n' && d[pos] != '\r')
+        ++pos;
+    start = begin;
+    end = pos;
+    while (start < end && isspace ((unsigned char) d[start]))
+        ++start;
+    while (end > start && isspace ((unsigned char) d[end - 1]))
+        --end;
+    if (pos < size && d[pos] == '\r')
+        ++pos;
+    if (pos < size && d[pos] == '\n')
+        ++pos;
+    return true;
+}
+
+static bool startsWithNoCase (const char *d, int start, int end, const char *s) {
+    const int len = strlen (s);
+    return end - start >= len && !qstrnicmp (d + start, s, len);
+}
+
+/* [name], case insensitive and white space allowed inside the brackets */
+static bool isGroup (const char *d, int start, int end, const char *name) {
+    if (end - start < 2 || d[start] != '[' || d[end - 1] != ']')
+        return false;
+    ++start;
+    --end;
+    while (start < end && isspace ((unsigned char) d[start]))
+        ++start;
+    while (end > start && isspace ((unsigned char) d[end - 1]))
+        --end;
+    return end - start == (int) strlen (name) &&
+        !qstrnicmp (d + start, name, end - start);
+}
+
+static int entryIndex (const char *d, int start, int end) {
+    bool ok;
+    const int i = QByteArray::fromRawData (d + start, end - start).trimmed ().toInt (&ok);
+    return ok ? i : 0;
+}
+
+void MediaInfo::readPls (int pos) {
+    const char *d = data.constData ();
+    const int size = data.size ();
+    bool group_found = false;
+    int begin, start, end;
+    // the File<N>= numbers can be sparse and in any order
+    QMap <int, PlaylistEntry> indexed;
+    entries_pls = true;
+    while (nextLine (d, size, pos, begin, start, end)) {
+        if (start == end)
+            continue;
+        if (d[start] == '[' && d[end - 1] == ']') {
+            if (!isGroup (d, start, end, "playlist"))
+                break;
+            group_found = true;
+        } else if (group_found) {
+            const char *eq = (const char *) memchr (d + start, '=', end - start);
+            if (!eq || eq == d + start)
+                continue;
+            const int eq_pos = eq - d;
+            int value = eq_pos + 1;
+            while (value < end && isspace ((unsigned char) d[value]))
+                ++value;
+            // NumberOfEntries is ignored, lists with a wrong count are
+            // seen often
+            const bool file = startsWithNoCase (d, start, eq_pos, "file");
+            if (file || startsWithNoCase (d, start, eq_pos, "title")) {
+                const int i = entryIndex (d, start + (file ? 4 : 5), eq_pos);
+                if (i <= 0)
+                    continue;
+                PlaylistEntry &entry = indexed[i];
+                if (file) {
+                    entry.url = value;
+                    entry.url_len = end - value;
+                } else {
+                    entry.title = value;
+                    entry.title_len = end - value;
                 }
-                line = textstream.readLine ();
             }
         }
     }
-    return !cur_elm->isPlayable ();
+    entries.reserve (indexed.size ());
+    const QMap <int, PlaylistEntry>::const_iterator e = indexed.constEnd ();
+    for (QMap <int, PlaylistEntry>::const_iterator i = indexed.constBegin (); i != e; ++i)
+        entries.append (i.value ());
+}
+
+void MediaInfo::readM3u (int pos, bool extm3u) {
+    const char *d = data.constData ();
+    const int size = data.size ();
+    int begin, start, end;
+    int title = 0, title_len = 0;
+    entries_pls = false;
+    while (nextLine (d, size, pos, begin, start, end)) {
+        if (end - start == 8 && !strncmp (d + start, "--stop--", 8))
+            break;
+        if (startsWithNoCase (d, start, end, "asf ")) {
+            start += 4;
+            while (start < end && isspace ((unsigned char) d[start]))
+                ++start;
+        }
+        if (start == end)
+            continue;
+        if (extm3u && d[start] == '#') {
+            if (!strncmp (d + begin, "#EXTINF:", 8))
+                title = qMin (begin + 9, end);
+            else
+                title = start + 1;
+            title_len = end - title;
+        } else if (d[begin] != '#') {
+            PlaylistEntry entry = { start, end - start, title, title_len };
+            entries.append (entry);
+            title_len = 0;
+        }
+    }
+}
+
+void MediaInfo::appendEntries (int count) {
+    if (mapped_file && mapped_file->size () < data.size ()) {
+        qCWarning(LOG_KMPLAYER_COMMON) << "playlist " << mapped_file->fileName () << " got truncated";
+        clearEntries ();
+        return;
+    }
+    const char *d = data.constData ();
+    NodePtr doc = node->document ();
+    const int last = qMin (entries.size (), entries_pos + count);
+    for (; entries_pos < last; ++entries_pos) {
+        const PlaylistEntry &entry = entries[entries_pos];
+        if (!entry.url_len)
+            continue;
+        const QString title = QString::fromLocal8Bit (d + entry.title, entry.title_len);
+        if (entries_pls)
+            node->appendChild (new GenericURL (doc, QUrl::fromPercentEncoding (
+                        QByteArray::fromRawData (d + entry.url, entry.url_len)),
+                        title));
+        else
+            node->appendChild (new GenericURL (doc,
+                        QString::fromLocal8Bit (d + entry.url, entry.url_len),
+                        title));
+    }
+    if (entries_pos >= entries.size ())
+        clearEntries ();
+}
+
+void MediaInfo::clearEntries () {
+    if (entries_timer) {
+        killTimer (entries_timer);
+        entries_timer = 0;
+    }
+    entries.clear ();
+    entries_pos = 0;
+}
+
+void MediaInfo::timerEvent (QTimerEvent *e) {
+    if (e->timerId () != entries_timer) {
+        killTimer (e->timerId ());
+        return;
+    }
+    appendEntries (playlist_batch);
+    // the view is rebuilt on each update, so do that less often as it grows
+    if (!entries_timer || entries_pos >= entries_update) {
+        entries_update = 2 * entries_pos;
+        MediaManager *mgr = (MediaManager *) node->document ()->role (RoleMediaManager);
+        if (mgr)
+            mgr->player ()->updateTree ();
+    }
+}
+
+/*
+ * Playlists are scanned in place, from the downloaded data or the mapped
+ * file. The first batch of items is added right away, so the caller knows
+ * whether the node got children. The rest is added from the event loop,
+ * one batch per pass, which is ahead of playing these items.
+ */
+bool MediaInfo::readChildDoc () {
+    const char *d = data.constData ();
+    const int size = data.size ();
+    int pos = 0, begin, start, end;
+    clearEntries ();
+    if (size > 2 && !strncmp (d, "\xef\xbb\xbf", 3))
+        pos = 3; // utf-8 byte order mark
+    const bool utf16 = size > 1 &&
+        (((uchar) d[0] == 0xff && (uchar) d[1] == 0xfe) ||
+         ((uchar) d[0] == 0xfe && (uchar) d[1] == 0xff));
+    do {
+        if (!nextLine (d, size, pos, begin, start, end))
+            return !node->isPlayable ();
+    } while (start == end);
+    Mrl *mrl = node->mrl ();
+    if (!utf16 && ((isGroup (d, start, end, "playlist") &&
+                    mrl->mimetype.startsWith ("audio/")) ||
+                mrl->mimetype == QString ("audio/x-scpls"))) {
+        readPls (begin);
+    } else if (utf16 || d[start] == '<') {
+        QTextStream textstream (data, QIODevice::ReadOnly);
+        QString line;
+        do {
+            line = textstream.readLine ();
+        } while (!line.isNull () && line.trimmed ().isEmpty ());
+        if (line.trimmed ().startsWith (QChar ('<')))
+            readXML (node, textstream, line);
+        //node->normalize ();
+    } else if (!isGroup (d, start, end, "reference")) {
+        const bool extm3u = !strncmp (d + begin, "#EXTM3U", 7);
+        readM3u (extm3u ? pos : begin, extm3u);
+    }
+    appendEntries (playlist_batch);
+    if (!entries.isEmpty ()) {
+        entries_update = 2 * playlist_batch;
+        entries_timer = startTimer (0);
+    }
+    return !node->isPlayable ();
 }
 
 void MediaInfo::setMimetype (const QString &mt)
@@ -655,7 +905,7 @@ void MediaInfo::setMimetype (const QString &mt)
 
 QString MediaInfo::mimetype () {
     if (data.size () > 0 && mime.isEmpty ())
-        setMimetype (mimeByContent (data));
+        setMimetype (mimeByContent (url, data));
     return mime;
 }
 
@@ -668,11 +918,17 @@ void MediaInfo::clearData () {
     url.truncate (0);
     mime.truncate (0);
     access_from.truncate (0);
+    clearEntries ();
     data.resize (0);
+    if (mapped_file) {
+        data = QByteArray (); // drop the reference to the mapping
+        delete mapped_file;
+        mapped_file = nullptr;
+    }
 }
 
 bool MediaInfo::downloading () const {
-    return !!job;
+    return wget_pending;
 }
 
 void MediaInfo::create () {
@@ -735,13 +991,13 @@ static bool validDataFormat (MediaManager::MediaType type, const QByteArray &ba)
     }
 }
 
-void MediaInfo::slotResult (KJob *kjob) {
-    job = nullptr; // signal KIO::Job::result deletes itself
+void MediaInfo::downloadResult (int error) {
+    wget_pending = false;
     if (check_access) {
         check_access = false;
 
         bool success = false;
-        if (!kjob->error () && data.size () > 0) {
+        if (!error && data.size () > 0) {
             QTextStream ts (data, QIODevice::ReadOnly);
             NodePtr doc = new Document (QString ());
             readXML (doc, ts, QString ());
@@ -769,49 +1025,46 @@ void MediaInfo::slotResult (KJob *kjob) {
             ready ();
         }
     } else {
-        if (MediaManager::Data != type && !kjob->error ()) {
+        if (MediaManager::Data != type && !error) {
             if (data.size () && data.size () < 512) {
-                setMimetype (mimeByContent (data));
+                setMimetype (mimeByContent (url, data));
                 if (!validDataFormat (type, data))
                     data.resize (0);
             }
             memory_cache->add (url, mime, data);
-        } else {
-            memory_cache->unpreserve (url);
-            if (MediaManager::Data != type)
-                data.resize (0);
+        } else if (MediaManager::Data != type) {
+            data.resize (0);
         }
         ready ();
     }
 }
 
-void MediaInfo::cachePreserveRemoved (const QString & str) {
-    if (str == url && !memory_cache->isPreserved (str)) {
-        preserve_wait = false;
-        disconnect (memory_cache, &DataCache::preserveRemoved,
-                    this, &MediaInfo::cachePreserveRemoved);
-        wget (str);
-    }
+void MediaInfo::sharedDownloadDone () {
+    wget_pending = false;
+    wget (QString (url)); // likely from the memory cache now
 }
 
-void MediaInfo::slotData (KIO::Job *, const QByteArray &qb) {
+void MediaInfo::downloadData (const QByteArray &qb) {
     if (qb.size ()) {
         int old_size = data.size ();
         int newsize = old_size + qb.size ();
         data.resize (newsize);
         memcpy (data.data () + old_size, qb.constData (), qb.size ());
         if (!check_access && old_size < 512 && newsize >= 512) {
-            setMimetype (mimeByContent (data));
+            setMimetype (mimeByContent (url, data));
             if (!validDataFormat (type, data)) {
                 data.resize (0);
-                job->kill (KJob::EmitResult);
+                killWGet ();
+                downloadResult (KIO::ERR_USER_CANCELED);
                 return;
             }
         }
     }
 }
 
-void MediaInfo::slotMimetype (KIO::Job *, const QString & m) {
+void MediaInfo::downloadMimetype (const QString & m) {
+    if (check_access)
+        return;
     Mrl *mrl = node->mrl ();
     mime = m;
     if (mrl)
@@ -822,8 +1075,10 @@ void MediaInfo::slotMimetype (KIO::Job *, const QString & m) {
         break;
     case MediaManager::Audio:
     case MediaManager::AudioVideo:
-        if (!isPlayListMime (m))
-            job->kill (KJob::EmitResult);
+        if (!isPlayListMime (m)) {
+            killWGet ();
+            downloadResult (KIO::ERR_USER_CANCELED);
+        }
         break;
     default:
         //TODO
@@ -836,12 +1091,14 @@ void MediaInfo::slotMimetype (KIO::Job *, const QString & m) {
 IProcess::IProcess (ProcessInfo *pinfo) :
     user (nullptr),
     process_info (pinfo),
+    crashed (false),
     m_state (NotRunning) {}
 
 AudioVideoMedia::AudioVideoMedia (MediaManager *manager, Node *node)
  : MediaObject (manager, node),
    process (nullptr),
    m_viewer (nullptr),
+   start_position (0),
    request (ask_nothing) {
     qCDebug(LOG_KMPLAYER_COMMON) << "AudioVideoMedia::AudioVideoMedia" << endl;
 }
@@ -1016,7 +1273,9 @@ ImageMedia::ImageMedia (MediaManager *manager, Node *node,
  : MediaObject (manager, node), data (ba), buffer (nullptr),
    img_movie (nullptr),
    svg_renderer (nullptr),
+   svg_xml_version (0),
    update_render (false),
+   svg_render_all (false),
    paused (false) {
     setupImage (url);
 }
@@ -1027,11 +1286,16 @@ ImageMedia::ImageMedia (Node *node, ImageDataPtr id)
    buffer (nullptr),
    img_movie (nullptr),
    svg_renderer (nullptr),
-   update_render (false) {
+   svg_xml_version (0),
+   update_render (false),
+   svg_render_all (false),
+   paused (false) {
     if (!id) {
         Node *c = findChildWithId (node, id_node_svg);
         if (c) {
-            svg_renderer = new QSvgRenderer (c->outerXML().toUtf8 ());
+            svg_xml = c->outerXMLData ();
+            svg_xml_version = c->document ()->m_xml_version;
+            svg_renderer = new QSvgRenderer (svg_xml);
             if (svg_renderer->isValid ()) {
                 cached_img = new ImageData (QString ());
                 cached_img->flags = ImageData::ImageScalable;
@@ -1120,35 +1384,120 @@ void ImageMedia::setupImage (const QString &url) {
     }
 }
 
+bool ImageMedia::svgBounds (QRectF &bounds) const {
+    const QStringList::const_iterator e = svg_dirty_ids.constEnd ();
+    for (QStringList::const_iterator i = svg_dirty_ids.constBegin (); i != e; ++i) {
+        if (!svg_renderer->elementExists (*i))
+            continue;
+        const QRectF r = svg_renderer->matrixForElement (*i).mapRect (
+                svg_renderer->boundsOnElement (*i));
+        if (r.isEmpty ())
+            return false; // eg. a gradient, used elsewhere
+        bounds |= r;
+    }
+    return true;
+}
+
 void ImageMedia::render (const ISize &sz) {
-    if (svg_renderer && update_render) {
-        delete svg_renderer;
-        svg_renderer = nullptr;
+    if (!svg_renderer)
+        return;
+    QRectF dirty; // document coordinates
+    if (update_render) {
+        update_render = false;
         Node *c = findChildWithId (m_node, id_node_svg);
-        if (c) {
-            QSvgRenderer *r = new QSvgRenderer (c->outerXML().toUtf8 ());
-            if (r->isValid ()) {
+        QByteArray xml = svg_xml;
+        if (!c || c->document ()->m_xml_version != svg_xml_version) {
+            // serialize again only when the document changed
+            xml = c ? c->outerXMLData () : QByteArray ();
+            svg_xml_version = c ? c->document ()->m_xml_version : 0;
+        }
+        if (xml != svg_xml) {
+            // where the changed elements were and are now
+            if (!svgBounds (dirty))
+                svg_render_all = true;
+            bool ok;
+            {
+                QSignalBlocker blocker (svg_renderer); // load repaints
+                ok = c && svg_renderer->load (xml);
+            }
+            if (!ok) {
+                delete svg_renderer;
+                svg_renderer = nullptr;
+                svg_xml.clear ();
+                svg_dirty_ids.clear ();
                 cached_img->setImage (nullptr);
-                svg_renderer = r;
-            } else {
-                delete r;
+                return;
             }
+            svg_xml = xml;
+            if (!svgBounds (dirty))
+                svg_render_all = true;
+            if (!paused && svg_renderer->animated ())
+                connect (svg_renderer, &QSvgRenderer::repaintNeeded,
+                        this, &ImageMedia::svgUpdated, Qt::UniqueConnection);
         }
-        update_render = false;
+        svg_dirty_ids.clear ();
     }
-    if (svg_renderer &&
-           (cached_img->width != sz.width || cached_img->height != sz.height)) {
-        QImage *img = new QImage (sz.width, sz.height,
+    QImage *img = cached_img->image;
+    if (!img || cached_img->width != sz.width || cached_img->height != sz.height) {
+        img = new QImage (sz.width, sz.height,
                 QImage::Format_ARGB32_Premultiplied);
-        img->fill (0x0);
-        QPainter paint (img);
-        paint.setViewport (QRect (0, 0, sz.width, sz.height));
-        svg_renderer->render (&paint);
         cached_img->setImage (img);
+        svg_render_all = true;
+    } else if (!svg_render_all && dirty.isEmpty ()) {
+        return;
+    }
+    QPainter paint (img);
+    paint.setViewport (QRect (0, 0, sz.width, sz.height));
+    const QRectF vb = svg_renderer->viewBoxF ();
+    if (!svg_render_all && vb.width () > 0 && vb.height () > 0) {
+        // only the changed area, the buffer keeps the rest
+        const qreal sx = sz.width / vb.width ();
+        const qreal sy = sz.height / vb.height ();
+        const QRect r = QRectF ((dirty.x () - vb.x ()) * sx,
+                (dirty.y () - vb.y ()) * sy,
+                dirty.width () * sx, dirty.height () * sy)
+            .toAlignedRect ().adjusted (-2, -2, 2, 2) & img->rect ();
+        paint.setClipRect (r);
+        paint.setCompositionMode (QPainter::CompositionMode_Source);
+        paint.fillRect (r, Qt::transparent);
+        paint.setCompositionMode (QPainter::CompositionMode_SourceOver);
+    } else {
+        img->fill (0x0);
     }
+    svg_renderer->render (&paint);
+    svg_render_all = false;
+}
+
+/* whether n is painted elsewhere too, so its own bounds don't tell what
+ * changed. That is when n or an ancestor is a definition or is referenced
+ * by an url(#id) or href="#id" in xml */
+static bool svgReferenced (Node *n, const QByteArray &xml) {
+    static const char * const definitions [] = {
+        "clipPath", "defs", "filter", "linearGradient", "marker", "mask",
+        "pattern", "radialGradient", "symbol"
+    };
+    for (; n && n->id != id_node_svg; n = n->parentNode ()) {
+        if (!n->isElementNode ())
+            continue;
+        const char *name = n->nodeName ();
+        for (size_t i = 0; i < sizeof (definitions) / sizeof (definitions[0]); ++i)
+            if (!strcmp (name, definitions[i]))
+                return true;
+        const QString id = static_cast <Element *> (n)->getAttribute (Ids::attr_id);
+        if (!id.isEmpty () && xml.contains ('#' + id.toUtf8 ()))
+            return true;
+    }
+    return false;
 }
 
-void ImageMedia::updateRender () {
+void ImageMedia::updateRender (Node *changed) {
+    const QString id = changed && changed->isElementNode ()
+        ? static_cast <Element *> (changed)->getAttribute (Ids::attr_id)
+        : QString ();
+    if (id.isEmpty () || svgReferenced (changed, svg_xml))
+        svg_render_all = true;
+    else if (!svg_dirty_ids.contains (id))
+        svg_dirty_ids.append (id);
     update_render = true;
     if (m_node)
         m_node->document()->post(m_node, new Posting (m_node, MsgMediaUpdated));
@@ -1173,7 +1522,7 @@ bool ImageMedia::isEmpty () const {
 }
 
 void ImageMedia::svgUpdated() {
-    cached_img->setImage (nullptr);
+    svg_render_all = true; // an svg animation, the changes are unknown
     if (m_node)
         m_node->document ()->post (m_node, new Posting (m_node, MsgMediaUpdated));
 }
@@ -16,6 +16,8 @@
 #include <QString>
 #include <QMovie>
 #include <QList>
+#include <QStringList>
+#include <QVector>
 
 #include "kmplayercommon_export.h"
 #include "kmplayerplaylist.h"
@@ -24,7 +26,9 @@ class QMovie;
 class QImage;
 class QSvgRenderer;
 class QBuffer;
+class QFile;
 class QByteArray;
+class QRectF;
 class KJob;
 namespace KIO {
     class Job;
@@ -43,6 +47,8 @@ class PreferencesPage;
 class MediaObject;
 class CalculatedSizer;
 class Surface;
+class ProcessWatchdog;
+class BandwidthEstimator;
 
 
 class KMPLAYERCOMMON_EXPORT IProcess
@@ -74,6 +80,7 @@ public:
     State state () const { return m_state; }
     ProcessUser *user;
     ProcessInfo *process_info;
+    bool crashed; // abnormal exit or hang, reset by play ()
 
 protected:
     IProcess (ProcessInfo *pinfo);
@@ -142,6 +149,8 @@ public:
     ProcessList &recorders () { return m_recorders; }
     MediaList &medias () { return m_media_objects; }
     PartBase *player () const { return m_player; }
+    ProcessWatchdog *watchdog () const { return m_watchdog; }
+    BandwidthEstimator *bandwidth () const { return m_bandwidth; }
 
 private:
     MediaList m_media_objects;
@@ -150,6 +159,8 @@ private:
     ProcessInfoMap m_record_infos;
     ProcessList m_recorders;
     PartBase *m_player;
+    ProcessWatchdog *m_watchdog;
+    BandwidthEstimator *m_bandwidth;
 };
 
 
@@ -163,19 +174,12 @@ class DataCache : public QObject
 {
     Q_OBJECT
     typedef QMap <QString, QPair <QString, QByteArray> > DataMap;
-    typedef QMap <QString, bool> PreserveMap;
     DataMap cache_map;
-    PreserveMap preserve_map;
 public:
     DataCache () {}
     ~DataCache () override {}
     void add (const QString &, const QString &, const QByteArray &);
     bool get (const QString &, QString &, QByteArray &);
-    bool preserve (const QString &);
-    bool unpreserve (const QString &);
-    bool isPreserved (const QString &);
-Q_SIGNALS:
-    void preserveRemoved (const QString &); // ready or canceled
 };
 
 class KMPLAYERCOMMON_EXPORT MediaObject : public QObject
@@ -206,6 +210,7 @@ protected:
 class KMPLAYERCOMMON_EXPORT MediaInfo : public QObject
 {
     Q_OBJECT
+    friend class DownloadScheduler;
 public:
     MediaInfo (Node *node, MediaManager::MediaType type);
     ~MediaInfo () override;
@@ -215,6 +220,8 @@ public:
     void clearData() KMPLAYERCOMMON_NO_EXPORT;
     QString mimetype() KMPLAYERCOMMON_NO_EXPORT;
     bool downloading() const KMPLAYERCOMMON_NO_EXPORT;
+    /* a prefetch waits for downloads that are needed now */
+    void setPrefetch (bool prefetch) KMPLAYERCOMMON_NO_EXPORT;
     void create ();
 
     QByteArray &rawData () { return data; }
@@ -224,22 +231,38 @@ public:
     QString mime;
     MediaManager::MediaType type;
 
-private Q_SLOTS:
-    void slotResult(KJob*) KMPLAYERCOMMON_NO_EXPORT;
-    void slotData(KIO::Job*, const QByteArray& qb) KMPLAYERCOMMON_NO_EXPORT;
-    void slotMimetype (KIO::Job* job, const QString& mimestr) KMPLAYERCOMMON_NO_EXPORT;
-    void cachePreserveRemoved(const QString&) KMPLAYERCOMMON_NO_EXPORT;
-
 private:
+    /* byte ranges in data of a playlist item, appended in batches */
+    struct PlaylistEntry {
+        int url;
+        int url_len;
+        int title;
+        int title_len;
+    };
+    void downloadResult (int error) KMPLAYERCOMMON_NO_EXPORT;
+    void downloadData (const QByteArray &qb) KMPLAYERCOMMON_NO_EXPORT;
+    void downloadMimetype (const QString &mimestr) KMPLAYERCOMMON_NO_EXPORT;
+    void sharedDownloadDone () KMPLAYERCOMMON_NO_EXPORT;
     void ready() KMPLAYERCOMMON_NO_EXPORT;
     bool readChildDoc() KMPLAYERCOMMON_NO_EXPORT;
+    void readPls (int pos) KMPLAYERCOMMON_NO_EXPORT;
+    void readM3u (int pos, bool extm3u) KMPLAYERCOMMON_NO_EXPORT;
+    void appendEntries (int count) KMPLAYERCOMMON_NO_EXPORT;
+    void clearEntries () KMPLAYERCOMMON_NO_EXPORT;
     void setMimetype(const QString&) KMPLAYERCOMMON_NO_EXPORT;
+    void timerEvent (QTimerEvent *e) override KMPLAYERCOMMON_NO_EXPORT;
 
     Node *node;
-    KIO::TransferJob *job;
+    QFile *mapped_file;
+    QVector <PlaylistEntry> entries;
+    int entries_pos;
+    int entries_update;
+    int entries_timer;
+    bool entries_pls;
     QString cross_domain;
     QString access_from;
-    bool preserve_wait;
+    bool wget_pending;
+    bool prefetch;
     bool check_access;
 };
 
@@ -308,6 +331,7 @@ public:
     IViewer *m_viewer;
     QString m_grab_file;
     int m_frame;
+    int start_position; // deci-seconds to seek to when playing starts
     Request request;
 
 protected:
@@ -345,6 +369,7 @@ struct ImageData
     short flags;
     bool has_alpha;
 private:
+    friend class ImageMedia; // renders svg into image in place
     QImage *image;
 #ifdef KMPLAYER_WITH_CAIRO
     cairo_surface_t *surface;
@@ -374,7 +399,8 @@ public:
     bool isEmpty () const;
     void render (const ISize &size);
     void sizes (SSize &size);
-    void updateRender ();
+    /* inline svg changed, changed is the element or null if unknown */
+    void updateRender (Node *changed=nullptr);
 
     ImageDataPtr cached_img;
 
@@ -389,13 +415,18 @@ protected:
 
 private:
     void setupImage (const QString &url);
+    bool svgBounds (QRectF &bounds) const;
 
     QByteArray data;
     QBuffer *buffer;
     QMovie *img_movie;
     QSvgRenderer *svg_renderer;
+    QByteArray svg_xml;           // what svg_renderer has loaded
+    unsigned int svg_xml_version; // Document::m_xml_version of svg_xml
+    QStringList svg_dirty_ids;    // changed elements since the last render
     int frame_nr;
     bool update_render;
+    bool svg_render_all;
     bool paused;
 };
 
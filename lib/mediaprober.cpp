@@ -0,0 +1,351 @@
+/*
+    This file belong to the KMPlayer project, a movie player plugin for Konqueror
+    SPDX-FileCopyrightText: 2026 The KMPlayer authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "config-kmplayer.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QThread>
+#include <QTimerEvent>
+#include <QUrl>
+
+#include "kmplayercommon_log.h"
+#include "mediaprober.h"
+
+using namespace KMPlayer;
+
+static const int probe_timeout = 15000; // ms, for a hanging backend
+static const int index_write_interval = 32; // results before saving the index
+static const quint32 index_magic = 0x4b4d5049; // 'KMPI'
+static const quint32 index_version = 1;
+
+namespace KMPlayer {
+
+QDataStream &operator << (QDataStream &out, const MediaProbe &p) {
+    out << qint32 (p.length) << qint32 (p.width) << qint32 (p.height);
+    out << p.aspect << p.audio_langs << p.subtitle_langs;
+    return out;
+}
+
+QDataStream &operator >> (QDataStream &in, MediaProbe &p) {
+    qint32 length, width, height;
+    in >> length >> width >> height;
+    in >> p.aspect >> p.audio_langs >> p.subtitle_langs;
+    p.length = length;
+    p.width = width;
+    p.height = height;
+    return in;
+}
+
+} // namespace
+
+static void applyProbe (Mrl *mrl, const MediaProbe &p) {
+    if (p.length > 0)
+        mrl->length = p.length;
+    if (mrl->size.isEmpty () && p.width > 0 && p.height > 0) {
+        mrl->size = SSize (p.width, p.height);
+        if (mrl->aspect < 0.001)
+            mrl->aspect = p.aspect > 0.001 ? p.aspect : 1.0 * p.width / p.height;
+    }
+}
+
+static bool parseLang (const QString &line, MediaProbe::LangList &list) {
+    int pos = line.indexOf ('_', 7);
+    if (pos > 0) {
+        int id = line.mid (7, pos - 7).toInt ();
+        pos = line.indexOf ('=', pos);
+        if (pos > 0) {
+            list.append (qMakePair (id, line.mid (pos + 1)));
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool parseIdentify (const QByteArray &output, MediaProbe &p) {
+    bool identified = false;
+    const QList <QByteArray> lines = output.split ('\n');
+    const QList <QByteArray>::const_iterator e = lines.constEnd ();
+    for (QList <QByteArray>::const_iterator i = lines.constBegin (); i != e; ++i) {
+        const QString out = QString::fromLocal8Bit (*i).trimmed ();
+        if (!out.startsWith ("ID_"))
+            continue;
+        const int pos = out.indexOf ('=');
+        if (pos < 0)
+            continue;
+        const QString val = out.mid (pos + 1);
+        bool ok;
+        if (out.startsWith ("ID_LENGTH")) {
+            double l = val.toDouble (&ok);
+            if (ok && l > 0) {
+                p.length = int (10 * l);
+                identified = true;
+            }
+        } else if (out.startsWith ("ID_VIDEO_WIDTH")) {
+            p.width = val.toInt ();
+            identified = true;
+        } else if (out.startsWith ("ID_VIDEO_HEIGHT")) {
+            p.height = val.toInt ();
+            identified = true;
+        } else if (out.startsWith ("ID_VIDEO_ASPECT")) {
+            QString a = val;
+            float f = a.toFloat (&ok);
+            if (!ok) {
+                a.replace (',', '.');
+                f = a.toFloat (&ok);
+            }
+            if (ok && f > 0.001)
+                p.aspect = f;
+        } else if (out.startsWith ("ID_AID_")) {
+            parseLang (out, p.audio_langs);
+        } else if (out.startsWith ("ID_SID_")) {
+            parseLang (out, p.subtitle_langs);
+        }
+    }
+    return identified;
+}
+
+MediaProber::MediaProber (QObject *parent, int max_workers)
+ : QObject (parent),
+   m_index_file (QStandardPaths::writableLocation (QStandardPaths::GenericCacheLocation) + "/kmplayer/mediaindex"),
+   m_program ("mplayer"),
+   m_last_tree_version (0),
+   m_max_workers (max_workers > 0 ? max_workers : qMax (1, QThread::idealThreadCount () / 2)),
+   m_dirty (0) {
+    readIndex ();
+}
+
+MediaProber::~MediaProber () {
+    clearQueue ();
+    const QList <Job *>::iterator e = m_running.end ();
+    for (QList <Job *>::iterator i = m_running.begin (); i != e; ++i) {
+        (*i)->process->disconnect (this);
+        delete (*i)->process; // kills the process
+        delete *i;
+    }
+    m_running.clear ();
+    if (m_dirty)
+        writeIndex ();
+}
+
+QString MediaProber::indexKey (const QString &url) const {
+    const QUrl u = QUrl::fromUserInput (url);
+    if (!u.isLocalFile ())
+        return QString ();
+    QFileInfo fi (u.toLocalFile ());
+    if (!fi.isFile ())
+        return QString ();
+    QByteArray key = u.url ().toUtf8 ();
+    key.append ('\n');
+    key.append (QByteArray::number (fi.lastModified ().toMSecsSinceEpoch ()));
+    key.append ('\n');
+    key.append (QByteArray::number (fi.size ()));
+    return QString::fromLatin1 (QCryptographicHash::hash (key, QCryptographicHash::Md5).toHex ());
+}
+
+bool MediaProber::lookup (const QString &url, MediaProbe &probe) const {
+    const QString key = indexKey (url);
+    if (key.isEmpty ())
+        return false;
+    QHash <QString, MediaProbe>::const_iterator i = m_index.constFind (key);
+    if (i == m_index.constEnd ())
+        return false;
+    probe = i.value ();
+    return true;
+}
+
+void MediaProber::probe (Node *root) {
+    if (!root)
+        return;
+    const unsigned int version = root->document ()->m_tree_version;
+    if (m_last_root.ptr () == root && m_last_tree_version == version)
+        return;
+    if (m_last_root.ptr () != root)
+        m_keys.clear ();
+    m_last_root = root;
+    m_last_tree_version = version;
+    probeTree (root);
+    startJobs ();
+}
+
+void MediaProber::probeTree (Node *node) {
+    Mrl *mrl = node->mrl ();
+    if (mrl == node && !mrl->length && !mrl->src.isEmpty () &&
+            node->isPlayable ()) {
+        const QString url = mrl->absolutePath ();
+        // the stat and hash are done once per url for a playlist, as this
+        // runs on every change of its tree
+        QHash <QString, QString>::const_iterator k = m_keys.constFind (url);
+        if (k == m_keys.constEnd ())
+            k = m_keys.insert (url, indexKey (url));
+        const QString key = k.value ();
+        if (!key.isEmpty ()) {
+            QHash <QString, MediaProbe>::const_iterator i = m_index.constFind (key);
+            if (i != m_index.constEnd ()) {
+                applyProbe (mrl, i.value ());
+            } else if (!m_requested.contains (key)) {
+                m_requested.insert (key);
+                Job *job = new Job;
+                job->node = node;
+                job->url = url;
+                job->key = key;
+                job->process = nullptr;
+                job->timer = 0;
+                m_queue.append (job);
+            }
+        }
+    }
+    for (Node *c = node->firstChild (); c; c = c->nextSibling ())
+        probeTree (c);
+}
+
+void MediaProber::clearQueue () {
+    const QList <Job *>::iterator e = m_queue.end ();
+    for (QList <Job *>::iterator i = m_queue.begin (); i != e; ++i) {
+        m_requested.remove ((*i)->key);
+        delete *i;
+    }
+    m_queue.clear ();
+}
+
+void MediaProber::startJobs () {
+    while (m_running.size () < m_max_workers && !m_queue.isEmpty ()) {
+        Job *job = m_queue.takeFirst ();
+        if (!job->node) { // playlist is gone meanwhile
+            m_requested.remove (job->key);
+            delete job;
+            continue;
+        }
+        QStringList args;
+        args << "-identify" << "-frames" << "0";
+        args << "-vo" << "null" << "-ao" << "null" << "-nosound" << "-quiet";
+        args << QUrl::fromUserInput (job->url).toLocalFile ();
+        job->process = new QProcess (this);
+        job->process->setStandardErrorFile (QProcess::nullDevice ());
+        connect (job->process, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished),
+                this, &MediaProber::workerFinished);
+        connect (job->process, &QProcess::errorOccurred,
+                this, &MediaProber::workerError);
+        job->timer = startTimer (probe_timeout);
+        m_running.append (job);
+        job->process->start (m_program, args);
+    }
+}
+
+MediaProber::Job *MediaProber::runningJob (QObject *process) const {
+    const QList <Job *>::const_iterator e = m_running.constEnd ();
+    for (QList <Job *>::const_iterator i = m_running.constBegin (); i != e; ++i)
+        if ((*i)->process == process)
+            return *i;
+    return nullptr;
+}
+
+void MediaProber::finishJob (Job *job, bool ok) {
+    m_running.removeAll (job);
+    m_requested.remove (job->key);
+    if (job->timer)
+        killTimer (job->timer);
+    MediaProbe result;
+    if (job->process) {
+        if (ok)
+            ok = parseIdentify (job->process->readAllStandardOutput (), result);
+        job->process->disconnect (this);
+        job->process->deleteLater ();
+    }
+    if (!ok)
+        qCDebug(LOG_KMPLAYER_COMMON) << "MediaProber: failed to identify " << job->url;
+    // failures are stored as an empty probe, so these aren't retried
+    m_index.insert (job->key, result);
+    if (++m_dirty >= index_write_interval)
+        writeIndex ();
+    Mrl *mrl = job->node ? job->node->mrl () : nullptr;
+    delete job;
+    if (mrl && ok) {
+        applyProbe (mrl, result);
+        Q_EMIT probed (mrl);
+    }
+    startJobs ();
+}
+
+void MediaProber::workerFinished (int, QProcess::ExitStatus status) {
+    Job *job = runningJob (sender ());
+    if (job)
+        finishJob (job, QProcess::NormalExit == status);
+}
+
+void MediaProber::workerError (QProcess::ProcessError err) {
+    if (QProcess::FailedToStart == err) { // no finished() signal follows
+        Job *job = runningJob (sender ());
+        if (job) {
+            qCWarning(LOG_KMPLAYER_COMMON) << "MediaProber: failed to start " << m_program;
+            job->process->disconnect (this);
+            job->process->deleteLater ();
+            job->process = nullptr;
+            // don't mark the files as unidentifiable, backend is missing
+            m_running.removeAll (job);
+            m_requested.remove (job->key);
+            if (job->timer)
+                killTimer (job->timer);
+            delete job;
+            clearQueue ();
+        }
+    }
+}
+
+void MediaProber::timerEvent (QTimerEvent *e) {
+    const QList <Job *>::const_iterator end = m_running.constEnd ();
+    for (QList <Job *>::const_iterator i = m_running.constBegin (); i != end; ++i)
+        if ((*i)->timer == e->timerId ()) {
+            killTimer ((*i)->timer);
+            (*i)->timer = 0;
+            qCDebug(LOG_KMPLAYER_COMMON) << "MediaProber: timeout identifying " << (*i)->url;
+            (*i)->process->kill (); // finished() follows with CrashExit
+            return;
+        }
+    QObject::timerEvent (e);
+}
+
+void MediaProber::readIndex () {
+    QFile file (m_index_file);
+    if (!file.open (QIODevice::ReadOnly))
+        return;
+    QDataStream in (&file);
+    in.setVersion (QDataStream::Qt_5_0);
+    quint32 magic, version;
+    in >> magic >> version;
+    if (magic != index_magic || version != index_version) {
+        qCDebug(LOG_KMPLAYER_COMMON) << "MediaProber: ignoring index " << m_index_file;
+        return;
+    }
+    in >> m_index;
+    if (in.status () != QDataStream::Ok) {
+        qCWarning(LOG_KMPLAYER_COMMON) << "MediaProber: corrupt index " << m_index_file;
+        m_index.clear ();
+    }
+}
+
+void MediaProber::writeIndex () {
+    m_dirty = 0;
+    QDir ().mkpath (QFileInfo (m_index_file).absolutePath ());
+    QSaveFile file (m_index_file);
+    if (!file.open (QIODevice::WriteOnly)) {
+        qCWarning(LOG_KMPLAYER_COMMON) << "MediaProber: can't write " << m_index_file;
+        return;
+    }
+    QDataStream out (&file);
+    out.setVersion (QDataStream::Qt_5_0);
+    out << index_magic << index_version << m_index;
+    file.commit ();
+}
+
+#include "moc_mediaprober.cpp"
@@ -0,0 +1,109 @@
+/*
+    This file belong to the KMPlayer project, a movie player plugin for Konqueror
+    SPDX-FileCopyrightText: 2026 The KMPlayer authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#ifndef _KMPLAYER_MEDIAPROBER_H_
+#define _KMPLAYER_MEDIAPROBER_H_
+
+#include "config-kmplayer.h"
+
+#include <QObject>
+#include <QString>
+#include <QList>
+#include <QPair>
+#include <QHash>
+#include <QSet>
+#include <QProcess>
+
+#include "kmplayercommon_export.h"
+#include "kmplayerplaylist.h"
+
+class QDataStream;
+
+namespace KMPlayer {
+
+/*
+ * What is known about a media file before playing it
+ */
+struct KMPLAYERCOMMON_EXPORT MediaProbe
+{
+    typedef QList <QPair <int, QString> > LangList;
+
+    MediaProbe () : length (0), width (0), height (0), aspect (0.0) {}
+
+    int length; // deci-seconds
+    int width;
+    int height;
+    float aspect;
+    LangList audio_langs;
+    LangList subtitle_langs;
+};
+
+/*
+ * Identifies the local media files of playlists in the background with a
+ * bounded pool of 'mplayer -identify -frames 0' runs. The results are kept
+ * in a persistent index keyed by url, mtime and size and filled into the
+ * Mrl's, so lengths and dimensions are known before these are played.
+ */
+class KMPLAYERCOMMON_EXPORT MediaProber : public QObject
+{
+    Q_OBJECT
+public:
+    MediaProber (QObject *parent, int max_workers = 0);
+    ~MediaProber () override;
+
+    /* fill in or queue all playable items of the tree of root */
+    void probe (Node *root);
+    /* returns false if url is not a local file or not yet probed */
+    bool lookup (const QString &url, MediaProbe &probe) const;
+    /* drop all queued probes, running workers are finished */
+    void clearQueue ();
+    void setProgram (const QString &exe) { m_program = exe; }
+    int pending () const { return m_queue.size () + m_running.size (); }
+
+Q_SIGNALS:
+    void probed (KMPlayer::Mrl *mrl);
+
+private Q_SLOTS:
+    void workerFinished (int, QProcess::ExitStatus) KMPLAYERCOMMON_NO_EXPORT;
+    void workerError (QProcess::ProcessError) KMPLAYERCOMMON_NO_EXPORT;
+
+private:
+    struct Job {
+        NodePtrW node;
+        QString url;
+        QString key;
+        QProcess *process;
+        int timer;
+    };
+    QString indexKey (const QString &url) const KMPLAYERCOMMON_NO_EXPORT;
+    void probeTree (Node *node) KMPLAYERCOMMON_NO_EXPORT;
+    void startJobs () KMPLAYERCOMMON_NO_EXPORT;
+    void finishJob (Job *job, bool ok) KMPLAYERCOMMON_NO_EXPORT;
+    Job *runningJob (QObject *process) const KMPLAYERCOMMON_NO_EXPORT;
+    void readIndex () KMPLAYERCOMMON_NO_EXPORT;
+    void writeIndex () KMPLAYERCOMMON_NO_EXPORT;
+    void timerEvent (QTimerEvent *e) override KMPLAYERCOMMON_NO_EXPORT;
+
+    QList <Job *> m_queue;
+    QList <Job *> m_running;
+    QSet <QString> m_requested;
+    QHash <QString, QString> m_keys; // index key of each url of m_last_root
+    QHash <QString, MediaProbe> m_index;
+    QString m_index_file;
+    QString m_program;
+    NodePtrW m_last_root;
+    unsigned int m_last_tree_version;
+    int m_max_workers;
+    int m_dirty;
+};
+
+QDataStream &operator << (QDataStream &out, const MediaProbe &probe);
+QDataStream &operator >> (QDataStream &in, MediaProbe &probe);
+
+} // namespace
+
+#endif
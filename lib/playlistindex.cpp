@@ -0,0 +1,130 @@
+/*
+    This file belong to the KMPlayer project, a movie player plugin for Konqueror
+    SPDX-FileCopyrightText: 2026 The KMPlayer authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "config-kmplayer.h"
+
+#include <QRegExp>
+
+#include "kmplayercommon_log.h"
+#include "playlistindex.h"
+
+using namespace KMPlayer;
+
+static quint64 trigram (const QChar *s) {
+    return (quint64 (s[0].unicode ()) << 32) |
+        (quint64 (s[1].unicode ()) << 16) | s[2].unicode ();
+}
+
+PlaylistIndex::PlaylistIndex ()
+ : m_tree_version (0),
+   m_all_nodes (false) {}
+
+bool PlaylistIndex::update (Node *root, bool all_nodes) {
+    if (!root) {
+        m_entries.clear ();
+        m_postings.clear ();
+        m_node_entries.clear ();
+        m_root = nullptr;
+        return true;
+    }
+    const unsigned int version = root->document ()->m_tree_version;
+    if (m_root.ptr () == root && m_all_nodes == all_nodes &&
+            m_tree_version == version)
+        return false;
+    m_entries.clear ();
+    m_postings.clear ();
+    m_node_entries.clear ();
+    m_root = root;
+    m_all_nodes = all_nodes;
+    m_tree_version = version;
+    add (root);
+    qCDebug(LOG_KMPLAYER_COMMON) << "PlaylistIndex: " << m_entries.size () << " entries " << m_postings.size () << " trigrams";
+    return true;
+}
+
+void PlaylistIndex::addEntry (Node *n, Attribute *a, const QString &text) {
+    const int id = m_entries.size ();
+    Entry entry;
+    entry.node = n;
+    entry.attribute = a;
+    entry.text = text;
+    m_entries.append (entry);
+    if (!a && !m_node_entries.contains (n))
+        m_node_entries.insert (n, id);
+    const QString folded = text.toLower ();
+    const QChar *s = folded.constData ();
+    for (int i = 0; i + 3 <= folded.size (); ++i) {
+        QVector <int> &posting = m_postings[trigram (s + i)];
+        if (posting.isEmpty () || posting.last () != id)
+            posting.append (id);
+    }
+}
+
+void PlaylistIndex::add (Node *n) {
+    PlaylistRole *title = (PlaylistRole *) n->role (RolePlaylist);
+    if (m_all_nodes || title) {
+        QString text = title && !m_all_nodes ? title->caption () : QString ();
+        if (text.isEmpty ())
+            text = id_node_text == n->id ? n->nodeValue () : n->nodeName ();
+        Mrl *mrl = n->mrl ();
+        if (mrl && mrl == n && !mrl->src.isEmpty () && mrl->src != text)
+            text += QChar ('\n') + mrl->src;
+        addEntry (n, nullptr, text);
+        if (m_all_nodes && n->isElementNode ())
+            for (Attribute *a = static_cast <Element *> (n)->attributes ().first (); a; a = a->nextSibling ())
+                addEntry (n, a, a->name ().toString () + QChar ('=') + a->value ());
+    }
+    for (Node *c = n->firstChild (); c; c = c->nextSibling ())
+        add (c);
+}
+
+bool PlaylistIndex::matches (const QString &text, const QString &pattern, int options) const {
+    const Qt::CaseSensitivity cs = options & CaseSensitive
+        ? Qt::CaseSensitive : Qt::CaseInsensitive;
+    if (options & (WholeWords | RegularExpression)) {
+        QRegExp re (options & RegularExpression
+                ? pattern : QString ("\\b%1\\b").arg (QRegExp::escape (pattern)), cs);
+        return re.indexIn (text) > -1;
+    }
+    return text.contains (pattern, cs);
+}
+
+QVector <int> PlaylistIndex::find (const QString &pattern, int options) const {
+    QVector <int> result;
+    if (pattern.isEmpty ())
+        return result;
+    if (options & RegularExpression || pattern.size () < 3) {
+        for (int i = 0; i < m_entries.size (); ++i)
+            if (matches (m_entries[i].text, pattern, options))
+                result.append (i);
+        return result;
+    }
+    // candidates have all trigrams of the pattern, start with the rarest
+    const QString folded = pattern.toLower ();
+    const QChar *s = folded.constData ();
+    QVector <const QVector <int> *> postings;
+    for (int i = 0; i + 3 <= folded.size (); ++i) {
+        QHash <quint64, QVector <int> >::const_iterator it = m_postings.constFind (trigram (s + i));
+        if (it == m_postings.constEnd ())
+            return result;
+        postings.append (&it.value ());
+    }
+    int rarest = 0;
+    for (int i = 1; i < postings.size (); ++i)
+        if (postings[i]->size () < postings[rarest]->size ())
+            rarest = i;
+    const QVector <int> &candidates = *postings[rarest];
+    const QVector <int>::const_iterator e = candidates.constEnd ();
+    for (QVector <int>::const_iterator i = candidates.constBegin (); i != e; ++i)
+        if (matches (m_entries[*i].text, pattern, options))
+            result.append (*i);
+    return result;
+}
+
+int PlaylistIndex::entryAt (Node *n) const {
+    return m_node_entries.value (n, -1);
+}
@@ -0,0 +1,70 @@
+/*
+    This file belong to the KMPlayer project, a movie player plugin for Konqueror
+    SPDX-FileCopyrightText: 2026 The KMPlayer authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#ifndef _KMPLAYER_PLAYLISTINDEX_H_
+#define _KMPLAYER_PLAYLISTINDEX_H_
+
+#include "config-kmplayer.h"
+
+#include <QString>
+#include <QVector>
+#include <QHash>
+
+#include "kmplayercommon_export.h"
+#include "kmplayerplaylist.h"
+
+namespace KMPlayer {
+
+/*
+ * Search index over a playlist tree. Each shown node is an entry with its
+ * caption and url, with all nodes shown each attribute is one too. Entries
+ * are in document order and looked up through the trigrams of their lower
+ * cased text. The index is rebuilt when the tree version changed, or
+ * after invalidate() as captions change without a new tree version.
+ */
+class KMPLAYERCOMMON_EXPORT PlaylistIndex
+{
+public:
+    enum Options {
+        CaseSensitive = 0x01, WholeWords = 0x02, RegularExpression = 0x04
+    };
+    struct Entry {
+        NodePtrW node;
+        AttributePtrW attribute;
+        QString text;
+    };
+
+    PlaylistIndex ();
+
+    /* (re)builds the index if root, the mode or the tree changed */
+    bool update (Node *root, bool all_nodes);
+    /* rebuild on the next update */
+    void invalidate () { m_root = nullptr; }
+    /* matching entries, in document order */
+    QVector <int> find (const QString &pattern, int options) const;
+    /* entry of node n, or -1 */
+    int entryAt (Node *n) const;
+
+    const Entry &entry (int i) const { return m_entries[i]; }
+    int count () const { return m_entries.size (); }
+
+private:
+    void add (Node *n) KMPLAYERCOMMON_NO_EXPORT;
+    void addEntry (Node *n, Attribute *a, const QString &text) KMPLAYERCOMMON_NO_EXPORT;
+    bool matches (const QString &text, const QString &pattern, int options) const KMPLAYERCOMMON_NO_EXPORT;
+
+    QVector <Entry> m_entries;
+    QHash <quint64, QVector <int> > m_postings;
+    QHash <Node *, int> m_node_entries;
+    NodePtrW m_root;
+    unsigned int m_tree_version;
+    bool m_all_nodes;
+};
+
+} // namespace
+
+#endif
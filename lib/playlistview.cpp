@@ -4,6 +4,7 @@
     SPDX-License-Identifier: LGPL-2.0-only
 */
 
+#include <algorithm>
 #include <cstdio>
 
 #include "config-kmplayer.h"
@@ -24,6 +25,8 @@
 #include <QList>
 #include <QItemSelectionModel>
 #include <QMimeData>
+#include <QLineEdit>
+#include <QTimerEvent>
 
 #include <KIconLoader>
 #include <KStandardAction>
@@ -34,12 +37,16 @@
 
 #include "kmplayercommon_log.h"
 #include "playlistview.h"
+#include "playlistindex.h"
 #include "playmodel.h"
 #include "kmplayerview.h"
 #include "kmplayercontrolpanel.h"
 
 using namespace KMPlayer;
 
+static const int filter_delay = 250; // ms after the last key press
+static const int filter_expand_limit = 50; // matches shown expanded
+
 namespace {
 
 class ItemDelegate : public QAbstractItemDelegate
@@ -95,8 +102,12 @@ PlayListView::PlayListView (QWidget *, View *view, KActionCollection * ac)
  : //QTreeView (parent),
    m_view (view),
    m_find_dialog (nullptr),
+   m_filter_edit (nullptr),
    m_active_color (30, 0, 255),
    last_drag_tree_id (0),
+   current_find_tree_id (0),
+   m_find_pos (-1),
+   m_filter_timer (0),
    m_ignore_expanded (false) {
     setHeaderHidden (true);
     setSortingEnabled (false);
@@ -121,6 +132,15 @@ PlayListView::PlayListView (QWidget *, View *view, KActionCollection * ac)
     m_find = KStandardAction::find (this, &PlayListView::slotFind, this);
     m_find_next = KStandardAction::findNext (this, &PlayListView::slotFindNext, this);
     m_find_next->setEnabled (false);
+    m_filter = new QAction (QIcon::fromTheme ("view-filter"), i18n ("&Filter"), this);
+    m_filter->setCheckable (true);
+    connect (m_filter, &QAction::triggered, this, &PlayListView::toggleFilter);
+    m_filter_edit = new QLineEdit (this);
+    m_filter_edit->setPlaceholderText (i18n ("Filter"));
+    m_filter_edit->setClearButtonEnabled (true);
+    m_filter_edit->hide ();
+    connect (m_filter_edit, &QLineEdit::textChanged,
+             this, &PlayListView::filterChanged);
     m_edit_playlist_item = ac->addAction ("edit_playlist_item");
     m_edit_playlist_item->setText (i18n ("Edit &item"));
     connect (m_edit_playlist_item, &QAction::triggered,
@@ -130,6 +150,7 @@ PlayListView::PlayListView (QWidget *, View *view, KActionCollection * ac)
 }
 
 PlayListView::~PlayListView () {
+    qDeleteAll (m_indexes);
 }
 
 void PlayListView::paintCell (const QAbstractItemDelegate *def,
@@ -183,6 +204,13 @@ void PlayListView::modelUpdated (const QModelIndex& r, const QModelIndex& i, boo
     }
     m_find_next->setEnabled (!!m_current_find_elm);
     TopPlayItem *ti = static_cast<TopPlayItem*>(playModel()->itemFromIndex(r));
+    // captions may have changed without a tree change
+    PlaylistIndex *index = m_indexes.value (ti->id);
+    if (index)
+        index->invalidate ();
+    // a growing list is updated often, filter at most once per delay
+    if (!m_filter_text.isEmpty () && !m_filter_timer)
+        m_filter_timer = startTimer (filter_delay);
     if (!ti->have_dark_nodes && ti->show_all_nodes && !m_view->editMode())
         toggleShowAllNodes (); // redo, because the user can't change it anymore
     m_ignore_expanded = false;
@@ -257,6 +285,9 @@ void PlayListView::contextMenuEvent (QContextMenuEvent *event)
             m_itemmenu->addSeparator ();
             m_find->setVisible (true);
             m_find_next->setVisible (true);
+            m_itemmenu->addAction (m_find);
+            m_itemmenu->addAction (m_find_next);
+            m_itemmenu->addAction (m_filter);
             Q_EMIT prepareMenu (item, m_itemmenu);
             m_itemmenu->exec (event->globalPos ());
         }
@@ -425,168 +456,198 @@ void PlayListView::slotCurrentItemChanged (QModelIndex /*cur*/, QModelIndex)
     //setItemsRenameable (ri && (ri->item_flagsTreeEdit) && ri != qitem);
 }
 
+PlaylistIndex *PlayListView::playlistIndex (TopPlayItem *ri) {
+    PlaylistIndex *&index = m_indexes[ri->id];
+    if (!index)
+        index = new PlaylistIndex;
+    index->update (ri->node.ptr (), ri->show_all_nodes);
+    return index;
+}
+
+int PlayListView::findOptions () const {
+    const long opt = m_find_dialog->options ();
+    int options = 0;
+    if (opt & KFind::CaseSensitive)
+        options |= PlaylistIndex::CaseSensitive;
+    if (opt & KFind::WholeWordsOnly)
+        options |= PlaylistIndex::WholeWords;
+    if (opt & KFind::RegularExpression)
+        options |= PlaylistIndex::RegularExpression;
+    return options;
+}
+
+/* searches the index and positions in front of the match next to cursor */
+void PlayListView::findFrom (PlaylistIndex *index, Node *cursor) {
+    m_find_results = index->find (m_find_dialog->pattern (), findOptions ());
+    const int at = cursor ? index->entryAt (cursor) : -1;
+    if (m_find_dialog->options () & KFind::FindBackwards)
+        m_find_pos = std::lower_bound (m_find_results.begin (),
+                m_find_results.end (), at) - m_find_results.begin ();
+    else
+        m_find_pos = std::upper_bound (m_find_results.begin (),
+                m_find_results.end (), at) - m_find_results.begin () - 1;
+}
+
 void PlayListView::slotFind () {
-    /*m_current_find_elm = 0L;
     if (!m_find_dialog) {
         m_find_dialog = new KFindDialog (this, KFind::CaseSensitive);
         m_find_dialog->setHasSelection (false);
-        connect(m_find_dialog, SIGNAL(okClicked ()), this, SLOT(slotFindOk ()));
-    } else
+        connect (m_find_dialog, &KFindDialog::okClicked,
+                 this, &PlayListView::slotFindOk);
+    } else {
         m_find_dialog->setPattern (QString ());
-    m_find_dialog->show ();*/
-}
-
-/*static QTreeWidgetItem * findNodeInTree (NodePtr n, QTreeWidgetItem * item) {
-    //qCDebug(LOG_KMPLAYER_COMMON) << "item:" << item->text (0) << " n:" << (n ? n->nodeName () : "null" );
-    PlayItem * pi = static_cast <PlayItem *> (item);
-    if (!n || !pi->node)
-        return 0L;
-    if (n == pi->node)
-        return item;
-    for (int i = 0; i < item->childCount (); ++i) {
-        //qCDebug(LOG_KMPLAYER_COMMON) << "ci:" << ci->text (0) << " n:" << n->nodeName ();
-        QTreeWidgetItem *vi = findNodeInTree (n, item->child (i));
-        if (vi)
-            return vi;
     }
-    return 0L;
-
-}*/
+    m_find_dialog->show ();
+}
 
 void PlayListView::slotFindOk () {
-    /*if (!m_find_dialog)
+    if (!m_find_dialog)
         return;
     m_find_dialog->hide ();
-    long opt = m_find_dialog->options ();
-    current_find_tree_id = 0;
-    if (opt & KFind::FromCursor && currentItem ()) {
-        PlayItem * lvi = selectedItem ();
-        if (lvi && lvi->node) {
-             m_current_find_elm = lvi->node;
-             current_find_tree_id = rootItem (lvi)->id;
-        } else if (lvi && lvi->attribute) {
-            PlayItem*pi=static_cast<PlayItem*>(currentItem()->parent());
-            if (pi) {
-                m_current_find_attr = lvi->attribute;
-                m_current_find_elm = pi->node;
-            }
-        }
-    } else if (!(opt & KFind::FindIncremental))
-        m_current_find_elm = 0L;
-    if (!m_current_find_elm && topLevelItemCount ())
-        m_current_find_elm = static_cast <PlayItem*>(topLevelItem(0))->node;
-    if (m_current_find_elm)
-        slotFindNext ();*/
+    m_current_find_elm = nullptr;
+    m_current_find_attr = nullptr;
+    m_find_results.clear ();
+    PlayItem *item = selectedItem ();
+    TopPlayItem *ri = item ? item->rootItem () : rootItem (0);
+    if (!ri || !ri->node)
+        return;
+    current_find_tree_id = ri->id;
+    Node *cursor = nullptr;
+    if (m_find_dialog->options () & KFind::FromCursor && item)
+        cursor = item->node ? item->node.ptr () : item->parent ()->node.ptr ();
+    findFrom (playlistIndex (ri), cursor);
+    slotFindNext ();
 }
 
-/* A bit tricky, but between the find's PlayItems might be gone, so
- * try to match on the generated tree following the source's document tree
+/* The matches are positions in the index, which is rebuilt when the tree
+ * changed. Then search again, continuing from the last match.
  */
 void PlayListView::slotFindNext () {
-    /*if (!m_find_dialog)
+    TopPlayItem *ri = rootItem (current_find_tree_id);
+    if (!m_find_dialog || !ri || !ri->node) {
+        m_find_next->setEnabled (false);
         return;
-    QString str = m_find_dialog->pattern();
-    if (!m_current_find_elm || str.isEmpty ())
+    }
+    PlaylistIndex *index = m_indexes.value (ri->id);
+    if (!index || index->update (ri->node.ptr (), ri->show_all_nodes))
+        findFrom (playlistIndex (ri), m_current_find_elm.ptr ());
+    const int count = m_find_results.size ();
+    if (!count) {
+        m_current_find_elm = nullptr;
+        m_current_find_attr = nullptr;
+        m_find_next->setEnabled (false);
         return;
-    long opt = m_find_dialog->options ();
-    QRegExp regexp;
-    if (opt & KFind::RegularExpression)
-        regexp = QRegExp (str);
-    bool cs = (opt & KFind::CaseSensitive);
-    bool found = false;
-    Node *node = NULL, *n = m_current_find_elm.ptr ();
-    TopPlayItem * ri = rootItem (current_find_tree_id);
-    while (!found && n) {
-        if (ri->show_all_nodes || n->role (RolePlaylist)) {
-            bool elm = n->isElementNode ();
-            QString val = n->nodeName ();
-            if (elm && !ri->show_all_nodes) {
-                Mrl * mrl = n->mrl ();
-                if (mrl) {
-                    if (mrl->title.isEmpty ()) {
-                        if (!mrl->src.isEmpty())
-                            val = KURL(mrl->src).prettyUrl();
-                    } else
-                        val = mrl->title;
-                }
-            } else if (!elm)
-                val = n->nodeValue ();
-            if (((opt & KFind::RegularExpression) &&
-                    val.find (regexp, 0) > -1) ||
-                    (!(opt & KFind::RegularExpression) &&
-                     val.find (str, 0, cs) > -1)) {
-                node = n;
-                m_current_find_attr = 0L;
-                found = true;
-            } else if (elm && ri->show_all_nodes) {
-                for (Attribute *a = static_cast <Element *> (n)->attributes ().first (); a; a = a->nextSibling ()) {
-                    QString attr = a->name ().toString ();
-                    if (((opt & KFind::RegularExpression) &&
-                                (attr.find (regexp, 0) || a->value ().find (regexp, 0) > -1)) ||
-                                (!(opt & KFind::RegularExpression) &&
-                                 (attr.find (str, 0, cs) > -1 || a->value ().find (str, 0, cs) > -1))) {
-                        node = n;
-                        m_current_find_attr = a;
-                        found = true;
-                        break;
-                    }
-                }
-            }
-        }
-        if (n) { //set pointer to next
-            if (opt & KFind::FindBackwards) {
-                if (n->lastChild ()) {
-                    n = n->lastChild ();
-                } else if (n->previousSibling ()) {
-                    n = n->previousSibling ();
-                } else {
-                    for (n = n->parentNode (); n; n = n->parentNode ())
-                        if (n->previousSibling ()) {
-                            n = n->previousSibling ();
-                            break;
-                        }
-                    while (!n && current_find_tree_id > 0) {
-                        ri = rootItem (--current_find_tree_id);
-                        if (ri)
-                            n = ri->node;
-                    }
-                }
-            } else {
-                if (n->firstChild ()) {
-                    n = n->firstChild ();
-                } else if (n->nextSibling ()) {
-                    n = n->nextSibling ();
-                } else {
-                    for (n = n->parentNode (); n; n = n->parentNode ())
-                        if (n->nextSibling ()) {
-                            n = n->nextSibling ();
-                            break;
-                        }
-                    while (!n) {
-                        ri = rootItem (++current_find_tree_id);
-                        if (!ri)
-                            break;
-                        n = ri->node;
-                    }
-                }
+    }
+    if (m_find_dialog->options () & KFind::FindBackwards)
+        m_find_pos = m_find_pos <= 0 ? count - 1 : m_find_pos - 1;
+    else
+        m_find_pos = (m_find_pos + 1) % count;
+    const PlaylistIndex::Entry &entry = playlistIndex (ri)->entry (m_find_results[m_find_pos]);
+    m_current_find_elm = entry.node;
+    m_current_find_attr = entry.attribute;
+    const QModelIndex i = playModel ()->indexFromNode (ri, entry.node.ptr ());
+    if (i.isValid ()) {
+        setCurrentIndex (i);
+        scrollTo (i);
+    }
+    m_find_next->setEnabled (true);
+}
+
+void PlayListView::toggleFilter () {
+    if (m_filter_edit->isVisible ()) {
+        m_filter_edit->hide ();
+        m_filter_edit->clear ();
+        setFocus ();
+    } else {
+        m_filter_edit->show ();
+        m_filter_edit->setFocus ();
+    }
+    m_filter->setChecked (m_filter_edit->isVisible ());
+    updateGeometries ();
+}
+
+void PlayListView::filterChanged (const QString &text) {
+    m_filter_text = text;
+    if (m_filter_timer)
+        killTimer (m_filter_timer);
+    m_filter_timer = startTimer (filter_delay);
+}
+
+void PlayListView::timerEvent (QTimerEvent *e) {
+    if (e->timerId () == m_filter_timer) {
+        killTimer (m_filter_timer);
+        m_filter_timer = 0;
+        applyFilter ();
+        return;
+    }
+    QTreeView::timerEvent (e);
+}
+
+void PlayListView::updateGeometries () {
+    QTreeView::updateGeometries (); // resets the viewport margins
+    if (m_filter_edit && m_filter_edit->isVisible ()) {
+        const int h = m_filter_edit->sizeHint ().height ();
+        setViewportMargins (0, h, 0, 0);
+        const QRect r = viewport ()->geometry ();
+        m_filter_edit->setGeometry (r.x (), r.y () - h, r.width (), h);
+    }
+}
+
+/* hides the rows of nodes without a match in their subtree */
+void PlayListView::applyFilter () {
+    m_filter_keep.clear ();
+    PlayItem *root = playModel ()->rootItem ();
+    for (int i = 0; i < root->childCount (); ++i) {
+        TopPlayItem *ri = static_cast <TopPlayItem *> (root->child (i));
+        if (m_filter_text.isEmpty () || !ri->node)
+            continue;
+        PlaylistIndex *index = playlistIndex (ri);
+        const QVector <int> matches = index->find (m_filter_text, 0);
+        const QVector <int>::const_iterator e = matches.constEnd ();
+        for (QVector <int>::const_iterator m = matches.constBegin (); m != e; ++m)
+            for (Node *n = index->entry (*m).node.ptr (); n && !filterKeeps (n); n = n->parentNode ())
+                m_filter_keep.insert (n, NodePtrW (n));
+        if (matches.size () <= filter_expand_limit)
+            for (QVector <int>::const_iterator m = matches.constBegin (); m != e; ++m) {
+                const QModelIndex mi = playModel ()->indexFromNode (ri, index->entry (*m).node.ptr ());
+                for (QModelIndex p = mi.parent (); p.isValid (); p = p.parent ())
+                    setExpanded (p, true);
             }
-        }
     }
-    m_current_find_elm = n;
-    qCDebug(LOG_KMPLAYER_COMMON) << " search for " << str << "=" << (node ? node->nodeName () : "not found") << " next:" << (n ? n->nodeName () : " not found");
-    if (found) {
-        QTreeWidgetItem *fc = findNodeInTree (node, ri);
-        if (!fc) {
-            m_current_find_elm = 0L;
-            qCDebug(LOG_KMPLAYER_COMMON) << "node not found in tree tree:" << ri->id;
-        } else {
-            fc->setSelected (true);
-            if (m_current_find_attr && fc->childCount () && fc->child (0)->childCount ())
-                scrollToItem (fc->child (0)->child (0));
-            scrollToItem (fc);
-        }
+    for (int i = 0; i < root->childCount (); ++i)
+        filterRows (playModel ()->indexFromItem (root->child (i)));
+}
+
+void PlayListView::filterRows (const QModelIndex &parent) {
+    PlayItem *item = playModel ()->itemFromIndex (parent);
+    for (int i = 0; i < item->childCount (); ++i) {
+        PlayItem *child = item->child (i);
+        const bool hide = !m_filter_text.isEmpty () && child->node &&
+            !filterKeeps (child->node.ptr ());
+        setRowHidden (i, parent, hide);
+        if (!hide && child->childCount ())
+            filterRows (playModel ()->index (i, 0, parent));
+    }
+}
+
+bool PlayListView::filterKeeps (Node *n) const {
+    // a freed node's address may be used again by a new one
+    const QHash <Node *, NodePtrW>::const_iterator i = m_filter_keep.constFind (n);
+    return i != m_filter_keep.constEnd () && i.value ().ptr () == n;
+}
+
+void PlayListView::rowsInserted (const QModelIndex &parent, int start, int end) {
+    QTreeView::rowsInserted (parent, start, end);
+    if (m_filter_text.isEmpty () || !parent.isValid ())
+        return;
+    PlayItem *item = playModel ()->itemFromIndex (parent);
+    for (int i = start; i <= end && i < item->childCount (); ++i) {
+        PlayItem *child = item->child (i);
+        const bool hide = child->node && !filterKeeps (child->node.ptr ());
+        setRowHidden (i, parent, hide);
+        if (!hide && child->childCount ())
+            filterRows (playModel ()->index (i, 0, parent));
     }
-    m_find_next->setEnabled (!!m_current_find_elm);*/
 }
 
 #include "moc_playlistview.cpp"
@@ -11,6 +11,8 @@
 
 #include <QTreeView>
 #include <QModelIndex>
+#include <QHash>
+#include <QVector>
 
 #include "kmplayerplaylist.h"
 
@@ -20,6 +22,7 @@ class QMenu;
 class QDropEvent;
 class QStyleOptionViewItem;
 class QAction;
+class QLineEdit;
 class KActionCollection;
 class KFindDialog;
 
@@ -29,6 +32,7 @@ class View;
 class PlayItem;
 class PlayModel;
 class TopPlayItem;
+class PlaylistIndex;
 
 /*
  * The playlist GUI
@@ -64,6 +68,10 @@ protected:
     void dragMoveEvent(QDragMoveEvent* event) override KMPLAYERCOMMON_NO_EXPORT;
     void drawBranches(QPainter*, const QRect&, const QModelIndex&) const override KMPLAYERCOMMON_NO_EXPORT {}
     void contextMenuEvent(QContextMenuEvent* event) override KMPLAYERCOMMON_NO_EXPORT;
+    void updateGeometries() override KMPLAYERCOMMON_NO_EXPORT;
+    void timerEvent(QTimerEvent* event) override KMPLAYERCOMMON_NO_EXPORT;
+protected Q_SLOTS:
+    void rowsInserted(const QModelIndex& parent, int start, int end) override KMPLAYERCOMMON_NO_EXPORT;
 private Q_SLOTS:
     void slotItemExpanded(const QModelIndex&) KMPLAYERCOMMON_NO_EXPORT;
     void copyToClipboard() KMPLAYERCOMMON_NO_EXPORT;
@@ -76,19 +84,36 @@ private Q_SLOTS:
     void slotFind() KMPLAYERCOMMON_NO_EXPORT;
     void slotFindOk() KMPLAYERCOMMON_NO_EXPORT;
     void slotFindNext() KMPLAYERCOMMON_NO_EXPORT;
+    void toggleFilter() KMPLAYERCOMMON_NO_EXPORT;
+    void filterChanged(const QString&) KMPLAYERCOMMON_NO_EXPORT;
 private:
+    PlaylistIndex *playlistIndex (TopPlayItem *ri) KMPLAYERCOMMON_NO_EXPORT;
+    int findOptions () const KMPLAYERCOMMON_NO_EXPORT;
+    void findFrom (PlaylistIndex *index, Node *cursor) KMPLAYERCOMMON_NO_EXPORT;
+    void applyFilter () KMPLAYERCOMMON_NO_EXPORT;
+    void filterRows (const QModelIndex &parent) KMPLAYERCOMMON_NO_EXPORT;
+    bool filterKeeps (Node *n) const KMPLAYERCOMMON_NO_EXPORT;
     View * m_view;
     QMenu * m_itemmenu;
     QAction * m_find;
     QAction * m_find_next;
+    QAction * m_filter;
     QAction * m_edit_playlist_item;
     KFindDialog * m_find_dialog;
+    QLineEdit * m_filter_edit;
+    QHash <int, PlaylistIndex *> m_indexes;
+    QVector <int> m_find_results; // entries of the find index
+    // matching nodes and their ancestors, weak as node memory gets reused
+    QHash <Node *, NodePtrW> m_filter_keep;
+    QString m_filter_text;
     QColor m_active_color;
     NodePtrW m_current_find_elm;
     NodePtrW m_last_drag;
     AttributePtrW m_current_find_attr;
     int last_drag_tree_id;
     int current_find_tree_id;
+    int m_find_pos;
+    int m_filter_timer;
     bool m_ignore_expanded;
 };
 
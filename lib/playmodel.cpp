@@ -6,10 +6,12 @@
 
 #include "playmodel.h"
 #include "playlistview.h"
+#include "thumbnailer.h"
 #include "kmplayercommon_log.h"
 
 #include <QPixmap>
 #include <QTimer>
+#include <QVector>
 
 #include <KLocalizedString>
 #include <KIconLoader>
@@ -36,6 +38,82 @@ Qt::ItemFlags TopPlayItem::itemFlags ()
 
 //-----------------------------------------------------------------------------
 
+static QString formatLength (int deci_sec) {
+    const int s = deci_sec / 10;
+    if (s >= 3600)
+        return QString ("%1:%2:%3").arg (s / 3600)
+            .arg ((s / 60) % 60, 2, 10, QChar ('0')).arg (s % 60, 2, 10, QChar ('0'));
+    return QString ("%1:%2").arg (s / 60).arg (s % 60, 2, 10, QChar ('0'));
+}
+
+static void playlistTotals (Node *n, int &count, int &known, int &length) {
+    Mrl *mrl = n->mrl ();
+    if (mrl == n && n->isPlayable ()) {
+        ++count;
+        if (mrl->length > 0) {
+            ++known;
+            length += mrl->length;
+        }
+    }
+    for (Node *c = n->firstChild (); c; c = c->nextSibling ())
+        playlistTotals (c, count, known, length);
+}
+
+static bool hasVisibleChildren (Node *e, bool all_nodes)
+{
+    if (all_nodes)
+        return e->hasChildNodes () || (e->isElementNode () &&
+                static_cast <Element *> (e)->attributes ().first ());
+    for (Node *c = e->firstChild (); c; c = c->nextSibling ())
+        if (c->role (RolePlaylist) || hasVisibleChildren (c, false))
+            return true;
+    return false;
+}
+
+static bool hasItemChildren (PlayItem *item)
+{
+    if (item->fetched)
+        return item->childCount () > 0;
+    return item->node &&
+        hasVisibleChildren (item->node, item->rootItem ()->show_all_nodes);
+}
+
+static QVariant toolTip (PlayItem *item) {
+    Node *n = item->node.ptr ();
+    if (!n || item->attribute)
+        return QVariant ();
+    if (hasItemChildren (item) || !n->isPlayable ()) {
+        const unsigned int version = n->document ()->m_tree_version;
+        if (item->total_count < 0 || item->totals_version != version) {
+            item->total_count = item->total_known = item->total_length = 0;
+            playlistTotals (n, item->total_count, item->total_known, item->total_length);
+            item->totals_version = version;
+        }
+        const int count = item->total_count;
+        const int known = item->total_known;
+        const int length = item->total_length;
+        if (!count)
+            return QVariant ();
+        if (!known)
+            return i18np ("1 item", "%1 items", count);
+        QString total = formatLength (length);
+        if (known < count)
+            total += QChar ('+');
+        return i18np ("1 item, %2", "%1 items, %2", count, total);
+    }
+    Mrl *mrl = n->mrl ();
+    if (!mrl || mrl != n)
+        return QVariant ();
+    QStringList info;
+    if (mrl->length > 0)
+        info << formatLength (mrl->length);
+    if (!mrl->size.isEmpty ())
+        info << QString ("%1x%2").arg ((int) mrl->size.width).arg ((int) mrl->size.height);
+    if (info.isEmpty ())
+        return QVariant ();
+    return info.join (QString (", "));
+}
+
 struct TreeUpdate {
     TreeUpdate (TopPlayItem *ri, NodePtr n, bool s, bool o, SharedPtr <TreeUpdate> &nx) : root_item (ri), node (n), select (s), open (o), next (nx) {}
     ~TreeUpdate () {}
@@ -58,6 +136,8 @@ PlayModel::PlayModel (QObject *parent, KIconLoader *loader)
     url_pix (loader->loadIcon (QString ("internet-web-browser"), KIconLoader::Small)),
     video_pix (loader->loadIcon (QString ("video-x-generic"), KIconLoader::Small)),
     root_item (new PlayItem ((Node *)nullptr, nullptr)),
+    thumbnailer (nullptr),
+    thumbnails (512),
     last_id (0)
 {
     TopPlayItem *ritem = new TopPlayItem (this,
@@ -98,10 +178,11 @@ QVariant PlayModel::data (const QModelIndex &index, int role) const
             case Node::play_type_info:
                 return info_pix;
             default:
-                if (pt > Node::play_type_none)
-                    return video_pix;
-                else
-                    return item->childCount ()
+                if (pt > Node::play_type_none) {
+                    QPixmap thumb = thumbnail (item, index);
+                    return thumb.isNull () ? video_pix : thumb;
+                } else
+                    return hasItemChildren (item)
                         ? item->node->auxiliaryNode ()
                           ? auxiliary_pix : folder_pix
                           : unknown_pix;
@@ -109,6 +190,9 @@ QVariant PlayModel::data (const QModelIndex &index, int role) const
         }
         return unknown_pix;
 
+    case Qt::ToolTipRole:
+        return toolTip (item);
+
     case UrlRole:
         if (item->node) {
             Mrl *mrl = item->node->mrl ();
@@ -148,6 +232,7 @@ bool PlayModel::setData (const QModelIndex& i, const QVariant& v, int role)
         }
         PlayItem *pi = item->parent ();
         if (pi && pi->node) {
+            pi->node->invalidateXML ();
             pi->node->document ()->m_tree_version++;
             pi->node->closed ();
         }
@@ -228,6 +313,11 @@ PlayItem *PlayModel::itemFromIndex (const QModelIndex& index) const
     return static_cast <PlayItem*> (index.internalPointer ());
 }
 
+QModelIndex PlayModel::indexFromNode (TopPlayItem *root, Node *n)
+{
+    return indexFromItem (fetchPath (root, n, true));
+}
+
 QModelIndex PlayModel::parent (const QModelIndex &index) const
 {
     if (!index.isValid())
@@ -251,6 +341,8 @@ bool PlayModel::hasChildren (const QModelIndex& parent) const
         return root_item->childCount();
 
     PlayItem *pitem = static_cast<PlayItem*>(parent.internalPointer());
+    if (!pitem->fetched)
+        return hasItemChildren (pitem);
     int count = pitem->childCount();
     if (!count
             && pitem->parent_item == root_item
@@ -294,6 +386,102 @@ int PlayModel::columnCount (const QModelIndex&) const
     return 1;
 }
 
+bool PlayModel::canFetchMore (const QModelIndex &parent) const
+{
+    PlayItem *pitem = itemFromIndex (parent);
+    return pitem && !pitem->fetched;
+}
+
+void PlayModel::fetchMore (const QModelIndex &parent)
+{
+    PlayItem *pitem = itemFromIndex (parent);
+    if (pitem && !pitem->fetched)
+        fetchChildren (pitem, true);
+}
+
+static const int thumbnail_position = 5; // seconds, skip black intro frames
+
+void PlayModel::setShowThumbnails (bool show)
+{
+    if (show == !!thumbnailer)
+        return;
+    if (show) {
+        thumbnailer = new Thumbnailer (this);
+        connect (thumbnailer, &Thumbnailer::ready,
+                this, &PlayModel::thumbnailReady);
+        connect (thumbnailer, &Thumbnailer::failed,
+                this, &PlayModel::thumbnailFailed);
+    } else {
+        delete thumbnailer;
+        thumbnailer = nullptr;
+        thumbnails.clear ();
+        thumbnail_requests.clear ();
+        thumbnail_failures.clear ();
+    }
+}
+
+QPixmap PlayModel::thumbnail (PlayItem *item, const QModelIndex &index) const
+{
+    if (!thumbnailer)
+        return QPixmap ();
+    Mrl *mrl = item->node->mrl ();
+    if (!mrl || mrl->src.isEmpty ())
+        return QPixmap ();
+    const QString url = mrl->absolutePath ();
+    QPixmap *pix = thumbnails.object (url);
+    if (pix)
+        return *pix;
+    if (thumbnail_failures.contains (url))
+        return QPixmap ();
+    if (!thumbnail_requests.contains (url)) {
+        QString file = thumbnailer->cachedFile (url, thumbnail_position);
+        if (file.isEmpty ())
+            file = thumbnailer->cachedFile (url, 0);
+        if (!file.isEmpty () &&
+                const_cast <PlayModel *> (this)->setThumbnail (url, file))
+            return *thumbnails.object (url);
+        if (!thumbnailer->request (url, thumbnail_position)) {
+            thumbnail_failures.insert (url);
+            return QPixmap ();
+        }
+    }
+    if (!thumbnail_requests.contains (url, QPersistentModelIndex (index)))
+        thumbnail_requests.insert (url, QPersistentModelIndex (index));
+    return QPixmap ();
+}
+
+bool PlayModel::setThumbnail (const QString &url, const QString &file)
+{
+    QPixmap pix (file);
+    if (pix.isNull ())
+        return false;
+    const int h = video_pix.height ();
+    thumbnails.insert (url, new QPixmap (pix.scaled (QSize (2 * h, h),
+                    Qt::KeepAspectRatio, Qt::SmoothTransformation)));
+    return true;
+}
+
+void PlayModel::thumbnailReady (const QString &url, int, const QString &file)
+{
+    if (!setThumbnail (url, file))
+        thumbnail_failures.insert (url);
+    const QList <QPersistentModelIndex> indexes = thumbnail_requests.values (url);
+    thumbnail_requests.remove (url);
+    const QList <QPersistentModelIndex>::const_iterator e = indexes.constEnd ();
+    for (QList <QPersistentModelIndex>::const_iterator i = indexes.constBegin (); i != e; ++i)
+        if ((*i).isValid ())
+            Q_EMIT dataChanged (*i, *i);
+}
+
+void PlayModel::thumbnailFailed (const QString &url, int pos)
+{
+    // too short for the default position, try the first frame
+    if (pos > 0 && thumbnailer->request (url, 0))
+        return;
+    thumbnail_failures.insert (url);
+    thumbnail_requests.remove (url);
+}
+
 void dumpTree( PlayItem *p, const QString &indent ) {
     qCDebug(LOG_KMPLAYER_COMMON, "%s%s", qPrintable(indent),qPrintable(p->title));
     for (int i=0; i < p->childCount(); i++)
@@ -326,6 +514,44 @@ void TopPlayItem ::remove ()
     model->endRemoveRows();
 }
 
+/* returns true if the title or flags changed */
+static bool setItemData (Node *e, TopPlayItem *root, PlayItem *item)
+{
+    Qt::ItemFlags flags = Qt::ItemIsEnabled | Qt::ItemIsSelectable;
+    flags |= root->itemFlags ();
+    PlaylistRole *title = (PlaylistRole *) e->role (RolePlaylist);
+    QString text (title ? title->caption () : "");
+    if (text.isEmpty ()) {
+        text = id_node_text == e->id ? e->nodeValue () : e->nodeName ();
+        if (e->isDocument ())
+            text = e->hasChildNodes () ? i18n ("unnamed") : i18n ("none");
+    }
+    if (title && !root->show_all_nodes && title->editable)
+        flags |= Qt::ItemIsEditable;
+    if (item->title == text && item->item_flags == flags)
+        return false;
+    item->title = text;
+    item->item_flags = flags;
+    return true;
+}
+
+/* the nodes that get an item below e, when not all nodes are shown */
+static void visibleChildren (Node *e, TopPlayItem *root, QVector <Node *> &nodes)
+{
+    for (Node *c = e->firstChild (); c; c = c->nextSibling ())
+        if (c->role (RolePlaylist)) {
+            nodes.append (c);
+        } else {
+            root->have_dark_nodes = true;
+            visibleChildren (c, root, nodes);
+        }
+}
+
+/*
+ * Makes the item for e below pitem, or fills root if pitem is null. Only
+ * the first level below root gets its items here, deeper ones are made by
+ * fetchChildren when their branch is expanded.
+ */
 PlayItem *PlayModel::populate (Node *e, Node *focus,
         TopPlayItem *root, PlayItem *pitem,
         PlayItem ** curitem)
@@ -341,21 +567,24 @@ PlayItem *PlayModel::populate (Node *e, Node *focus,
         item = new PlayItem (e, pitem);
         pitem->appendChild (item);
     }
-    item->item_flags |= root->itemFlags ();
-    PlaylistRole *title = (PlaylistRole *) e->role (RolePlaylist);
-    QString text (title ? title->caption () : "");
-    if (text.isEmpty ()) {
-        text = id_node_text == e->id ? e->nodeValue () : e->nodeName ();
-        if (e->isDocument ())
-            text = e->hasChildNodes () ? i18n ("unnamed") : i18n ("none");
-    }
-    item->title = text;
-    if (title && !root->show_all_nodes && title->editable)
-        item->item_flags |= Qt::ItemIsEditable;
+    setItemData (e, root, item);
     if (focus == e)
         *curitem = item;
     //if (e->active ())
         //scrollToItem (item);
+    if (pitem)
+        item->fetched = false;
+    else
+        populateChildren (e, focus, root, item, curitem);
+        //if (root->flags & PlayModel::AllowDrag)
+        //    item->setDragEnabled (true);
+    return item;
+}
+
+void PlayModel::populateChildren (Node *e, Node *focus,
+        TopPlayItem *root, PlayItem *item,
+        PlayItem ** curitem)
+{
     for (Node *c = e->firstChild (); c; c = c->nextSibling ())
         populate (c, focus, root, item, curitem);
     if (e->isElementNode ()) {
@@ -378,9 +607,79 @@ PlayItem *PlayModel::populate (Node *e, Node *focus,
             }
         }
     }
-        //if (root->flags & PlayModel::AllowDrag)
-        //    item->setDragEnabled (true);
-    return item;
+}
+
+void PlayModel::fetchChildren (PlayItem *item, bool notify)
+{
+    item->fetched = true;
+    if (!item->node)
+        return;
+    PlayItem holder ((Node *) nullptr, nullptr);
+    PlayItem *curitem = nullptr;
+    populateChildren (item->node, nullptr, item->rootItem (), &holder, &curitem);
+    const int count = holder.childCount ();
+    if (!count)
+        return;
+    if (notify)
+        beginInsertRows (indexFromItem (item), 0, count - 1);
+    for (int i = 0; i < count; ++i)
+        holder.child_items[i]->parent_item = item;
+    item->child_items = holder.child_items;
+    holder.child_items.clear ();
+    if (notify)
+        endInsertRows ();
+}
+
+/* makes the items down to focus, so it can be selected */
+PlayItem *PlayModel::fetchPath (TopPlayItem *root, Node *focus, bool notify)
+{
+    QVector <Node *> path;
+    Node *n = focus;
+    for (; n && n != root->node.ptr (); n = n->parentNode ())
+        path.append (n);
+    if (!n)
+        return nullptr;
+    PlayItem *item = root;
+    for (int i = path.size () - 1; i >= 0; --i) {
+        if (!item->fetched)
+            fetchChildren (item, notify);
+        for (int j = 0; j < item->childCount (); ++j)
+            if (item->child_items[j]->node.ptr () == path[i] &&
+                    !item->child_items[j]->attribute) {
+                item = item->child_items[j];
+                break;
+            } // else a hidden node, its children are at this level
+    }
+    return item->node.ptr () == focus ? item : nullptr;
+}
+
+void PlayModel::nodeChanged (Node *n)
+{
+    for (int i = 0; i < root_item->childCount (); ++i) {
+        PlayItem *item = root_item->child (i);
+        QVector <Node *> path;
+        Node *p = n;
+        for (; p && p != item->node.ptr (); p = p->parentNode ())
+            path.append (p);
+        if (!p)
+            continue;
+        // like fetchPath, but items that are not there need no update
+        for (int j = path.size () - 1; j >= 0 && item->fetched; --j) {
+            for (int k = 0; k < item->childCount (); ++k)
+                if (item->child_items[k]->node.ptr () == path[j] &&
+                        !item->child_items[k]->attribute) {
+                    item = item->child_items[k];
+                    break;
+                }
+        }
+        // a length may have changed, which the tree version doesn't tell
+        for (PlayItem *up = item; up; up = up->parent_item)
+            up->total_count = -1;
+        if (item->node.ptr () == n) {
+            const QModelIndex index = indexFromItem (item);
+            Q_EMIT dataChanged (index, index);
+        }
+    }
 }
 
 int PlayModel::addTree (NodePtr doc, const QString &source, const QString &icon, int flags) {
@@ -389,14 +688,15 @@ int PlayModel::addTree (NodePtr doc, const QString &source, const QString &icon,
     ritem->icon = KIconLoader::global ()->loadIcon (icon, KIconLoader::Small);
     PlayItem *curitem = nullptr;
     populate (doc, nullptr, ritem, nullptr, &curitem);
+    ritem->populated = doc;
+    if (doc)
+        ritem->tree_version = doc->document ()->m_tree_version;
     ritem->add ();
     return last_id;
 }
 
 void PlayModel::updateTree (int id, NodePtr root, NodePtr active,
         bool select, bool open) {
-    // TODO, if root is same as rootitems->node and treeversion is the same
-    // and show all nodes is unchanged then only update the cells
     int root_item_count = root_item->childCount ();
     TopPlayItem *ritem = nullptr;
     if (id == -1) { // wildcard id
@@ -436,20 +736,157 @@ void PlayModel::updateTrees () {
     }
 }
 
+void PlayModel::removeItems (PlayItem *item, const QModelIndex &parent,
+        int first, int last, QHash <Node *, PlayItem *> &old)
+{
+    beginRemoveRows (parent, first, last);
+    for (int i = first; i <= last; ++i) {
+        PlayItem *child = item->child_items.at (i);
+        if (child->node)
+            old.remove (child->node.ptr ());
+        delete child;
+    }
+    item->child_items.erase (item->child_items.begin () + first,
+            item->child_items.begin () + last + 1);
+    endRemoveRows ();
+}
+
+/*
+ * Brings the child items of item in line with the visible children of e.
+ * Items of nodes that are still there are kept, so the view keeps its
+ * expanded and selected rows. Removed nodes and those moved elsewhere lose
+ * their items, new nodes get theirs inserted.
+ */
+void PlayModel::reconcileChildren (Node *e, Node *focus, TopPlayItem *root,
+        PlayItem *item, PlayItem **curitem)
+{
+    QVector <Node *> nodes;
+    visibleChildren (e, root, nodes);
+    const QModelIndex parent = indexFromItem (item);
+    QSet <Node *> wanted;
+    QHash <Node *, PlayItem *> old;
+    bool indexed = false;
+    bool changed = false;
+    int row = 0;
+    int n = 0;
+    while (n < nodes.size ()) {
+        Node *c = nodes[n];
+        if (row < item->childCount () && item->child_items[row]->node.ptr () == c) {
+            old.remove (c);
+            reconcile (c, focus, root, item->child_items[row], curitem, true);
+            ++row;
+            ++n;
+            continue;
+        }
+        if (!indexed) { // first difference, index the rest
+            indexed = true;
+            wanted.reserve (nodes.size () - n);
+            for (int i = n; i < nodes.size (); ++i)
+                wanted.insert (nodes[i]);
+            for (int i = row; i < item->childCount (); ++i)
+                if (item->child_items[i]->node)
+                    old.insert (item->child_items[i]->node.ptr (), item->child_items[i]);
+        }
+        changed = true;
+        int last = row;
+        while (last < item->childCount () &&
+                (!item->child_items[last]->node ||
+                 !wanted.contains (item->child_items[last]->node.ptr ())))
+            ++last;
+        if (last > row) {
+            removeItems (item, parent, row, last - 1, old);
+            continue;
+        }
+        QHash <Node *, PlayItem *>::const_iterator i = old.constFind (c);
+        if (i != old.constEnd ()) { // c moved up, drop the items before it
+            removeItems (item, parent, row,
+                    item->child_items.indexOf (i.value (), row) - 1, old);
+            continue;
+        }
+        PlayItem holder ((Node *) nullptr, nullptr);
+        for (; n < nodes.size () && !old.contains (nodes[n]); ++n)
+            populate (nodes[n], focus, root, &holder, curitem);
+        const int count = holder.childCount ();
+        beginInsertRows (parent, row, row + count - 1);
+        for (int i = 0; i < count; ++i)
+            holder.child_items[i]->parent_item = item;
+        if (row == item->childCount ())
+            item->child_items.append (holder.child_items);
+        else
+            item->child_items = item->child_items.mid (0, row) +
+                holder.child_items + item->child_items.mid (row);
+        holder.child_items.clear ();
+        endInsertRows ();
+        row += count;
+    }
+    if (row < item->childCount ()) {
+        removeItems (item, parent, row, item->childCount () - 1, old);
+        changed = true;
+    }
+    if (changed)
+        Q_EMIT dataChanged (parent, parent); // icon and tooltip
+}
+
+void PlayModel::reconcile (Node *e, Node *focus, TopPlayItem *root,
+        PlayItem *item, PlayItem **curitem, bool structure)
+{
+    root->have_dark_nodes |= !e->role (RolePlaylist);
+    if (e->isElementNode () && static_cast <Element *> (e)->attributes ().first ())
+        root->have_dark_nodes = true;
+    if (setItemData (e, root, item)) {
+        const QModelIndex index = indexFromItem (item);
+        Q_EMIT dataChanged (index, index);
+    }
+    if (focus == e)
+        *curitem = item;
+    if (!item->fetched) // nothing made below it yet
+        return;
+    // an embedded document counts its own tree changes
+    if (structure || (e != root->node.ptr () && e->isDocument ())) {
+        reconcileChildren (e, focus, root, item, curitem);
+        return;
+    }
+    for (int i = 0; i < item->childCount (); ++i) {
+        PlayItem *child = item->child_items[i];
+        if (!child->node) { // can't be without a tree change, but anyhow
+            reconcileChildren (e, focus, root, item, curitem);
+            return;
+        }
+        reconcile (child->node, focus, root, child, curitem, false);
+    }
+}
+
 PlayItem *PlayModel::updateTree (TopPlayItem *ritem, NodePtr active) {
     PlayItem *curitem = nullptr;
 
+    if (ritem->node && !ritem->show_all_nodes)
+        for (NodePtr n = active; n; n = n->parentNode ()) {
+            active = n;
+            if (n->role (RolePlaylist))
+                break;
+        }
+    if (ritem->node && ritem->populated == ritem->node &&
+            !ritem->show_all_nodes && !ritem->populated_all_nodes) {
+        // same tree shown the same way, only update what changed
+        const unsigned int version = ritem->node->document ()->m_tree_version;
+        reconcile (ritem->node, active, ritem, ritem, &curitem,
+                version != ritem->tree_version);
+        ritem->tree_version = version;
+        if (!curitem && active)
+            curitem = fetchPath (ritem, active.ptr (), true);
+        return curitem;
+    }
+
     ritem->remove ();
     ritem->deleteChildren ();
     if (ritem->node) {
-        if (!ritem->show_all_nodes)
-            for (NodePtr n = active; n; n = n->parentNode ()) {
-                active = n;
-                if (n->role (RolePlaylist))
-                    break;
-            }
         populate (ritem->node, active, ritem, nullptr, &curitem);
+        if (!curitem && active)
+            curitem = fetchPath (ritem, active.ptr (), false);
+        ritem->tree_version = ritem->node->document ()->m_tree_version;
     }
+    ritem->populated = ritem->node;
+    ritem->populated_all_nodes = ritem->show_all_nodes;
     ritem->add ();
 
     return curitem;
@@ -11,7 +11,12 @@
 
 #include <QAbstractItemModel>
 #include <QModelIndex>
+#include <QPersistentModelIndex>
 #include <QPixmap>
+#include <QCache>
+#include <QMultiMap>
+#include <QSet>
+#include <QHash>
 
 #include "kmplayerplaylist.h"
 
@@ -23,6 +28,7 @@ namespace KMPlayer {
 
 class PlayModel; 
 class TopPlayItem;
+class Thumbnailer;
 
 /*
  * An item in the playlist
@@ -32,11 +38,15 @@ class PlayItem
 public:
     PlayItem (Node *e, PlayItem *parent)
         : item_flags (Qt::ItemIsEnabled | Qt::ItemIsSelectable),
-          node (e), parent_item (parent)
+          node (e), parent_item (parent),
+          totals_version (0), total_count (-1), total_known (0),
+          total_length (0), fetched (true)
     {}
     PlayItem (Attribute *a, PlayItem *pa)
         : item_flags (Qt::ItemIsEnabled | Qt::ItemIsSelectable),
-          attribute (a), parent_item (pa)
+          attribute (a), parent_item (pa),
+          totals_version (0), total_count (-1), total_known (0),
+          total_length (0), fetched (true)
     {}
     virtual ~PlayItem () { deleteChildren (); }
 
@@ -60,6 +70,12 @@ public:
 
     QList<PlayItem*> child_items;
     PlayItem *parent_item;
+    // playlist totals for the tooltip, -1 or other tree version if not known
+    unsigned int totals_version;
+    int total_count;
+    int total_known;
+    int total_length;
+    bool fetched; // child items are made when the branch gets expanded
 };
 
 class TopPlayItem : public PlayItem
@@ -70,8 +86,10 @@ public:
         model (m),
         id (_id),
         root_flags (flags),
+        tree_version (0),
         show_all_nodes (false),
-        have_dark_nodes (false)
+        have_dark_nodes (false),
+        populated_all_nodes (false)
     {}
     Qt::ItemFlags itemFlags () KMPLAYERCOMMON_EXPORT;
     void add ();
@@ -79,10 +97,13 @@ public:
     QPixmap icon;
     QString source;
     PlayModel *model;
+    NodePtrW populated; // node and tree version the items were made from
     int id;
     int root_flags;
+    unsigned int tree_version;
     bool show_all_nodes;
     bool have_dark_nodes;
+    bool populated_all_nodes;
 };
 
 class KMPLAYERCOMMON_EXPORT PlayModel : public QAbstractItemModel
@@ -114,27 +135,49 @@ public:
     bool hasChildren (const QModelIndex& parent = QModelIndex ()) const override KMPLAYERCOMMON_NO_EXPORT;
     int rowCount (const QModelIndex &parent = QModelIndex()) const override KMPLAYERCOMMON_NO_EXPORT;
     int columnCount (const QModelIndex &parent = QModelIndex()) const override KMPLAYERCOMMON_NO_EXPORT;
+    bool canFetchMore (const QModelIndex &parent) const override KMPLAYERCOMMON_NO_EXPORT;
+    void fetchMore (const QModelIndex &parent) override KMPLAYERCOMMON_NO_EXPORT;
 
     PlayItem *rootItem () const KMPLAYERCOMMON_NO_EXPORT { return root_item; }
     QModelIndex indexFromItem (PlayItem *item) const KMPLAYERCOMMON_NO_EXPORT;
     PlayItem *itemFromIndex (const QModelIndex& index) const KMPLAYERCOMMON_NO_EXPORT;
+    /* index of the item of n, its items are made if not yet there */
+    QModelIndex indexFromNode (TopPlayItem *root, Node *n) KMPLAYERCOMMON_NO_EXPORT;
 
     int addTree (NodePtr r, const QString &src, const QString &ico, int flgs);
     PlayItem *updateTree (TopPlayItem *ritem, NodePtr active);
+    void setShowThumbnails (bool show);
 Q_SIGNALS:
     void updating (const QModelIndex&);
     void updated (const QModelIndex&, const QModelIndex&, bool sel, bool exp);
 
 public Q_SLOTS:
     void updateTree (int id, NodePtr root, NodePtr active, bool sel, bool open);
+    /* repaint the item of n if it has one, eg. when its Mrl got updated */
+    void nodeChanged (KMPlayer::Node *n);
 
 private Q_SLOTS:
     void updateTrees() KMPLAYERCOMMON_NO_EXPORT;
+    void thumbnailReady (const QString &url, int pos, const QString &file) KMPLAYERCOMMON_NO_EXPORT;
+    void thumbnailFailed (const QString &url, int pos) KMPLAYERCOMMON_NO_EXPORT;
 
 private:
     PlayItem *populate (Node *e, Node *focus,
             TopPlayItem *root, PlayItem *item,
             PlayItem **curitem) KMPLAYERCOMMON_NO_EXPORT;
+    void populateChildren (Node *e, Node *focus,
+            TopPlayItem *root, PlayItem *item,
+            PlayItem **curitem) KMPLAYERCOMMON_NO_EXPORT;
+    void fetchChildren (PlayItem *item, bool notify) KMPLAYERCOMMON_NO_EXPORT;
+    PlayItem *fetchPath (TopPlayItem *root, Node *focus, bool notify) KMPLAYERCOMMON_NO_EXPORT;
+    void reconcile (Node *e, Node *focus, TopPlayItem *root,
+            PlayItem *item, PlayItem **curitem, bool structure) KMPLAYERCOMMON_NO_EXPORT;
+    void reconcileChildren (Node *e, Node *focus, TopPlayItem *root,
+            PlayItem *item, PlayItem **curitem) KMPLAYERCOMMON_NO_EXPORT;
+    void removeItems (PlayItem *item, const QModelIndex &parent,
+            int first, int last, QHash <Node *, PlayItem *> &old) KMPLAYERCOMMON_NO_EXPORT;
+    QPixmap thumbnail (PlayItem *item, const QModelIndex &index) const KMPLAYERCOMMON_NO_EXPORT;
+    bool setThumbnail (const QString &url, const QString &file) KMPLAYERCOMMON_NO_EXPORT;
     SharedPtr <TreeUpdate> tree_update;
     QPixmap auxiliary_pix;
     QPixmap config_pix;
@@ -146,6 +189,11 @@ private:
     QPixmap url_pix;
     QPixmap video_pix;
     PlayItem *root_item;
+    Thumbnailer *thumbnailer;
+    // thumbnails are only requested for painted, ie. visible, rows
+    mutable QCache <QString, QPixmap> thumbnails;
+    mutable QMultiMap <QString, QPersistentModelIndex> thumbnail_requests;
+    mutable QSet <QString> thumbnail_failures;
     int last_id;
 };
 
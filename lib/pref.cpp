@@ -230,11 +230,17 @@ PrefGeneralPageGeneral::PrefGeneralPageGeneral(QWidget *parent, Settings *)
     adjustvolume->setWhatsThis(i18n ("When a new source is selected, the volume will be set according the volume control"));
     adjustcolors = new QCheckBox(i18n("Auto set colors on start"));
     adjustcolors->setWhatsThis(i18n ("When a movie starts, the colors will be set according the sliders for colors"));
+    thumbnails = new QCheckBox(i18n("Show thumbnails in playlist"));
+    thumbnails->setWhatsThis(i18n ("Grab a frame of local video files shown in the playlist and use it as item icon"));
+    probeMedia = new QCheckBox(i18n("Identify playlist items in advance"));
+    probeMedia->setWhatsThis(i18n ("Determine length and size of local media files in the playlist in the background, so these are known before playing"));
     vbox = new QVBoxLayout;
     vbox->addWidget(loop);
     vbox->addWidget(framedrop);
     vbox->addWidget(adjustvolume);
     vbox->addWidget(adjustcolors);
+    vbox->addWidget(thumbnails);
+    vbox->addWidget(probeMedia);
     playbox->setLayout(vbox);
 
     QGroupBox* controlbox = new QGroupBox(i18n("Control Panel"));
@@ -107,6 +107,8 @@ public:
     QCheckBox *framedrop;
     QCheckBox *adjustvolume;
     QCheckBox *adjustcolors;
+    QCheckBox *thumbnails;
+    QCheckBox *probeMedia;
 
     QSpinBox *seekTime;
 };
@@ -0,0 +1,217 @@
+/*
+    This file belong to the KMPlayer project, a movie player plugin for Konqueror
+    SPDX-FileCopyrightText: 2026 The KMPlayer authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "config-kmplayer.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "kmplayercommon_log.h"
+#include "smiltimeline.h"
+#include "kmplayer_smil.h"
+
+using namespace KMPlayer;
+
+static int addTime (int a, int b) {
+    if (SmilTimeline::Unresolved == a || SmilTimeline::Unresolved == b)
+        return SmilTimeline::Unresolved;
+    const qint64 t = qint64 (a) + b;
+    return t < SmilTimeline::Indefinite ? int (t) : SmilTimeline::Indefinite;
+}
+
+static int lastEnd (int a, int b) {
+    if (SmilTimeline::Unresolved == a || SmilTimeline::Unresolved == b)
+        return SmilTimeline::Unresolved;
+    return qMax (a, b);
+}
+
+static bool isContainer (Node *n) {
+    return SMIL::id_node_body == n->id || SMIL::id_node_seq == n->id ||
+        SMIL::id_node_par == n->id || SMIL::id_node_excl == n->id;
+}
+
+static bool earlier (const SmilTimeline::Interval &a, const SmilTimeline::Interval &b) {
+    return a.begin < b.begin;
+}
+
+static SmilTimeline::Interval newInterval (Node *n) {
+    SmilTimeline::Interval iv;
+    iv.node = n;
+    iv.activate = 0;
+    iv.begin = iv.end = iv.simple = SmilTimeline::Unresolved;
+    iv.resolved = SmilTimeline::Indefinite;
+    iv.first_child = iv.child_count = 0;
+    return iv;
+}
+
+SmilTimeline::SmilTimeline ()
+ : m_tree_version (0) {}
+
+bool SmilTimeline::update (Node *body) {
+    if (!body) {
+        m_intervals.clear ();
+        m_index.clear ();
+        m_body = nullptr;
+        return true;
+    }
+    const unsigned int version = body->document ()->m_tree_version;
+    if (m_body.ptr () == body && m_tree_version == version)
+        return false;
+    m_intervals.clear ();
+    m_index.clear ();
+    m_body = body;
+    m_tree_version = version;
+    m_intervals.append (newInterval (body));
+    schedule (0);
+    for (int i = 0; i < m_intervals.size (); ++i)
+        m_index.insert (m_intervals[i].node.ptr (), i);
+    qCDebug(LOG_KMPLAYER_COMMON) << "SmilTimeline: " << m_intervals.size () << " intervals, duration " << duration () << " resolved " << resolvedUntil ();
+    return true;
+}
+
+void SmilTimeline::schedule (int i) {
+    Node *n = m_intervals[i].node.ptr ();
+    const bool seq = SMIL::id_node_body == n->id || SMIL::id_node_seq == n->id;
+    const bool excl = SMIL::id_node_excl == n->id;
+    const bool media = SMIL::id_node_text == n->id ||
+        SMIL::id_node_brush == n->id ||
+        (SMIL::id_node_ref == n->id && !strcmp (n->nodeName (), "img"));
+    const int first = m_intervals.size ();
+    int count = 0;
+    if (isContainer (n) || media)
+        for (Node *c = n->firstChild (); c; c = c->nextSibling ())
+            if (c->isElementNode () && SMIL::id_node_param != c->id) {
+                m_intervals.append (newInterval (c));
+                ++count;
+            }
+    int at = 0;
+    for (int k = first; k < first + count; ++k) {
+        m_intervals[k].activate = seq ? at : 0;
+        schedule (k);
+        at = m_intervals[k].end;
+    }
+    if (excl && count) { // a starting child stops the previous one
+        std::stable_sort (m_intervals.begin () + first,
+                m_intervals.begin () + first + count, earlier);
+        for (int k = first; k + 1 < first + count; ++k) {
+            Interval &c = m_intervals[k];
+            const int next = m_intervals[k + 1].begin;
+            if (Unresolved != c.end && Unresolved != next && next < c.end)
+                c.end = next;
+        }
+    }
+
+    Interval &iv = m_intervals[i];
+    iv.first_child = first;
+    iv.child_count = count;
+    if (!n->isElementNode () || !n->role (RoleTiming)) {
+        iv.begin = iv.activate;
+        return; // not timed, it's unresolved when it ends
+    }
+    // runtimes of played elements are modified, parse the timing as written
+    Element *elm = static_cast <Element *> (n);
+    Runtime rt (elm);
+    for (Attribute *a = elm->attributes ().first (); a; a = a->nextSibling ())
+        rt.parseParam (a->name (), a->value ());
+
+    Runtime::DurationItem &begin = rt.beginTime ();
+    Runtime::DurationItem &dur = rt.durTime ();
+    Runtime::DurationItem &end = rt.endTime ();
+    if (!begin.next && rt.expr.isEmpty () && Runtime::DurTimer == begin.durval)
+        iv.begin = addTime (iv.activate, qMax (0, begin.offset));
+
+    int simple = 0;
+    if (Runtime::DurTimer == dur.durval) { // as Runtime::setDuration
+        simple = dur.offset;
+        if (Runtime::DurTimer == end.durval &&
+                (!simple || end.offset - begin.offset < simple))
+            simple = end.offset - begin.offset;
+    } else if (Runtime::DurTimer == end.durval) {
+        simple = end.offset;
+    }
+    if (end.next || (Runtime::DurTimer != end.durval &&
+                Runtime::DurMedia != end.durval)) {
+        simple = Unresolved; // ended by an event
+    } else if (simple > 0) {
+    } else if (Runtime::DurIndefinite == dur.durval) {
+        simple = Indefinite;
+    } else if (Runtime::DurTimer != dur.durval || !(isContainer (n) || media)) {
+        simple = Unresolved; // intrinsic duration of the media
+    } else { // waits for its children
+        simple = 0;
+        for (int k = first; k < first + count; ++k)
+            simple = lastEnd (simple, m_intervals[k].end);
+    }
+
+    int active = simple;
+    const int repeat = rt.repeats ();
+    if (Unresolved != simple && Indefinite != simple) {
+        if (Runtime::DurIndefinite == repeat)
+            active = simple > 0 ? (int) Indefinite : 0;
+        else if (repeat > 1)
+            active = (int) qMin (qint64 (simple) * repeat, qint64 (Indefinite));
+    }
+    iv.simple = simple;
+    iv.end = addTime (iv.begin, active);
+
+    int inner = Indefinite;
+    for (int k = first; k < first + count; ++k) {
+        const Interval &c = m_intervals[k];
+        if (Unresolved == c.begin || Unresolved == c.end) {
+            if (seq || excl) { // the rest depends on it
+                inner = qMin (inner, Unresolved == c.begin ? c.activate : c.begin);
+                break;
+            }
+            if (Unresolved != c.begin && isContainer (c.node.ptr ()))
+                inner = qMin (inner, c.begin);
+            continue; // media started at an offset ends by itself
+        }
+        inner = qMin (inner, c.resolved);
+    }
+    if (Indefinite == inner ||
+            (Unresolved != simple && Indefinite != simple && inner >= simple))
+        iv.resolved = Indefinite; // repeats alike
+    else
+        iv.resolved = addTime (iv.begin, inner);
+}
+
+int SmilTimeline::duration () const {
+    return m_intervals.isEmpty () ? (int) Unresolved : m_intervals[0].end;
+}
+
+int SmilTimeline::resolvedUntil () const {
+    if (m_intervals.isEmpty ())
+        return 0;
+    const Interval &iv = m_intervals[0];
+    return Unresolved == iv.end ? iv.resolved : qMin (iv.resolved, iv.end);
+}
+
+int SmilTimeline::find (Node *n) const {
+    return m_index.value (n, -1);
+}
+
+int SmilTimeline::childAt (int i, int t) const {
+    const Interval &p = m_intervals[i];
+    if (!p.node)
+        return -1;
+    const bool seq = SMIL::id_node_excl != p.node->id;
+    int lo = p.first_child;
+    int hi = p.first_child + p.child_count;
+    while (lo < hi) { // first child that starts after t
+        const int mid = (lo + hi) / 2;
+        const Interval &c = m_intervals[mid];
+        const int key = seq ? c.activate : c.begin;
+        if (Unresolved != key && key <= t)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == p.first_child)
+        return -1;
+    const Interval &c = m_intervals[lo - 1];
+    return Unresolved == c.end || t < c.end ? lo - 1 : -1;
+}
@@ -0,0 +1,71 @@
+/*
+    This file belong to the KMPlayer project, a movie player plugin for Konqueror
+    SPDX-FileCopyrightText: 2026 The KMPlayer authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#ifndef _KMPLAYER_SMILTIMELINE_H_
+#define _KMPLAYER_SMILTIMELINE_H_
+
+#include "config-kmplayer.h"
+
+#include <QVector>
+#include <QHash>
+
+#include "kmplayercommon_export.h"
+#include "kmplayerplaylist.h"
+
+namespace KMPlayer {
+
+/*
+ * Static schedule of a SMIL body, as written in the begin/dur/end/repeat
+ * attributes. Each element gets an interval of activity in the time of its
+ * parent, the children of a time container follow their parent's interval
+ * sorted on begin. Event driven timing or durations that depend on the
+ * media are unresolved, and so is what follows them in a seq or excl.
+ * Times are in centi-seconds, like those of Runtime.
+ */
+class KMPLAYERCOMMON_EXPORT SmilTimeline
+{
+public:
+    enum { Unresolved = -1, Indefinite = 0x7fffffff };
+    struct Interval {
+        NodePtrW node;
+        int activate;    // when the parent activates it
+        int begin;
+        int end;
+        int simple;      // duration of one repeat
+        int resolved;    // known schedule before this time, or Indefinite
+        int first_child;
+        int child_count;
+    };
+
+    SmilTimeline ();
+
+    /* (re)builds the schedule if body or the tree changed */
+    bool update (Node *body);
+    /* length of the body, or Unresolved */
+    int duration () const;
+    /* a seek to a time before this one is possible */
+    int resolvedUntil () const;
+    /* index of n, or -1 */
+    int find (Node *n) const;
+    /* child of seq or excl i that's active or waiting at time t, or -1 */
+    int childAt (int i, int t) const;
+
+    const Interval &interval (int i) const { return m_intervals[i]; }
+    int count () const { return m_intervals.size (); }
+
+private:
+    void schedule (int i) KMPLAYERCOMMON_NO_EXPORT;
+
+    QVector <Interval> m_intervals;
+    QHash <Node *, int> m_index;
+    NodePtrW m_body;
+    unsigned int m_tree_version;
+};
+
+} // namespace
+
+#endif
@@ -0,0 +1,491 @@
+/*
+    This file belong to the KMPlayer project, a movie player plugin for Konqueror
+    SPDX-FileCopyrightText: 2026 The KMPlayer authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "config-kmplayer.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+
+#include "kmplayercommon_log.h"
+#include "snapshot.h"
+
+using namespace KMPlayer;
+
+static const quint32 snapshot_magic = 0x4b4d5053; // 'KMPS'
+static const quint32 snapshot_version = 1;
+static const qint64 header_size = 8;  // magic and version
+static const qint64 segment_header_size = 8; // kind and length
+
+// segments, the image and then the edits
+enum { segment_image = 1, segment_splices = 2 };
+
+// node records
+enum { record_start = 1, record_end = 2, record_text = 3, record_cdata = 4 };
+
+static QByteArray digest (const QByteArray &records) {
+    return QCryptographicHash::hash (records, QCryptographicHash::Md5);
+}
+
+static bool readString (QDataStream &in, const QVector <QString> &strings, QString &s) {
+    quint32 i;
+    in >> i;
+    if (in.status () != QDataStream::Ok || i >= (quint32) strings.size ())
+        return false;
+    s = strings[i];
+    return true;
+}
+
+static bool readStart (QDataStream &in, const QVector <QString> &strings,
+        QString &tag, AttributeList &attrs) {
+    quint32 count;
+    if (!readString (in, strings, tag))
+        return false;
+    in >> count;
+    for (quint32 i = 0; i < count; ++i) {
+        QString name, value;
+        if (!readString (in, strings, name) || !readString (in, strings, value))
+            return false;
+        attrs.append (new Attribute (TrieString (), name, value));
+    }
+    return in.status () == QDataStream::Ok;
+}
+
+static bool readChildren (QDataStream &in, const QVector <QString> &strings, Node *parent);
+
+// appends the node of the record, with its subtree, to parent
+static bool readChild (QDataStream &in, const QVector <QString> &strings,
+        Node *parent, quint8 kind) {
+    NodePtr doc = parent->document ();
+    QString s;
+    if (record_text == kind || record_cdata == kind) {
+        if (!readString (in, strings, s))
+            return false;
+        if (record_text == kind)
+            parent->appendChild (new TextNode (doc, s));
+        else
+            parent->appendChild (new CData (doc, s));
+        return true;
+    }
+    if (record_start != kind)
+        return false;
+    AttributeList attrs;
+    if (!readStart (in, strings, s, attrs))
+        return false;
+    NodePtr n = parent->childFromTag (s);
+    if (!n || n == parent)
+        n = new DarkNode (doc, s.toUtf8 ());
+    if (n->isElementNode ())
+        convertNode <Element> (n)->setAttributes (attrs);
+    parent->appendChild (n);
+    n->opened ();
+    if (!readChildren (in, strings, n))
+        return false;
+    n->closed ();
+    return true;
+}
+
+static bool readChildren (QDataStream &in, const QVector <QString> &strings, Node *parent) {
+    while (true) {
+        quint8 kind;
+        in >> kind;
+        if (in.status () != QDataStream::Ok)
+            return false;
+        if (record_end == kind)
+            return true;
+        if (!readChild (in, strings, parent, kind))
+            return false;
+    }
+}
+
+DocumentSnapshot::DocumentSnapshot () {
+    reset ();
+}
+
+void DocumentSnapshot::reset () {
+    m_string_index.clear ();
+    m_new_strings.clear ();
+    m_root_digest.clear ();
+    m_digests.clear ();
+    m_image_size = m_journal_size = m_file_size = 0;
+    m_appendable = false;
+}
+
+quint32 DocumentSnapshot::intern (const QString &s) {
+    QHash <QString, quint32>::const_iterator i = m_string_index.constFind (s);
+    if (i != m_string_index.constEnd ())
+        return i.value ();
+    const quint32 id = m_string_index.size ();
+    m_string_index.insert (s, id);
+    m_new_strings.append (s);
+    return id;
+}
+
+void DocumentSnapshot::encodeStart (QDataStream &out, Node *n) {
+    out << quint8 (record_start) << intern (QString::fromUtf8 (n->nodeName ()));
+    if (!n->isElementNode ()) {
+        out << quint32 (0);
+        return;
+    }
+    const AttributeList &attrs = static_cast <Element *> (n)->attributes ();
+    quint32 count = 0;
+    for (Attribute *a = attrs.first (); a; a = a->nextSibling ())
+        ++count;
+    out << count;
+    for (Attribute *a = attrs.first (); a; a = a->nextSibling ())
+        out << intern (a->name ().toString ()) << intern (a->value ());
+}
+
+void DocumentSnapshot::encode (QDataStream &out, Node *n) {
+    if (!n->isElementNode ()) { // #text or #cdata
+        out << quint8 (id_node_cdata == n->id ? record_cdata : record_text);
+        out << intern (n->nodeValue ());
+        return;
+    }
+    encodeStart (out, n);
+    for (Node *c = n->firstChild (); c; c = c->nextSibling ())
+        encode (out, c);
+    out << quint8 (record_end);
+}
+
+QByteArray DocumentSnapshot::startRecord (Node *n) {
+    QByteArray records;
+    QDataStream out (&records, QIODevice::WriteOnly);
+    out.setVersion (QDataStream::Qt_5_0);
+    encodeStart (out, n);
+    return records;
+}
+
+QByteArray DocumentSnapshot::nodeRecords (Node *n) {
+    QByteArray records;
+    QDataStream out (&records, QIODevice::WriteOnly);
+    out.setVersion (QDataStream::Qt_5_0);
+    encode (out, n);
+    return records;
+}
+
+bool DocumentSnapshot::read (Node *root, const QString &file) {
+    reset ();
+    QFile f (file);
+    if (!f.open (QIODevice::ReadOnly))
+        return false;
+    const qint64 size = f.size ();
+    uchar *map = f.map (0, size);
+    const QByteArray data = map
+        ? QByteArray::fromRawData ((const char *) map, size)
+        : f.readAll ();
+    QDataStream in (data);
+    in.setVersion (QDataStream::Qt_5_0);
+    quint32 magic, version;
+    in >> magic >> version;
+    if (magic != snapshot_magic || version != snapshot_version) {
+        qCDebug(LOG_KMPLAYER_COMMON) << "DocumentSnapshot: ignoring " << file;
+        return false;
+    }
+    // a bad edit ends the snapshot before it, then the image and the
+    // edits before that are read again
+    qint64 end = data.size ();
+    QVector <QString> strings;
+    bool truncated = false;
+    while (true) {
+        const qint64 start = in.device ()->pos ();
+        bool ok = true;
+        qint64 bad = -1;
+        while (ok && in.device ()->pos () < end) {
+            const qint64 segment = in.device ()->pos ();
+            quint32 kind, length;
+            in >> kind >> length;
+            const qint64 pos = in.device ()->pos ();
+            if (in.status () != QDataStream::Ok || pos + length > end) {
+                qCWarning(LOG_KMPLAYER_COMMON) << "DocumentSnapshot: ignoring the incomplete tail of " << file;
+                truncated = true; // an edit that wasn't completely written
+                break;
+            }
+            const quint32 expected = m_root_digest.isEmpty ()
+                ? segment_image : segment_splices;
+            ok = kind == expected && readSegment (root, kind,
+                    QByteArray::fromRawData (data.constData () + pos, length), strings);
+            if (!ok)
+                bad = segment;
+            else if (segment_image == kind)
+                m_image_size = length;
+            else
+                m_journal_size += length;
+            in.skipRawData (length);
+        }
+        if (ok && !m_root_digest.isEmpty ())
+            break;
+        if (ok || !m_image_size) { // the image itself is bad
+            qCWarning(LOG_KMPLAYER_COMMON) << "DocumentSnapshot: corrupt " << file;
+            root->clearChildren ();
+            reset ();
+            if (map)
+                f.unmap (map);
+            return false;
+        }
+        qCWarning(LOG_KMPLAYER_COMMON) << "DocumentSnapshot: ignoring the edits from offset " << bad << " of " << file;
+        root->clearChildren ();
+        reset ();
+        strings.clear ();
+        truncated = true;
+        end = bad;
+        in.device ()->seek (start);
+        in.resetStatus ();
+    }
+    if (map)
+        f.unmap (map);
+    m_file = file;
+    m_file_size = data.size ();
+    m_new_strings.clear ();
+    m_appendable = !truncated;
+    qCDebug(LOG_KMPLAYER_COMMON) << "DocumentSnapshot: read " << file << " " << strings.size () << " strings " << m_digests.size () << " children";
+    return true;
+}
+
+bool DocumentSnapshot::readSegment (Node *root, quint32 kind,
+        const QByteArray &payload, QVector <QString> &strings) {
+    QDataStream in (payload);
+    in.setVersion (QDataStream::Qt_5_0);
+    quint32 count;
+    in >> count;
+    for (quint32 i = 0; i < count && in.status () == QDataStream::Ok; ++i) {
+        QString s;
+        in >> s;
+        m_string_index.insert (s, strings.size ());
+        strings.append (s);
+    }
+    if (in.status () != QDataStream::Ok)
+        return false;
+
+    QIODevice *dev = in.device ();
+    quint8 record;
+    if (segment_image == kind) {
+        QString tag;
+        AttributeList attrs;
+        const qint64 root_start = dev->pos ();
+        in >> record;
+        if (record_start != record || !readStart (in, strings, tag, attrs))
+            return false;
+        m_root_digest = digest (payload.mid (root_start, dev->pos () - root_start));
+        if (root->isElementNode ())
+            static_cast <Element *> (root)->setAttributes (attrs);
+        root->opened ();
+        while (true) {
+            const qint64 start = dev->pos ();
+            in >> record;
+            if (in.status () != QDataStream::Ok)
+                return false;
+            if (record_end == record)
+                break;
+            if (!readChild (in, strings, root, record))
+                return false;
+            m_digests.append (digest (payload.mid (start, dev->pos () - start)));
+        }
+        root->closed ();
+        return true;
+    }
+
+    quint32 splices;
+    in >> splices;
+    for (quint32 i = 0; i < splices; ++i) {
+        quint32 pos, removed, inserted;
+        in >> pos >> removed >> inserted;
+        if (in.status () != QDataStream::Ok ||
+                pos + removed > (quint32) m_digests.size ())
+            return false;
+        Node *before = root->firstChild ();
+        for (quint32 k = 0; k < pos && before; ++k)
+            before = before->nextSibling ();
+        for (quint32 k = 0; k < removed && before; ++k) {
+            NodePtr c = before;
+            before = before->nextSibling ();
+            root->removeChild (c);
+        }
+        m_digests.remove (pos, removed);
+        for (quint32 k = 0; k < inserted; ++k) {
+            const qint64 start = dev->pos ();
+            in >> record;
+            if (in.status () != QDataStream::Ok ||
+                    !readChild (in, strings, root, record))
+                return false;
+            if (before) { // readChild appended it
+                NodePtr c = root->lastChild ();
+                root->removeChild (c);
+                root->insertBefore (c, before);
+            }
+            m_digests.insert (pos + k, digest (payload.mid (start, dev->pos () - start)));
+        }
+    }
+    return in.status () == QDataStream::Ok;
+}
+
+bool DocumentSnapshot::write (Node *root, const QString &file) {
+    if (file != m_file || !QFile::exists (file))
+        m_appendable = false;
+    m_file = file;
+    if (m_appendable && matchesFile () && append (root))
+        return true;
+    return writeAll (root);
+}
+
+/* the file is still what this wrote, eg. not replaced by another instance */
+bool DocumentSnapshot::matchesFile () const {
+    QFile f (m_file);
+    if (!f.open (QIODevice::ReadOnly) || f.size () != m_file_size) {
+        qCDebug(LOG_KMPLAYER_COMMON) << "DocumentSnapshot: " << m_file << " changed, writing it again";
+        return false;
+    }
+    QDataStream in (&f);
+    in.setVersion (QDataStream::Qt_5_0);
+    quint32 magic, version, kind, length;
+    in >> magic >> version >> kind >> length;
+    return in.status () == QDataStream::Ok &&
+        magic == snapshot_magic && version == snapshot_version &&
+        kind == segment_image && length == m_image_size;
+}
+
+bool DocumentSnapshot::append (Node *root) {
+    m_new_strings.clear ();
+    if (digest (startRecord (root)) != m_root_digest)
+        return false;
+
+    QVector <QByteArray> records;
+    QVector <QByteArray> digests;
+    for (Node *c = root->firstChild (); c; c = c->nextSibling ()) {
+        records.append (nodeRecords (c));
+        digests.append (digest (records.last ()));
+    }
+    QHash <QByteArray, QVector <int> > old_positions;
+    for (int i = 0; i < m_digests.size (); ++i)
+        old_positions[m_digests[i]].append (i);
+
+    // walk old and new children, unmatched ones become splices
+    QVector <Splice> splices;
+    bool open = false;
+    int i = 0, j = 0;
+    while (i < m_digests.size () || j < digests.size ()) {
+        if (i < m_digests.size () && j < digests.size () &&
+                m_digests[i] == digests[j]) {
+            ++i;
+            ++j;
+            open = false;
+            continue;
+        }
+        if (!open) {
+            Splice s;
+            s.pos = j;
+            s.removed = 0;
+            splices.append (s);
+            open = true;
+        }
+        Splice &s = splices.last ();
+        int later = -1;
+        if (j < digests.size ()) {
+            const QVector <int> positions = old_positions.value (digests[j]);
+            for (int k = 0; k < positions.size () && later < 0; ++k)
+                if (positions[k] >= i)
+                    later = positions[k];
+        }
+        if (later > -1) { // the old ones before it are removed
+            s.removed += later - i;
+            i = later;
+        } else if (j < digests.size ()) {
+            s.inserted.append (j++);
+        } else {
+            s.removed += m_digests.size () - i;
+            i = m_digests.size ();
+        }
+    }
+    if (splices.isEmpty ())
+        return true;
+
+    QByteArray payload;
+    QDataStream out (&payload, QIODevice::WriteOnly);
+    out.setVersion (QDataStream::Qt_5_0);
+    out << quint32 (m_new_strings.size ());
+    for (int k = 0; k < m_new_strings.size (); ++k)
+        out << m_new_strings[k];
+    out << quint32 (splices.size ());
+    for (int k = 0; k < splices.size (); ++k) {
+        const Splice &s = splices[k];
+        out << quint32 (s.pos) << quint32 (s.removed) << quint32 (s.inserted.size ());
+        for (int n = 0; n < s.inserted.size (); ++n) {
+            const QByteArray &r = records[s.inserted[n]];
+            out.writeRawData (r.constData (), r.size ());
+        }
+    }
+    if (m_journal_size + payload.size () > m_image_size)
+        return false; // cheaper to read it back when written as a whole
+
+    QFile f (m_file);
+    if (!f.open (QIODevice::WriteOnly | QIODevice::Append))
+        return false;
+    QDataStream seg (&f);
+    seg.setVersion (QDataStream::Qt_5_0);
+    seg << quint32 (segment_splices) << quint32 (payload.size ());
+    seg.writeRawData (payload.constData (), payload.size ());
+    f.close ();
+    if (seg.status () != QDataStream::Ok || f.error () != QFileDevice::NoError) {
+        qCWarning(LOG_KMPLAYER_COMMON) << "DocumentSnapshot: can't append to " << m_file;
+        return false;
+    }
+    m_digests = digests;
+    m_journal_size += payload.size ();
+    m_file_size += segment_header_size + payload.size ();
+    m_new_strings.clear ();
+    qCDebug(LOG_KMPLAYER_COMMON) << "DocumentSnapshot: appended " << splices.size () << " edits, " << payload.size () << " bytes";
+    return true;
+}
+
+bool DocumentSnapshot::writeAll (Node *root) {
+    const QString file = m_file;
+    reset ();
+    m_file = file;
+
+    const QByteArray start = startRecord (root);
+    QVector <QByteArray> records;
+    for (Node *c = root->firstChild (); c; c = c->nextSibling ())
+        records.append (nodeRecords (c));
+
+    QByteArray payload;
+    QDataStream out (&payload, QIODevice::WriteOnly);
+    out.setVersion (QDataStream::Qt_5_0);
+    out << quint32 (m_new_strings.size ());
+    for (int i = 0; i < m_new_strings.size (); ++i)
+        out << m_new_strings[i];
+    out.writeRawData (start.constData (), start.size ());
+    for (int i = 0; i < records.size (); ++i)
+        out.writeRawData (records[i].constData (), records[i].size ());
+    out << quint8 (record_end);
+
+    QDir ().mkpath (QFileInfo (m_file).absolutePath ());
+    QSaveFile f (m_file);
+    if (!f.open (QIODevice::WriteOnly)) {
+        qCWarning(LOG_KMPLAYER_COMMON) << "DocumentSnapshot: can't write " << m_file;
+        return false;
+    }
+    QDataStream seg (&f);
+    seg.setVersion (QDataStream::Qt_5_0);
+    seg << snapshot_magic << snapshot_version;
+    seg << quint32 (segment_image) << quint32 (payload.size ());
+    seg.writeRawData (payload.constData (), payload.size ());
+    if (seg.status () != QDataStream::Ok || !f.commit ()) {
+        qCWarning(LOG_KMPLAYER_COMMON) << "DocumentSnapshot: can't write " << m_file;
+        return false;
+    }
+    m_root_digest = digest (start);
+    for (int i = 0; i < records.size (); ++i)
+        m_digests.append (digest (records[i]));
+    m_image_size = payload.size ();
+    m_file_size = header_size + segment_header_size + m_image_size;
+    m_new_strings.clear ();
+    m_appendable = true;
+    return true;
+}
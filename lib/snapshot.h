@@ -0,0 +1,74 @@
+/*
+    This file belong to the KMPlayer project, a movie player plugin for Konqueror
+    SPDX-FileCopyrightText: 2026 The KMPlayer authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#ifndef _KMPLAYER_SNAPSHOT_H_
+#define _KMPLAYER_SNAPSHOT_H_
+
+#include "config-kmplayer.h"
+
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include "kmplayercommon_export.h"
+#include "kmplayerplaylist.h"
+
+class QDataStream;
+
+namespace KMPlayer {
+
+/*
+ * Binary image of a document tree, a faster alternative to its xml. The
+ * file has a table of the strings and flat records of the nodes in
+ * document order. Later changes are appended as edits of the top level
+ * children, when those get larger than the image itself the file is
+ * written again as a whole, also when the file isn't the one read or
+ * written last anymore.
+ */
+class KMPLAYERCOMMON_EXPORT DocumentSnapshot
+{
+public:
+    DocumentSnapshot ();
+
+    /* reads file into the empty root, false if it isn't a valid snapshot */
+    bool read (Node *root, const QString &file);
+    /* stores root in file, appends the changes if it was read or written */
+    bool write (Node *root, const QString &file);
+
+private:
+    struct Splice {
+        int pos;
+        int removed;
+        QVector <int> inserted;
+    };
+    void reset () KMPLAYERCOMMON_NO_EXPORT;
+    quint32 intern (const QString &s) KMPLAYERCOMMON_NO_EXPORT;
+    void encodeStart (QDataStream &out, Node *n) KMPLAYERCOMMON_NO_EXPORT;
+    void encode (QDataStream &out, Node *n) KMPLAYERCOMMON_NO_EXPORT;
+    QByteArray startRecord (Node *n) KMPLAYERCOMMON_NO_EXPORT;
+    QByteArray nodeRecords (Node *n) KMPLAYERCOMMON_NO_EXPORT;
+    bool readSegment (Node *root, quint32 kind, const QByteArray &payload, QVector <QString> &strings) KMPLAYERCOMMON_NO_EXPORT;
+    bool matchesFile () const KMPLAYERCOMMON_NO_EXPORT;
+    bool append (Node *root) KMPLAYERCOMMON_NO_EXPORT;
+    bool writeAll (Node *root) KMPLAYERCOMMON_NO_EXPORT;
+
+    QString m_file;
+    QHash <QString, quint32> m_string_index;
+    QStringList m_new_strings;     // interned after the last write
+    QByteArray m_root_digest;
+    QVector <QByteArray> m_digests; // of the top level children in the file
+    qint64 m_image_size;
+    qint64 m_journal_size;
+    qint64 m_file_size; // as read or written here
+    bool m_appendable;
+};
+
+} // namespace
+
+#endif
@@ -0,0 +1,227 @@
+/*
+    This file belong to the KMPlayer project, a movie player plugin for Konqueror
+    SPDX-FileCopyrightText: 2026 The KMPlayer authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "config-kmplayer.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <QThread>
+#include <QTimerEvent>
+#include <QUrl>
+
+#include <KShell>
+
+#include "kmplayercommon_log.h"
+#include "thumbnailer.h"
+
+using namespace KMPlayer;
+
+static const int grab_timeout = 30000; // ms, for a hanging backend
+static const qint64 max_cache_size = 32 * 1024 * 1024;
+
+Thumbnailer::Thumbnailer (QObject *parent, int max_workers)
+ : QObject (parent),
+   m_cache_dir (QStandardPaths::writableLocation (QStandardPaths::GenericCacheLocation) + "/kmplayer/thumbnails"),
+   m_program ("mplayer"),
+   m_max_workers (max_workers > 0 ? max_workers : qMax (1, QThread::idealThreadCount ())) {
+    QDir ().mkpath (m_cache_dir);
+    pruneCache ();
+}
+
+Thumbnailer::~Thumbnailer () {
+    clearQueue ();
+    const QList <Job *>::iterator e = m_running.end ();
+    for (QList <Job *>::iterator i = m_running.begin (); i != e; ++i) {
+        (*i)->process->disconnect (this);
+        delete (*i)->process; // kills the process
+        delete (*i)->dir;
+        delete *i;
+    }
+    m_running.clear ();
+}
+
+void Thumbnailer::pruneCache () {
+    // the most recently grabbed are kept, down to three quarters
+    QDir dir (m_cache_dir);
+    const QFileInfoList files = dir.entryInfoList (QStringList ("*.jpg"), QDir::Files, QDir::Time);
+    qint64 size = 0;
+    const QFileInfoList::const_iterator e = files.constEnd ();
+    for (QFileInfoList::const_iterator i = files.constBegin (); i != e; ++i)
+        size += i->size ();
+    if (size <= max_cache_size)
+        return;
+    size = 0;
+    int removed = 0;
+    for (QFileInfoList::const_iterator i = files.constBegin (); i != e; ++i) {
+        size += i->size ();
+        if (size > max_cache_size * 3 / 4 && dir.remove (i->fileName ()))
+            ++removed;
+    }
+    qCDebug(LOG_KMPLAYER_COMMON) << "Thumbnailer: removed " << removed << " cached frames";
+}
+
+QString Thumbnailer::cacheFile (const QString &url, int position) const {
+    const QUrl u = QUrl::fromUserInput (url);
+    if (!u.isLocalFile ())
+        return QString ();
+    QFileInfo fi (u.toLocalFile ());
+    if (!fi.isFile ())
+        return QString ();
+    QByteArray key = u.url ().toUtf8 ();
+    key.append ('\n');
+    key.append (QByteArray::number (fi.lastModified ().toMSecsSinceEpoch ()));
+    key.append ('\n');
+    key.append (QByteArray::number (fi.size ()));
+    const QByteArray hash = QCryptographicHash::hash (key, QCryptographicHash::Md5).toHex ();
+    return QString ("%1/%2_%3.jpg").arg (m_cache_dir).arg (QString::fromLatin1 (hash)).arg (position);
+}
+
+QString Thumbnailer::cachedFile (const QString &url, int position) const {
+    const QString file = cacheFile (url, position);
+    if (!file.isEmpty () && QFile::exists (file))
+        return file;
+    return QString ();
+}
+
+bool Thumbnailer::request (const QString &url, int position) {
+    const QString file = cacheFile (url, position);
+    if (file.isEmpty ())
+        return false;
+    if (m_requested.contains (file))
+        return true;
+    m_requested.insert (file);
+    Job *job = new Job;
+    job->url = url;
+    job->file = file;
+    job->position = position;
+    job->process = nullptr;
+    job->dir = nullptr;
+    job->timer = 0;
+    // the last requested are the ones currently visible, do these first
+    m_queue.prepend (job);
+    startJobs ();
+    return true;
+}
+
+void Thumbnailer::request (const QString &url, const QList <int> &positions) {
+    const QList <int>::const_iterator e = positions.constEnd ();
+    for (QList <int>::const_iterator i = positions.constBegin (); i != e; ++i)
+        if (cachedFile (url, *i).isEmpty ())
+            request (url, *i);
+}
+
+void Thumbnailer::clearQueue () {
+    const QList <Job *>::iterator e = m_queue.end ();
+    for (QList <Job *>::iterator i = m_queue.begin (); i != e; ++i) {
+        m_requested.remove ((*i)->file);
+        delete *i;
+    }
+    m_queue.clear ();
+}
+
+void Thumbnailer::startJobs () {
+    while (m_running.size () < m_max_workers && !m_queue.isEmpty ()) {
+        Job *job = m_queue.takeFirst ();
+        job->dir = new QTemporaryDir (m_cache_dir + "/grab-XXXXXX");
+        if (!job->dir->isValid ()) {
+            qCCritical(LOG_KMPLAYER_COMMON) << "Thumbnailer: failed to create temporary directory in " << m_cache_dir;
+            m_running.append (job);
+            finishJob (job, false);
+            return;
+        }
+        QStringList args;
+        QString jpgopts ("jpeg:outdir=");
+        jpgopts += KShell::quoteArg (job->dir->path ());
+        args << "-vo" << jpgopts;
+        args << "-frames" << "1" << "-nosound" << "-quiet";
+        if (job->position > 0)
+            args << "-ss" << QString::number (job->position);
+        args << QUrl::fromUserInput (job->url).toLocalFile ();
+        job->process = new QProcess (this);
+        connect (job->process, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished),
+                this, &Thumbnailer::workerFinished);
+        connect (job->process, &QProcess::errorOccurred,
+                this, &Thumbnailer::workerError);
+        job->timer = startTimer (grab_timeout);
+        m_running.append (job);
+        job->process->start (m_program, args);
+    }
+}
+
+Thumbnailer::Job *Thumbnailer::runningJob (QObject *process) const {
+    const QList <Job *>::const_iterator e = m_running.constEnd ();
+    for (QList <Job *>::const_iterator i = m_running.constBegin (); i != e; ++i)
+        if ((*i)->process == process)
+            return *i;
+    return nullptr;
+}
+
+void Thumbnailer::finishJob (Job *job, bool ok) {
+    m_running.removeAll (job);
+    m_requested.remove (job->file);
+    if (job->timer)
+        killTimer (job->timer);
+    if (job->process) {
+        job->process->disconnect (this);
+        job->process->deleteLater ();
+    }
+    if (ok) {
+        ok = false;
+        QDir dir (job->dir->path ());
+        const QStringList files = dir.entryList (QDir::Files, QDir::Name);
+        if (!files.isEmpty ()) {
+            QFile::remove (job->file);
+            ok = QFile::rename (dir.filePath (files.first ()), job->file);
+        }
+    }
+    delete job->dir; // removes left over frames
+    const QString url = job->url;
+    const QString file = job->file;
+    const int position = job->position;
+    delete job;
+    if (ok)
+        Q_EMIT ready (url, position, file);
+    else
+        Q_EMIT failed (url, position);
+    startJobs ();
+}
+
+void Thumbnailer::workerFinished (int, QProcess::ExitStatus status) {
+    Job *job = runningJob (sender ());
+    if (job)
+        finishJob (job, QProcess::NormalExit == status);
+}
+
+void Thumbnailer::workerError (QProcess::ProcessError err) {
+    if (QProcess::FailedToStart == err) { // no finished() signal follows
+        Job *job = runningJob (sender ());
+        if (job) {
+            qCWarning(LOG_KMPLAYER_COMMON) << "Thumbnailer: failed to start " << m_program;
+            finishJob (job, false);
+        }
+    }
+}
+
+void Thumbnailer::timerEvent (QTimerEvent *e) {
+    const QList <Job *>::const_iterator end = m_running.constEnd ();
+    for (QList <Job *>::const_iterator i = m_running.constBegin (); i != end; ++i)
+        if ((*i)->timer == e->timerId ()) {
+            killTimer ((*i)->timer);
+            (*i)->timer = 0;
+            qCDebug(LOG_KMPLAYER_COMMON) << "Thumbnailer: timeout grabbing " << (*i)->url;
+            (*i)->process->kill (); // finished() follows with CrashExit
+            return;
+        }
+    QObject::timerEvent (e);
+}
+
+#include "moc_thumbnailer.cpp"
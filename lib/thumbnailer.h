@@ -0,0 +1,84 @@
+/*
+    This file belong to the KMPlayer project, a movie player plugin for Konqueror
+    SPDX-FileCopyrightText: 2026 The KMPlayer authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#ifndef _KMPLAYER_THUMBNAILER_H_
+#define _KMPLAYER_THUMBNAILER_H_
+
+#include "config-kmplayer.h"
+
+#include <QObject>
+#include <QString>
+#include <QList>
+#include <QSet>
+#include <QProcess>
+
+#include "kmplayercommon_export.h"
+
+class QTemporaryDir;
+
+namespace KMPlayer {
+
+/*
+ * Extracts frames of local media files with a bounded pool of mplayer
+ * processes. Results are kept in an on-disk cache, keyed by url, mtime,
+ * size and position, so a grab is done only once per file version. The
+ * oldest are removed on startup when the cache gets too large.
+ */
+class KMPLAYERCOMMON_EXPORT Thumbnailer : public QObject
+{
+    Q_OBJECT
+public:
+    Thumbnailer (QObject *parent, int max_workers = 0);
+    ~Thumbnailer () override;
+
+    /* request frames at positions in seconds, ready() or failed() follows
+     * for each one not already in the cache, see cachedFile() */
+    void request (const QString &url, const QList <int> &positions);
+    /* returns false if url can't be grabbed, eg. not a local file */
+    bool request (const QString &url, int position);
+    /* cache file name if the grab is already done, otherwise null */
+    QString cachedFile (const QString &url, int position) const;
+    /* drop all queued requests, running workers are finished */
+    void clearQueue ();
+    void setProgram (const QString &exe) { m_program = exe; }
+    int pending () const { return m_queue.size () + m_running.size (); }
+
+Q_SIGNALS:
+    void ready (const QString &url, int position, const QString &file);
+    void failed (const QString &url, int position);
+
+private Q_SLOTS:
+    void workerFinished (int, QProcess::ExitStatus) KMPLAYERCOMMON_NO_EXPORT;
+    void workerError (QProcess::ProcessError) KMPLAYERCOMMON_NO_EXPORT;
+
+private:
+    struct Job {
+        QString url;
+        QString file;
+        int position;
+        QProcess *process;
+        QTemporaryDir *dir;
+        int timer;
+    };
+    QString cacheFile (const QString &url, int position) const KMPLAYERCOMMON_NO_EXPORT;
+    void pruneCache () KMPLAYERCOMMON_NO_EXPORT;
+    void startJobs () KMPLAYERCOMMON_NO_EXPORT;
+    void finishJob (Job *job, bool ok) KMPLAYERCOMMON_NO_EXPORT;
+    Job *runningJob (QObject *process) const KMPLAYERCOMMON_NO_EXPORT;
+    void timerEvent (QTimerEvent *e) override KMPLAYERCOMMON_NO_EXPORT;
+
+    QList <Job *> m_queue;
+    QList <Job *> m_running;
+    QSet <QString> m_requested;
+    QString m_cache_dir;
+    QString m_program;
+    int m_max_workers;
+};
+
+} // namespace
+
+#endif
@@ -0,0 +1,434 @@
+/*
+    This file belong to the KMPlayer project, a movie player plugin for Konqueror
+    SPDX-FileCopyrightText: 2026 The KMPlayer authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "config-kmplayer.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <QDir>
+#include <QSocketNotifier>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <QTimerEvent>
+
+#include "kmplayercommon_log.h"
+#include "timeshift.h"
+
+using namespace KMPlayer;
+
+static const qint64 segment_size = 4 * 1024 * 1024;
+static const int feed_chunk = 64 * 1024;
+static const int sync_scan = 256 * 1024; // max bytes to look for a pack header
+static const int progress_interval = 1000; // ms
+
+TimeShiftBuffer::TimeShiftBuffer (const QString &dir, qint64 seg_size, int max_segments)
+ : m_dir (dir),
+   m_segment_size (seg_size),
+   m_max_segments (qMax (1, max_segments)),
+   m_next_number (0),
+   m_read_number (-1) {}
+
+TimeShiftBuffer::~TimeShiftBuffer () {
+    close ();
+}
+
+bool TimeShiftBuffer::open () {
+    close ();
+    if (!QDir ().mkpath (m_dir))
+        return false;
+    m_clock.start ();
+    return true;
+}
+
+void TimeShiftBuffer::close () {
+    m_write_file.close ();
+    m_read_file.close ();
+    m_read_number = -1;
+    const QList <Segment>::const_iterator e = m_segments.constEnd ();
+    for (QList <Segment>::const_iterator i = m_segments.constBegin (); i != e; ++i)
+        QFile::remove (segmentFile ((*i).number));
+    m_segments.clear ();
+    m_clock.invalidate ();
+}
+
+QString TimeShiftBuffer::segmentFile (int number) const {
+    return QString ("%1/segment-%2.mpg").arg (m_dir).arg (number, 6, 10, QChar ('0'));
+}
+
+qint64 TimeShiftBuffer::begin () const {
+    return m_segments.isEmpty () ? 0 : m_segments.first ().offset;
+}
+
+qint64 TimeShiftBuffer::end () const {
+    if (m_segments.isEmpty ())
+        return 0;
+    const Segment &s = m_segments.last ();
+    return s.offset + s.size;
+}
+
+qint64 TimeShiftBuffer::startTime () const {
+    return m_segments.isEmpty () ? 0 : m_segments.first ().start_time;
+}
+
+qint64 TimeShiftBuffer::write (const char *data, qint64 len) {
+    if (!m_clock.isValid ())
+        return -1;
+    if (m_segments.isEmpty () || m_segments.last ().size >= m_segment_size) {
+        Segment s;
+        s.number = m_next_number++;
+        s.offset = end ();
+        s.size = 0;
+        s.start_time = elapsed ();
+        m_write_file.close ();
+        m_write_file.setFileName (segmentFile (s.number));
+        if (!m_write_file.open (QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Unbuffered))
+            return -1;
+        m_segments.append (s);
+        while (m_segments.size () > m_max_segments) {
+            // a reader of this segment keeps it open until it moves on
+            QFile::remove (segmentFile (m_segments.first ().number));
+            m_segments.removeFirst ();
+        }
+    }
+    const qint64 n = m_write_file.write (data, len);
+    if (n > 0)
+        m_segments.last ().size += n;
+    return n;
+}
+
+int TimeShiftBuffer::segmentIndex (qint64 pos) const {
+    if (m_segments.isEmpty () || pos < begin () || pos >= end ())
+        return -1;
+    int lo = 0;
+    int hi = m_segments.size () - 1;
+    while (lo < hi) {
+        const int mid = (lo + hi + 1) / 2;
+        if (m_segments[mid].offset <= pos)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+qint64 TimeShiftBuffer::read (qint64 pos, char *data, qint64 len) {
+    const int i = segmentIndex (pos);
+    if (i < 0)
+        return pos == end () ? 0 : -1;
+    const Segment &s = m_segments[i];
+    if (m_read_number != s.number) {
+        m_read_file.close ();
+        m_read_file.setFileName (segmentFile (s.number));
+        if (!m_read_file.open (QIODevice::ReadOnly | QIODevice::Unbuffered)) {
+            m_read_number = -1;
+            return -1;
+        }
+        m_read_number = s.number;
+    }
+    const qint64 off = pos - s.offset;
+    if (!m_read_file.seek (off))
+        return -1;
+    return m_read_file.read (data, qMin (len, s.size - off));
+}
+
+qint64 TimeShiftBuffer::positionAt (qint64 msec) const {
+    if (m_segments.isEmpty () || msec <= startTime ())
+        return begin ();
+    int lo = 0;
+    int hi = m_segments.size () - 1;
+    while (lo < hi) {
+        const int mid = (lo + hi + 1) / 2;
+        if (m_segments[mid].start_time <= msec)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    const Segment &s = m_segments[lo];
+    const qint64 t1 = lo + 1 < m_segments.size ()
+        ? m_segments[lo + 1].start_time
+        : elapsed ();
+    if (t1 <= s.start_time)
+        return s.offset;
+    return qMin (s.offset + s.size * (msec - s.start_time) / (t1 - s.start_time), end ());
+}
+
+qint64 TimeShiftBuffer::timeAt (qint64 pos) const {
+    if (pos >= end ())
+        return elapsed ();
+    const int i = segmentIndex (pos);
+    if (i < 0)
+        return startTime ();
+    const Segment &s = m_segments[i];
+    const qint64 t1 = i + 1 < m_segments.size ()
+        ? m_segments[i + 1].start_time
+        : elapsed ();
+    return s.start_time + (t1 - s.start_time) * (pos - s.offset) / qMax (s.size, qint64 (1));
+}
+
+//-----------------------------------------------------------------------------
+
+TimeShift::TimeShift (QObject *parent, qint64 max_size)
+ : QObject (parent),
+   m_dir (nullptr),
+   m_buffer (nullptr),
+   m_capture (nullptr),
+   m_in_notifier (nullptr),
+   m_out_notifier (nullptr),
+   m_max_size (max_size),
+   m_read_pos (0),
+   m_out_offset (0),
+   m_in_fd (-1),
+   m_in_keep_fd (-1),
+   m_out_fd (-1),
+   m_timer (0) {}
+
+TimeShift::~TimeShift () {
+    stop ();
+}
+
+void TimeShift::setCapture (const QString &program, const QStringList &args) {
+    m_program = program;
+    m_args = args;
+}
+
+QString TimeShift::playbackFile () const {
+    return m_dir ? m_dir->filePath ("playback.fifo") : QString ();
+}
+
+bool TimeShift::start () {
+    if (m_capture && m_running_args == m_args)
+        return true;
+    stop ();
+    if (m_program.isEmpty ())
+        return false;
+    // not in tempPath, that is often a small tmpfs
+    const QString cache = QStandardPaths::writableLocation (QStandardPaths::CacheLocation);
+    QDir ().mkpath (cache);
+    m_dir = new QTemporaryDir (cache + "/timeshift-XXXXXX");
+    if (!m_dir->isValid ()) {
+        qCCritical(LOG_KMPLAYER_COMMON) << "TimeShift: failed to create temporary directory";
+        stop ();
+        return false;
+    }
+    const QString in_file = m_dir->filePath ("capture.fifo");
+    const QByteArray in_path = QFile::encodeName (in_file);
+    const QByteArray out_path = QFile::encodeName (playbackFile ());
+    if (::mkfifo (in_path.constData (), 0600) ||
+            ::mkfifo (out_path.constData (), 0600)) {
+        qCCritical(LOG_KMPLAYER_COMMON) << "TimeShift: failed to create fifos in " << m_dir->path ();
+        stop ();
+        return false;
+    }
+    // keep a write end of our own, so there's no EOF before the capture
+    // process has opened the fifo
+    m_in_fd = ::open (in_path.constData (), O_RDONLY | O_NONBLOCK);
+    if (m_in_fd > -1)
+        m_in_keep_fd = ::open (in_path.constData (), O_WRONLY | O_NONBLOCK);
+    // opened read-write so writes don't fail before the player opened it,
+    // and stale data can be drained on a seek
+    m_out_fd = ::open (out_path.constData (), O_RDWR | O_NONBLOCK);
+    if (m_in_fd < 0 || m_in_keep_fd < 0 || m_out_fd < 0) {
+        qCCritical(LOG_KMPLAYER_COMMON) << "TimeShift: failed to open fifos in " << m_dir->path ();
+        stop ();
+        return false;
+    }
+    // at least two segments, smaller ones if max_size is small
+    const int segments = qMax (qint64 (2), m_max_size / segment_size);
+    m_buffer = new TimeShiftBuffer (m_dir->filePath ("buffer"),
+            qMax (qint64 (feed_chunk), m_max_size / segments), segments);
+    if (!m_buffer->open ()) {
+        qCCritical(LOG_KMPLAYER_COMMON) << "TimeShift: failed to open buffer in " << m_dir->path ();
+        stop ();
+        return false;
+    }
+    m_read_pos = 0;
+    m_out_buf.clear ();
+    m_out_offset = 0;
+
+    m_in_notifier = new QSocketNotifier (m_in_fd, QSocketNotifier::Read, this);
+    connect (m_in_notifier, QOverload<int>::of(&QSocketNotifier::activated),
+            this, &TimeShift::captureReady);
+    m_out_notifier = new QSocketNotifier (m_out_fd, QSocketNotifier::Write, this);
+    m_out_notifier->setEnabled (false);
+    connect (m_out_notifier, QOverload<int>::of(&QSocketNotifier::activated),
+            this, &TimeShift::playbackReady);
+
+    QStringList args = m_args;
+    args.replaceInStrings (QString ("%o"), in_file);
+    m_capture = new QProcess (this);
+    m_capture->setStandardOutputFile (QProcess::nullDevice ());
+    m_capture->setStandardErrorFile (QProcess::nullDevice ());
+    connect (m_capture, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished),
+            this, &TimeShift::captureFinished);
+    m_running_args = m_args;
+    qCDebug(LOG_KMPLAYER_COMMON) << "TimeShift: " << m_program << " " << args.join (" ");
+    m_capture->start (m_program, args);
+    if (!m_capture->waitForStarted ()) {
+        qCWarning(LOG_KMPLAYER_COMMON) << "TimeShift: failed to start " << m_program;
+        stop ();
+        return false;
+    }
+    m_timer = startTimer (progress_interval);
+    return true;
+}
+
+void TimeShift::stop () {
+    if (m_timer) {
+        killTimer (m_timer);
+        m_timer = 0;
+    }
+    if (m_capture) {
+        m_capture->disconnect (this);
+        m_capture->terminate ();
+        if (!m_capture->waitForFinished (1000))
+            m_capture->kill ();
+        m_capture->deleteLater (); // might be called from its finished()
+        m_capture = nullptr;
+    }
+    closeFifos (); // player sees EOF
+    delete m_buffer;
+    m_buffer = nullptr;
+    delete m_dir;
+    m_dir = nullptr;
+    m_running_args.clear ();
+}
+
+void TimeShift::closeFifos () {
+    delete m_in_notifier;
+    m_in_notifier = nullptr;
+    delete m_out_notifier;
+    m_out_notifier = nullptr;
+    if (m_in_fd > -1)
+        ::close (m_in_fd);
+    if (m_in_keep_fd > -1)
+        ::close (m_in_keep_fd);
+    if (m_out_fd > -1)
+        ::close (m_out_fd);
+    m_in_fd = m_in_keep_fd = m_out_fd = -1;
+    m_out_buf.clear ();
+    m_out_offset = 0;
+}
+
+void TimeShift::captureReady () {
+    char buf[feed_chunk];
+    for (int i = 0; i < 16; ++i) { // don't starve the event loop
+        const ssize_t n = ::read (m_in_fd, buf, sizeof (buf));
+        if (n <= 0)
+            break;
+        if (m_buffer->write (buf, n) < 0) {
+            qCCritical(LOG_KMPLAYER_COMMON) << "TimeShift: write error, stopping";
+            stop ();
+            return;
+        }
+    }
+    if (m_read_pos < m_buffer->begin ()) // paused longer than buffered
+        m_read_pos = syncPosition (m_buffer->begin ());
+    if (!m_out_notifier->isEnabled ())
+        feedPlayback ();
+}
+
+void TimeShift::playbackReady () {
+    feedPlayback ();
+}
+
+void TimeShift::feedPlayback () {
+    if (m_out_fd < 0)
+        return;
+    for (;;) {
+        if (m_out_offset >= m_out_buf.size ()) {
+            m_out_buf.resize (feed_chunk);
+            qint64 n = m_buffer->read (m_read_pos, m_out_buf.data (), feed_chunk);
+            if (n < 0) { // dropped meanwhile
+                m_read_pos = syncPosition (m_buffer->begin ());
+                n = qMax (m_buffer->read (m_read_pos, m_out_buf.data (), feed_chunk), qint64 (0));
+            }
+            m_out_buf.resize (int (n));
+            m_out_offset = 0;
+            if (!n) { // at the live edge, captureReady() continues
+                m_out_notifier->setEnabled (false);
+                return;
+            }
+            m_read_pos += n;
+        }
+        const ssize_t n = ::write (m_out_fd,
+                m_out_buf.constData () + m_out_offset,
+                m_out_buf.size () - m_out_offset);
+        if (n < 0) {
+            if (EINTR == errno)
+                continue;
+            if (EAGAIN != errno)
+                qCWarning(LOG_KMPLAYER_COMMON) << "TimeShift: playback write error " << errno;
+            // paused or player still busy, wait for room in the fifo
+            m_out_notifier->setEnabled (EAGAIN == errno);
+            return;
+        }
+        m_out_offset += n;
+    }
+}
+
+void TimeShift::flushPlayback () {
+    char buf[4096];
+    while (::read (m_out_fd, buf, sizeof (buf)) > 0)
+        ;
+    m_out_buf.clear ();
+    m_out_offset = 0;
+}
+
+qint64 TimeShift::syncPosition (qint64 pos) {
+    // start at an MPEG pack header, so the demuxer resyncs quickly
+    QByteArray buf (sync_scan, 0);
+    const qint64 n = m_buffer->read (pos, buf.data (), sync_scan);
+    if (n > 0) {
+        const int i = buf.left (int (n)).indexOf (QByteArray ("\x00\x00\x01\xba", 4));
+        if (i > -1)
+            return pos + i;
+    }
+    return pos;
+}
+
+bool TimeShift::seek (int pos, bool absolute) {
+    if (!m_buffer || m_out_fd < 0)
+        return false;
+    qint64 msec = 100LL * pos;
+    msec += absolute ? m_buffer->startTime () : m_buffer->timeAt (m_read_pos);
+    msec = qBound (m_buffer->startTime (), msec, m_buffer->elapsed ());
+    flushPlayback ();
+    m_read_pos = syncPosition (m_buffer->positionAt (msec));
+    feedPlayback ();
+    Q_EMIT progress (position (), length ());
+    return true;
+}
+
+void TimeShift::catchUp () {
+    seek (length (), true);
+}
+
+int TimeShift::length () const {
+    return m_buffer ? int ((m_buffer->elapsed () - m_buffer->startTime ()) / 100) : 0;
+}
+
+int TimeShift::position () const {
+    return m_buffer ? int ((m_buffer->timeAt (m_read_pos) - m_buffer->startTime ()) / 100) : 0;
+}
+
+void TimeShift::captureFinished (int code, QProcess::ExitStatus) {
+    qCDebug(LOG_KMPLAYER_COMMON) << "TimeShift: capture finished " << code;
+    stop ();
+}
+
+void TimeShift::timerEvent (QTimerEvent *e) {
+    if (e->timerId () == m_timer)
+        Q_EMIT progress (position (), length ());
+    else
+        QObject::timerEvent (e);
+}
+
+#include "moc_timeshift.cpp"
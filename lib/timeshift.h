@@ -0,0 +1,148 @@
+/*
+    This file belong to the KMPlayer project, a movie player plugin for Konqueror
+    SPDX-FileCopyrightText: 2026 The KMPlayer authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#ifndef _KMPLAYER_TIMESHIFT_H_
+#define _KMPLAYER_TIMESHIFT_H_
+
+#include "config-kmplayer.h"
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QList>
+#include <QByteArray>
+#include <QFile>
+#include <QElapsedTimer>
+#include <QProcess>
+
+#include "kmplayercommon_export.h"
+
+class QSocketNotifier;
+class QTemporaryDir;
+
+namespace KMPlayer {
+
+/*
+ * Fixed size on-disk ring buffer, made of segment files. Byte positions are
+ * counted from the start of the recording, times in ms since open(). When
+ * the maximum number of segments is reached, the oldest one is dropped.
+ */
+class KMPLAYERCOMMON_EXPORT TimeShiftBuffer
+{
+public:
+    struct Segment {
+        int number;
+        qint64 offset;      // byte position of first byte
+        qint64 size;
+        qint64 start_time;  // ms since open()
+    };
+
+    TimeShiftBuffer (const QString &dir, qint64 segment_size, int max_segments);
+    ~TimeShiftBuffer ();
+
+    bool open ();
+    void close ();
+    /* append to the last segment, returns -1 on a write error */
+    qint64 write (const char *data, qint64 len);
+    /* read at byte position pos, returns -1 if pos is not buffered (anymore) */
+    qint64 read (qint64 pos, char *data, qint64 len);
+
+    /* byte position for time in ms, interpolated inside its segment */
+    qint64 positionAt (qint64 msec) const;
+    /* time in ms for byte position pos */
+    qint64 timeAt (qint64 pos) const;
+
+    qint64 begin () const;
+    qint64 end () const;
+    qint64 startTime () const;
+    qint64 elapsed () const { return m_clock.isValid () ? m_clock.elapsed () : 0; }
+    const QList <Segment> &segments () const { return m_segments; }
+
+private:
+    QString segmentFile (int number) const;
+    int segmentIndex (qint64 pos) const;
+
+    QString m_dir;
+    QList <Segment> m_segments;
+    QFile m_write_file;
+    QFile m_read_file;
+    QElapsedTimer m_clock;
+    qint64 m_segment_size;
+    int m_max_segments;
+    int m_next_number;
+    int m_read_number;
+};
+
+/*
+ * Time shifting of a live source. A capture process writes the stream to
+ * a fifo, which is recorded into a TimeShiftBuffer. A second fifo, see
+ * playbackFile(), is fed from a read position in that buffer, so playback
+ * can be paused, rewound and can catch up with the live stream again.
+ */
+class KMPLAYERCOMMON_EXPORT TimeShift : public QObject
+{
+    Q_OBJECT
+public:
+    TimeShift (QObject *parent, qint64 max_size);
+    ~TimeShift () override;
+
+    /* the capture command, the %o in args is replaced by the output file */
+    void setCapture (const QString &program, const QStringList &args);
+    /* player options to use instead of the source's while capturing */
+    void setPlaybackOptions (const QString &options) { m_playback_options = options; }
+    QString playbackOptions () const { return m_playback_options; }
+    /* (re)starts capturing if not running or the capture command changed */
+    bool start ();
+    void stop ();
+    bool running () const { return !!m_capture; }
+    QString playbackFile () const;
+
+    /* seek pos in deci-seconds, absolute from the oldest buffered data */
+    bool seek (int pos, bool absolute);
+    /* jump to the live stream */
+    void catchUp ();
+    /* buffered and playback position in deci-seconds */
+    int length () const;
+    int position () const;
+
+Q_SIGNALS:
+    void progress (int position, int length);
+
+private Q_SLOTS:
+    void captureReady () KMPLAYERCOMMON_NO_EXPORT;
+    void playbackReady () KMPLAYERCOMMON_NO_EXPORT;
+    void captureFinished (int, QProcess::ExitStatus) KMPLAYERCOMMON_NO_EXPORT;
+
+private:
+    void feedPlayback () KMPLAYERCOMMON_NO_EXPORT;
+    void flushPlayback () KMPLAYERCOMMON_NO_EXPORT;
+    void closeFifos () KMPLAYERCOMMON_NO_EXPORT;
+    qint64 syncPosition (qint64 pos) KMPLAYERCOMMON_NO_EXPORT;
+    void timerEvent (QTimerEvent *e) override KMPLAYERCOMMON_NO_EXPORT;
+
+    QString m_program;
+    QStringList m_args;
+    QStringList m_running_args;
+    QString m_playback_options;
+    QTemporaryDir *m_dir;
+    TimeShiftBuffer *m_buffer;
+    QProcess *m_capture;
+    QSocketNotifier *m_in_notifier;
+    QSocketNotifier *m_out_notifier;
+    QByteArray m_out_buf;
+    qint64 m_max_size;
+    qint64 m_read_pos;
+    int m_out_offset;
+    int m_in_fd;
+    int m_in_keep_fd;
+    int m_out_fd;
+    int m_timer;
+};
+
+} // namespace
+
+#endif
@@ -0,0 +1,192 @@
+/*
+    This file belong to the KMPlayer project, a movie player plugin for Konqueror
+    SPDX-FileCopyrightText: 2026 The KMPlayer authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "config-kmplayer.h"
+
+#include <QTimerEvent>
+
+#include "kmplayercommon_log.h"
+#include "watchdog.h"
+
+using namespace KMPlayer;
+
+static const int check_interval = 5000; // ms
+static const qint64 hang_timeout = 30000; // ms without output while playing
+static const int arm_beats = 10; // backends that never report aren't checked
+static const int max_failures = 3; // in a row, before skipping the item
+static const int max_backoff = 30000; // ms
+
+ProcessWatchdog::ProcessWatchdog (MediaManager *manager)
+ : m_manager (manager),
+   m_check_timer (0) {}
+
+ProcessWatchdog::~ProcessWatchdog () {
+}
+
+QString ProcessWatchdog::statisticsKey (AudioVideoMedia *media) const {
+    Mrl *mrl = media->mrl ();
+    if (!mrl || !media->process)
+        return QString ();
+    return QString (media->process->process_info->name) + QChar (' ') +
+        mrl->absolutePath ();
+}
+
+AudioVideoMedia *ProcessWatchdog::media (IProcess *process) const {
+    const MediaManager::MediaList &ml = m_manager->medias ();
+    const MediaManager::MediaList::const_iterator e = ml.constEnd ();
+    for (MediaManager::MediaList::const_iterator i = ml.constBegin (); i != e; ++i)
+        if (MediaManager::AudioVideo == (*i)->type () &&
+                static_cast <AudioVideoMedia *> (*i)->process == process)
+            return static_cast <AudioVideoMedia *> (*i);
+    return nullptr;
+}
+
+void ProcessWatchdog::heartbeat (IProcess *process, int pos) {
+    QHash <IProcess *, Supervised>::iterator i = m_processes.find (process);
+    if (i == m_processes.end ())
+        return;
+    i.value ().last_beat.start ();
+    i.value ().beats++;
+    if (pos > 0)
+        i.value ().position = pos;
+}
+
+void ProcessWatchdog::stateChange (AudioVideoMedia *media,
+        IProcess::State olds, IProcess::State news) {
+    IProcess *p = media->process;
+    if (IProcess::Playing == news) {
+        Supervised &s = m_processes[p];
+        if (s.node.ptr () != media->mrl ()) {
+            s = Supervised ();
+            s.node = media->mrl ();
+        }
+        s.last_beat.start ();
+        s.beats = 0;
+        s.hung = false;
+        if (s.resume > 0) {
+            qCDebug(LOG_KMPLAYER_COMMON) << "ProcessWatchdog: resume at " << s.resume;
+            p->seek (s.resume, true);
+            s.resume = -1;
+        }
+        if (!m_check_timer)
+            m_check_timer = startTimer (check_interval);
+    } else if (IProcess::Playing == olds && news < IProcess::Buffering) {
+        QHash <IProcess *, Supervised>::iterator i = m_processes.find (p);
+        if (i != m_processes.end ())
+            i.value ().beats = 0; // no longer checked for hangs
+    }
+}
+
+bool ProcessWatchdog::restart (AudioVideoMedia *media) {
+    if (AudioVideoMedia::ask_stop == media->request ||
+            AudioVideoMedia::ask_delete == media->request)
+        return false;
+    const QString key = statisticsKey (media);
+    QHash <IProcess *, Supervised>::iterator i = m_processes.find (media->process);
+    if (key.isEmpty () || i == m_processes.end ())
+        return false; // never got playing
+    Supervised &s = i.value ();
+    Statistics &st = m_statistics[key];
+    if (!s.hung)
+        st.crashes++;
+    s.hung = false;
+    if (++st.failures >= max_failures) {
+        qCWarning(LOG_KMPLAYER_COMMON) << "ProcessWatchdog: giving up on " << key;
+        return false;
+    }
+    if (s.restart_timer)
+        killTimer (s.restart_timer);
+    const int backoff = qMin (max_backoff, 1000 << (st.failures - 1));
+    s.resume = s.position;
+    s.restart_timer = startTimer (backoff);
+    qCDebug(LOG_KMPLAYER_COMMON) << "ProcessWatchdog: restart " << key << " in " << backoff << "ms at " << s.resume;
+    return true;
+}
+
+void ProcessWatchdog::finished (AudioVideoMedia *media) {
+    const QString key = statisticsKey (media);
+    QHash <QString, Statistics>::iterator i = m_statistics.find (key);
+    if (i != m_statistics.end ())
+        i.value ().failures = 0;
+    QHash <IProcess *, Supervised>::iterator si = m_processes.find (media->process);
+    if (si != m_processes.end ()) {
+        si.value ().position = -1;
+        si.value ().resume = -1;
+    }
+}
+
+bool ProcessWatchdog::poisoned (AudioVideoMedia *media) const {
+    QHash <QString, Statistics>::const_iterator i = m_statistics.constFind (statisticsKey (media));
+    return i != m_statistics.constEnd () && i.value ().failures >= max_failures;
+}
+
+void ProcessWatchdog::processDestroyed (IProcess *process) {
+    QHash <IProcess *, Supervised>::iterator i = m_processes.find (process);
+    if (i != m_processes.end ()) {
+        if (i.value ().restart_timer)
+            killTimer (i.value ().restart_timer);
+        m_processes.erase (i);
+    }
+}
+
+ProcessWatchdog::Statistics ProcessWatchdog::statistics (const QString &url, const QString &backend) const {
+    return m_statistics.value (backend + QChar (' ') + url);
+}
+
+void ProcessWatchdog::timerEvent (QTimerEvent *e) {
+    if (e->timerId () == m_check_timer) {
+        QList <IProcess *> hanging;
+        bool playing = false;
+        const MediaManager::ProcessList &pl = m_manager->processes ();
+        const QHash <IProcess *, Supervised>::iterator end = m_processes.end ();
+        for (QHash <IProcess *, Supervised>::iterator i = m_processes.begin (); i != end; ++i) {
+            IProcess *p = i.key ();
+            if (!pl.contains (p) || IProcess::Playing != p->state ())
+                continue;
+            playing = true;
+            Supervised &s = i.value ();
+            if (s.beats >= arm_beats && s.last_beat.elapsed () > hang_timeout) {
+                AudioVideoMedia *av = media (p);
+                if (!av)
+                    continue;
+                qCWarning(LOG_KMPLAYER_COMMON) << "ProcessWatchdog: " << p->process_info->name << " hangs";
+                s.hung = true;
+                s.beats = 0;
+                m_statistics[statisticsKey (av)].hangs++;
+                p->crashed = true;
+                hanging.append (p);
+            }
+        }
+        if (!playing) {
+            killTimer (m_check_timer);
+            m_check_timer = 0;
+        }
+        const QList <IProcess *>::const_iterator he = hanging.constEnd ();
+        for (QList <IProcess *>::const_iterator i = hanging.constBegin (); i != he; ++i)
+            (*i)->quit (); // stateChange follows, which restarts it
+        return;
+    }
+    const QHash <IProcess *, Supervised>::iterator end = m_processes.end ();
+    for (QHash <IProcess *, Supervised>::iterator i = m_processes.begin (); i != end; ++i)
+        if (i.value ().restart_timer == e->timerId ()) {
+            killTimer (e->timerId ());
+            i.value ().restart_timer = 0;
+            IProcess *p = i.key ();
+            AudioVideoMedia *av = media (p);
+            if (av && av->mrl () && i.value ().node.ptr () == av->mrl () &&
+                    AudioVideoMedia::ask_stop != av->request &&
+                    AudioVideoMedia::ask_delete != av->request) {
+                if (p->state () < IProcess::Ready)
+                    p->ready ();
+                av->play ();
+            }
+            return;
+        }
+    QObject::timerEvent (e);
+}
+
+#include "moc_watchdog.cpp"
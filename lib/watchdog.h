@@ -0,0 +1,79 @@
+/*
+    This file belong to the KMPlayer project, a movie player plugin for Konqueror
+    SPDX-FileCopyrightText: 2026 The KMPlayer authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#ifndef _KMPLAYER_WATCHDOG_H_
+#define _KMPLAYER_WATCHDOG_H_
+
+#include "config-kmplayer.h"
+
+#include <QObject>
+#include <QString>
+#include <QHash>
+#include <QElapsedTimer>
+
+#include "kmplayercommon_export.h"
+#include "mediaobject.h"
+
+namespace KMPlayer {
+
+/*
+ * Supervises the playing backends. A backend that crashed, or that went
+ * silent while playing, is restarted with exponential backoff and seeks
+ * back to the last reported position. Failures are counted per url and
+ * backend, an item failing too often in a row is skipped from then on.
+ */
+class KMPLAYERCOMMON_EXPORT ProcessWatchdog : public QObject
+{
+    Q_OBJECT
+public:
+    struct Statistics {
+        Statistics () : crashes (0), hangs (0), failures (0) {}
+        int crashes;
+        int hangs;
+        int failures; // in a row, reset after playing to the end
+    };
+
+    ProcessWatchdog (MediaManager *manager);
+    ~ProcessWatchdog () override;
+
+    /* backend reported output or a position, pos in deci-seconds or -1 */
+    void heartbeat (IProcess *process, int pos = -1);
+    void stateChange (AudioVideoMedia *media, IProcess::State olds, IProcess::State news);
+    /* returns true if a restart is scheduled for a crashed backend */
+    bool restart (AudioVideoMedia *media);
+    /* item played to the end */
+    void finished (AudioVideoMedia *media);
+    /* item failed too often, don't play it anymore */
+    bool poisoned (AudioVideoMedia *media) const;
+    void processDestroyed (IProcess *process);
+    Statistics statistics (const QString &url, const QString &backend) const;
+
+private:
+    struct Supervised {
+        Supervised ()
+            : beats (0), position (-1), resume (-1), restart_timer (0), hung (false) {}
+        QElapsedTimer last_beat;
+        NodePtrW node;
+        int beats;
+        int position;
+        int resume;
+        int restart_timer;
+        bool hung;
+    };
+    QString statisticsKey (AudioVideoMedia *media) const KMPLAYERCOMMON_NO_EXPORT;
+    AudioVideoMedia *media (IProcess *process) const KMPLAYERCOMMON_NO_EXPORT;
+    void timerEvent (QTimerEvent *e) override KMPLAYERCOMMON_NO_EXPORT;
+
+    MediaManager *m_manager;
+    QHash <IProcess *, Supervised> m_processes;
+    QHash <QString, Statistics> m_statistics;
+    int m_check_timer;
+};
+
+} // namespace
+
+#endif